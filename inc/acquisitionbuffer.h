@@ -2,11 +2,25 @@
 #pragma once
 
 #include "acquisitionbufferchannel.h"
+#include "samplering.h"
 #include <QObject>
-#include <atomic_queue/atomic_queue.h>
-#include <functional>
-#include <map>
+#include <atomic>
+#include <memory>
+#include <vector>
 
+/**
+ * @brief The buffer between the acquisition thread (producer) and the sample processing thread (consumer). Each watch
+ * entry has a channel holding a SampleRing.
+ *
+ * The table of channels is an immutable snapshot. Adding or removing a channel (GUI thread only) copies the table,
+ * publishes the copy with an atomic pointer swap, and retires the old one. Producer and consumer look up channels
+ * without locks: each of them announces the table epoch it entered at, and a retired table is only freed once neither
+ * of them can still be looking at it. So channels can be added and removed while acquisition is running.
+ *
+ * When a ring is full, the channel's overflow policy decides what to give up. With SpillToDisk, samples that don't
+ * fit go to a second ring laid out in a block of the disk backed storage, and are drained after the main ring, once
+ * the consumer catches up. The producer keeps spilling until the spill ring is empty, so samples stay in order.
+ */
 class AcquisitionBuffer : public QObject, public IAcquisitionBufferChannel {
     Q_OBJECT
 public:
@@ -15,28 +29,175 @@ public:
     using Clock = std::chrono::steady_clock;
     using Timepoint = Clock::time_point;
 
+    /// @brief What a channel does with new samples when its ring is full.
+    enum class OverflowPolicy {
+        DropNewest,  ///< Drop the new samples
+        DropOldest,  ///< Evict a chunk of the oldest samples to make room
+        Decimate,    ///< Keep every 2nd sample until the ring is half empty again
+        SpillToDisk, ///< Put them in the spill ring, or drop the new samples if the channel doesn't have one
+    };
+    Q_ENUM(OverflowPolicy);
+
+    struct ChannelConfig {
+        size_t capacity = DefaultCapacity; ///< Samples in the ring, rounded up to a power of 2
+        OverflowPolicy overflowPolicy = OverflowPolicy::DropNewest;
+        uint8_t *spillStorage = nullptr; ///< Storage of the spill ring. Not owned, must outlive the channel.
+        size_t spillStorageSize = 0;     ///< In bytes
+    };
+
+    static constexpr size_t DefaultCapacity = 8192;
+    static constexpr size_t MinimumCapacity = 1024;
+    static constexpr size_t MaximumCapacity = 1 << 22;
+
+    /**
+     * @brief Ring capacity that holds headroom worth of samples at the given rate.
+     * @param sampleRate Samples per second. 0 means unlimited, for which a guess of what probes can do is used.
+     */
+    static size_t capacityForRate(double sampleRate, std::chrono::milliseconds headroom);
+
     virtual void addDataPoint(size_t entryId, Timepoint timestamp, Value value) override;
     virtual void acquisitionFrequencyFeedback(size_t entryId, double frequency) override;
 
-    void addChannel(size_t entryId);
+    /// @brief Set the timepoint all sample timestamps are relative to. Only call this when acquisition is not running.
+    void setEpoch(Timepoint epoch) { m_epoch = epoch; }
+    Timepoint epoch() const { return m_epoch; }
+
+    // Channel table modification. GUI thread only.
+    void addChannel(size_t entryId, const ChannelConfig &config);
     void removeChannel(size_t entryId);
-    void drainChannel(size_t entryId, std::function<void(Timepoint, Value)> processor);
+    /// @brief Replace a channel with a new one made from config. Whatever is buffered in the old channel is lost, so
+    /// only call this when acquisition is not running.
+    void reconfigureChannel(size_t entryId, const ChannelConfig &config);
+    /// @brief Change the overflow policy of a channel. Takes effect immediately.
+    void setChannelOverflowPolicy(size_t entryId, OverflowPolicy policy);
+
+    /**
+     * @brief Drain up to maxCount samples of a channel into a contiguous buffer, converted to double.
+     * @param out Anything with double key and value members, such as QCPGraphData. Keys are milliseconds since epoch.
+     * @return Number of samples written to out.
+     */
+    template<typename Point>
+    size_t drainChannel(size_t entryId, Point *out, size_t maxCount) {
+        ReadGuard guard(*this, ConsumerReader);
+        auto channel = guard.table()->find(entryId);
+        if (!channel) {
+            return 0;
+        }
+        auto drained = drainRing(channel->ring, out, maxCount);
+        // Spilled samples are newer than anything in the main ring, so only go there once it has been emptied
+        if (channel->spill && drained < maxCount && !channel->ring.size()) {
+            drained += drainRing(*channel->spill, out + drained, maxCount - drained);
+        }
+        return drained;
+    }
+
+    /// @brief Number of samples that can be drained from the channel right now, 0 if there's no such channel. Call only
+    /// from the draining thread.
+    size_t getChannelBufferedCount(size_t entryId);
+
+    // Channel statistics. GUI thread only.
     double getChannelFrequencyFeedback(size_t entryId);
+    /// @brief Number of samples lost to overflow (dropped, evicted or decimated), since the channel was configured.
+    size_t getChannelOverflowCount(size_t entryId);
+    /// @brief Number of samples that went through the spill ring, since the channel was configured.
+    size_t getChannelSpilledCount(size_t entryId);
 
     static double valueToDouble(Value value);
     static double timepointToMillisecond(Timepoint reference, Timepoint timepoint);
 
 private:
-    static constexpr size_t Size = 8192;
-    using ChannelQueue = atomic_queue::AtomicQueueB2<std::tuple<Timepoint, Value>>;
+    /// @brief Fraction of the ring evicted at once with DropOldest. Evicting in chunks keeps the consumer from
+    /// having to throw away what it's reading on every new sample.
+    static constexpr size_t EvictionDivisor = 16;
+    /// @brief Sample rate assumed for channels without a frequency limit.
+    static constexpr double UnlimitedSampleRate = 20000;
+
     struct Channel {
-        Channel() : queue(Size) {} // FIXME: Make queue size editable in settings
-        ChannelQueue queue;
-        double frequencyFeedback;
-        bool overflowFlag;
+        Channel(const ChannelConfig &config);
+        SampleRing ring;
+        std::unique_ptr<SampleRing> spill; ///< Null if the channel has no spill storage
+        std::atomic<OverflowPolicy> overflowPolicy;
+        std::atomic<double> frequencyFeedback = NAN;
+        std::atomic<size_t> overflowCount{0}; ///< Written by acquisition thread, read by anyone
+        std::atomic<size_t> spilledCount{0};  ///< Written by acquisition thread, read by anyone
+
+        // Acquisition thread only
+        bool overflowFlag = false; ///< Overflowing right now. Only the first overflow of a run is logged.
+        bool spilling = false;     ///< New samples go to the spill ring until it's empty
+        bool decimating = false;
+        bool decimationPhase = false;
+    };
+
+    /// @brief Never modified once published. Channels are shared between consecutive tables.
+    struct ChannelTable {
+        std::vector<size_t> entryIds; ///< Sorted
+        std::vector<std::shared_ptr<Channel>> channels;
+
+        Channel *find(size_t entryId) const;
+    };
+
+    struct RetiredTable {
+        std::unique_ptr<const ChannelTable> table;
+        uint64_t epoch; ///< Table epoch right after this table was unpublished
+    };
+
+    /// @brief Threads that look up channels without locking. There's exactly one of each.
+    enum Reader { ProducerReader, ConsumerReader, ReaderCount };
+
+    /**
+     * @brief Read-side critical section of the channel table. While a guard is alive, the table it loaded won't be
+     * freed. Not reentrant: a reader must not hold two guards at once.
+     */
+    class ReadGuard {
+    public:
+        ReadGuard(AcquisitionBuffer &buffer, Reader reader) : m_announcement(buffer.m_readerEpochs[reader].epoch) {
+            // Announce first, then load. Anything retired before our announcement is gone from m_table by now.
+            m_announcement.store(buffer.m_tableEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            m_table = buffer.m_table.load(std::memory_order_seq_cst);
+        }
+        ~ReadGuard() { m_announcement.store(0, std::memory_order_release); }
+        const ChannelTable *table() const { return m_table; }
+
+    private:
+        std::atomic<uint64_t> &m_announcement;
+        const ChannelTable *m_table;
+    };
+
+    /// @brief Look up a channel in a table. Logs an error and returns nullptr if there's no such channel.
+    static Channel *findChannel(const ChannelTable *table, size_t entryId);
+
+    /// @brief Store one sample in a channel according to its overflow policy. Acquisition thread only.
+    void pushSample(Channel *channel, size_t entryId, uint64_t timeUs, SampleRing::ValueKind kind, uint64_t slot);
+    void reportOverflow(Channel *channel, size_t entryId, size_t count);
+
+    template<typename Point>
+    static size_t drainRing(SampleRing &ring, Point *out, size_t maxCount) {
+        return ring.drain(
+            [&](const SampleRing::Span &span) {
+                for (size_t i = 0; i < span.size(); i++) {
+                    out[i].key = double(span.timeBaseUs + span.timestamps[i]) / 1000.0;
+                }
+                SampleRing::convertValues(span.kind, span.values, [out](size_t i, double v) { out[i].value = v; });
+                out += span.size();
+            },
+            [&](size_t count) { out -= count; }, maxCount);
+    }
+
+    /// @brief Replace the current table and retire the old one. GUI thread only.
+    void publishTable(std::unique_ptr<ChannelTable> table);
+    /// @brief Free retired tables no reader can be looking at anymore. GUI thread only.
+    void reclaimTables();
+
+private:
+    std::atomic<const ChannelTable *> m_table;
+    std::atomic<uint64_t> m_tableEpoch = 1; ///< Bumped each time a table is retired. 0 is reserved for "not reading".
+    struct alignas(64) ReaderEpoch {
+        std::atomic<uint64_t> epoch = 0; ///< Table epoch the reader entered at, or 0 when it's not reading
     };
+    ReaderEpoch m_readerEpochs[ReaderCount];
+    std::vector<RetiredTable> m_retiredTables;
 
-    std::map<size_t, Channel> m_channels;
+    Timepoint m_epoch;
 
 signals:
     /// @brief Emitted when frequency feedback was set for a channel. PLEASE Connect with QueuedConnection!
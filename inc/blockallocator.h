@@ -0,0 +1,139 @@
+
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Hands out block sequence numbers of DiskBackedStorage. Free blocks are tracked by a hierarchical bitmap: a set
+ * bit in the bottom level is a free block, and a set bit in each level above means the word below it has a free bit.
+ * Allocation follows the lowest set bits from the top down with count-trailing-zeros, freeing sets the bit and its
+ * summary bits; both are O(levels), which is 3 for up to 256K blocks. There is no free list to keep coalesced, adjacent
+ * free blocks are simply adjacent bits.
+ *
+ * The lowest free block is always allocated first, so a growing file is filled from the front.
+ */
+class BlockAllocator {
+public:
+    static constexpr uint64_t NoBlock = std::numeric_limits<uint64_t>::max();
+
+    BlockAllocator() = default;
+    explicit BlockAllocator(uint64_t blockCount) { reset(blockCount); }
+
+    /// @brief Resize to blockCount blocks, all free.
+    void reset(uint64_t blockCount) {
+        m_blockCount = blockCount;
+        m_allocatedCount = 0;
+        m_levels.clear();
+        if (!blockCount) {
+            m_levels.push_back({0});
+            return;
+        }
+
+        // Bottom level first, then summaries until a level fits in one word
+        auto bits = blockCount;
+        do {
+            auto &level = m_levels.emplace_back((bits + 63) / 64, ~uint64_t(0));
+            if (bits % 64) {
+                level.back() = (uint64_t(1) << (bits % 64)) - 1;
+            }
+            bits = level.size();
+        } while (bits > 1);
+    }
+
+    uint64_t blockCount() const { return m_blockCount; }
+    uint64_t allocatedCount() const { return m_allocatedCount; }
+    uint64_t freeCount() const { return m_blockCount - m_allocatedCount; }
+
+    /// @brief The block allocate() would return, or NoBlock when all blocks are allocated.
+    uint64_t lowestFree() const {
+        if (!m_levels.back()[0]) {
+            return NoBlock;
+        }
+        uint64_t index = 0;
+        for (auto level = m_levels.size(); level-- > 0;) {
+            index = index * 64 + std::countr_zero(m_levels[level][index]);
+        }
+        return index;
+    }
+
+    /// @return The lowest free block, or NoBlock when all blocks are allocated.
+    uint64_t allocate() {
+        auto block = lowestFree();
+        if (block != NoBlock) {
+            claim(block);
+        }
+        return block;
+    }
+
+    /**
+     * @brief Allocate a specific block, such as one found in use when recovering the cache file.
+     * @return false if the block is out of range or already allocated.
+     */
+    bool claim(uint64_t block) {
+        if (block >= m_blockCount || isAllocated(block)) {
+            return false;
+        }
+        // Clear the bit, and the summary bits above it for as long as the word below becomes empty
+        auto index = block;
+        for (auto &level : m_levels) {
+            auto &word = level[index / 64];
+            word &= ~(uint64_t(1) << (index % 64));
+            if (word) {
+                break;
+            }
+            index /= 64;
+        }
+        m_allocatedCount++;
+        return true;
+    }
+
+    /// @return false if the block is out of range or not allocated.
+    bool free(uint64_t block) {
+        if (!isAllocated(block)) {
+            return false;
+        }
+
+        // Set the bit, and the summary bits above it for as long as the word below was empty before
+        auto index = block;
+        for (auto &level : m_levels) {
+            auto &word = level[index / 64];
+            auto wasEmpty = !word;
+            word |= uint64_t(1) << (index % 64);
+            if (!wasEmpty) {
+                break;
+            }
+            index /= 64;
+        }
+        m_allocatedCount--;
+        return true;
+    }
+
+    bool isAllocated(uint64_t block) const {
+        return block < m_blockCount && !(m_levels[0][block / 64] & (uint64_t(1) << (block % 64)));
+    }
+
+    /**
+     * @brief Call f(first, count) for each range of contiguous free blocks, in order. Slow, for debugging only.
+     */
+    template<typename F>
+    void forEachFreeRange(F f) const {
+        uint64_t first = NoBlock;
+        for (uint64_t block = 0; block <= m_blockCount; block++) {
+            bool isFree = block < m_blockCount && !isAllocated(block);
+            if (isFree && first == NoBlock) {
+                first = block;
+            } else if (!isFree && first != NoBlock) {
+                f(first, block - first);
+                first = NoBlock;
+            }
+        }
+    }
+
+private:
+    uint64_t m_blockCount = 0;
+    uint64_t m_allocatedCount = 0;
+    std::vector<std::vector<uint64_t>> m_levels{{0}}; ///< Bottom level first. Set bits are free.
+};
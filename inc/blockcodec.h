@@ -0,0 +1,362 @@
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief How the points in a storage block are encoded. Recorded in each block header.
+ */
+enum class BlockCodec : uint32_t {
+    Raw,        ///< Array of {double key, double value}
+    Compressed, ///< Bit stream written by BlockEncoder
+};
+
+/**
+ * @brief Helpers shared by BlockEncoder and BlockDecoder. The compressed stream is a sequence of 64-bit words, bits
+ * are filled from the most significant end.
+ *
+ * The first point of a block is stored raw, so every block decodes on its own. For the rest of the points:
+ *
+ * Keys are milliseconds, but they come from integer microseconds, so the microseconds are what's encoded, as the
+ * delta of delta to the previous point. Sampling intervals are nearly constant, so most of them are zero:
+ *   0                 delta of delta is 0
+ *   10    + 7 bits    zigzag delta of delta fits in 7 bits
+ *   110   + 12 bits   ...in 12 bits
+ *   1110  + 20 bits   ...in 20 bits
+ *   11110 + 64 bits   ...in 64 bits
+ *   11111 + 64 bits   raw key, for keys that aren't a whole number of microseconds
+ *
+ * Values are doubles, but most channels are integers that vary slowly:
+ *   0                          same bits as the previous value
+ *   10  + 2 bits size + bits   both integers: zigzag delta in 4, 8, 16 or 32 bits
+ *   110 + bits                 XOR with the previous value, within the previous meaningful bits window (Gorilla)
+ *   111 + 5 bits leading zeros + 6 bits length - 1 + bits   XOR with a new window
+ */
+namespace BlockCodecDetail {
+
+/// @brief Worst case size of one point, in bits. Raw first point is 128, the rest at most 69 + 78.
+constexpr size_t MaxPointBits = 160;
+/// @brief Keys beyond this many microseconds are stored raw, so llround() can't overflow.
+constexpr double MaxKeyUs = 0x1p62;
+
+inline uint64_t zigzag(uint64_t v) {
+    return (v << 1) ^ uint64_t(int64_t(v) >> 63);
+}
+inline uint64_t unzigzag(uint64_t v) {
+    return (v >> 1) ^ (0 - (v & 1));
+}
+
+/// @brief Microseconds of a key, if the key is exactly a whole number of microseconds.
+inline bool keyToUs(double key, int64_t &us) {
+    auto scaled = key * 1000.0;
+    if (!(std::abs(scaled) < MaxKeyUs)) {
+        return false;
+    }
+    us = std::llround(scaled);
+    return double(us) / 1000.0 == key;
+}
+
+/// @brief The value as an integer, if it is one and converts back to exactly the same bits.
+inline bool valueToInteger(uint64_t bits, int64_t &integer) {
+    auto value = std::bit_cast<double>(bits);
+    if (!(std::abs(value) <= 0x1p53)) {
+        return false;
+    }
+    integer = int64_t(value);
+    return std::bit_cast<uint64_t>(double(integer)) == bits;
+}
+
+/// @brief Predictor state. Encoder and decoder update it in exactly the same way.
+struct State {
+    uint64_t count = 0;
+    int64_t previousUs = 0;
+    int64_t previousDeltaUs = 0;
+    uint64_t previousValue = 0;
+    bool previousIsInteger = false;
+    int64_t previousInteger = 0;
+    unsigned previousLeading = 64; ///< 64 when there's no window yet
+    unsigned previousTrailing = 0;
+
+    /// @brief Restart key prediction from a raw key.
+    void resetKey(double key) {
+        int64_t us;
+        previousUs = keyToUs(key, us) ? us : previousUs;
+        previousDeltaUs = 0;
+    }
+    void setValue(uint64_t bits) {
+        previousValue = bits;
+        previousIsInteger = valueToInteger(bits, previousInteger);
+    }
+};
+
+} // namespace BlockCodecDetail
+
+/**
+ * @brief Appends points to a block as a compressed bit stream. The encoder state lives outside the block, so keep the
+ * encoder of a block around for as long as points are appended to it.
+ */
+class BlockEncoder {
+public:
+    /**
+     * @brief Start encoding a new block.
+     * @param payload Where the bit stream goes, 8-byte aligned. Needn't be zeroed.
+     * @param bytes Size of payload, a multiple of 8.
+     */
+    void begin(uint8_t *payload, size_t bytes) {
+        m_words = reinterpret_cast<uint64_t *>(payload);
+        m_capacityBits = bytes * 8;
+        m_bitPosition = 0;
+        m_state = {};
+    }
+
+    /// @brief Number of points encoded since begin().
+    uint64_t count() const { return m_state.count; }
+    /// @brief Bits of payload written so far. Bits already written never change, later ones are ORed in after them.
+    size_t usedBits() const { return m_bitPosition; }
+    /// @brief Bytes of payload in use so far.
+    size_t usedBytes() const { return (m_bitPosition + 63) / 64 * 8; }
+
+    /// @return false if the block is full. The point is not encoded then.
+    bool append(double key, double value) {
+        using namespace BlockCodecDetail;
+        if (!m_words || m_bitPosition + MaxPointBits > m_capacityBits) {
+            return false;
+        }
+        auto valueBits = std::bit_cast<uint64_t>(value);
+
+        if (!m_state.count) {
+            write(std::bit_cast<uint64_t>(key), 64);
+            write(valueBits, 64);
+            m_state.resetKey(key);
+            m_state.setValue(valueBits);
+            m_state.count++;
+            return true;
+        }
+
+        appendKey(key);
+        appendValue(valueBits);
+        m_state.count++;
+        return true;
+    }
+
+private:
+    void appendKey(double key) {
+        using namespace BlockCodecDetail;
+        int64_t us;
+        if (!keyToUs(key, us)) {
+            write(0b11111, 5);
+            write(std::bit_cast<uint64_t>(key), 64);
+            m_state.resetKey(key);
+            return;
+        }
+
+        // Wrapping arithmetic, a far off key must not overflow
+        auto delta = uint64_t(us) - uint64_t(m_state.previousUs);
+        auto deltaOfDelta = zigzag(delta - uint64_t(m_state.previousDeltaUs));
+        if (deltaOfDelta == 0) {
+            write(0b0, 1);
+        } else if (deltaOfDelta < (1ull << 7)) {
+            write(0b10, 2);
+            write(deltaOfDelta, 7);
+        } else if (deltaOfDelta < (1ull << 12)) {
+            write(0b110, 3);
+            write(deltaOfDelta, 12);
+        } else if (deltaOfDelta < (1ull << 20)) {
+            write(0b1110, 4);
+            write(deltaOfDelta, 20);
+        } else {
+            write(0b11110, 5);
+            write(deltaOfDelta, 64);
+        }
+        m_state.previousUs = us;
+        m_state.previousDeltaUs = int64_t(delta);
+    }
+
+    void appendValue(uint64_t bits) {
+        using namespace BlockCodecDetail;
+        if (bits == m_state.previousValue) {
+            write(0b0, 1);
+            return;
+        }
+
+        int64_t integer;
+        if (m_state.previousIsInteger && valueToInteger(bits, integer)) {
+            auto delta = zigzag(uint64_t(integer - m_state.previousInteger));
+            if (delta < (1ull << 32)) {
+                unsigned sizeClass = delta < (1ull << 4) ? 0 : delta < (1ull << 8) ? 1 : delta < (1ull << 16) ? 2 : 3;
+                write(0b10, 2);
+                write(sizeClass, 2);
+                write(delta, 4u << sizeClass);
+                m_state.setValue(bits);
+                return;
+            }
+        }
+
+        auto xored = bits ^ m_state.previousValue;
+        auto leading = std::min(unsigned(std::countl_zero(xored)), 31u);
+        auto trailing = unsigned(std::countr_zero(xored));
+        if (m_state.previousLeading != 64 && leading >= m_state.previousLeading &&
+            trailing >= m_state.previousTrailing) {
+            write(0b110, 3);
+            write(xored >> m_state.previousTrailing, 64 - m_state.previousLeading - m_state.previousTrailing);
+        } else {
+            auto meaningful = 64 - leading - trailing;
+            write(0b111, 3);
+            write(leading, 5);
+            write(meaningful - 1, 6);
+            write(xored >> trailing, meaningful);
+            m_state.previousLeading = leading;
+            m_state.previousTrailing = trailing;
+        }
+        m_state.setValue(bits);
+    }
+
+    /// @brief Append the low n bits of value. n is 1 to 64, value must fit in n bits.
+    void write(uint64_t value, unsigned n) {
+        auto index = m_bitPosition / 64;
+        auto used = unsigned(m_bitPosition % 64);
+        auto free = 64 - used;
+        // Words are assigned when first written to, so the payload needn't be zeroed beforehand
+        if (n <= free) {
+            auto bits = value << (free - n);
+            m_words[index] = used ? (m_words[index] | bits) : bits;
+        } else {
+            m_words[index] |= value >> (n - free);
+            m_words[index + 1] = value << (64 - (n - free));
+        }
+        m_bitPosition += n;
+    }
+
+private:
+    uint64_t *m_words = nullptr;
+    size_t m_capacityBits = 0;
+    size_t m_bitPosition = 0;
+    BlockCodecDetail::State m_state;
+};
+
+/**
+ * @brief Decodes the points of a block written by BlockEncoder, front to back.
+ */
+class BlockDecoder {
+public:
+    /**
+     * @param payload The bit stream, 8-byte aligned.
+     * @param count Number of points encoded in it.
+     */
+    BlockDecoder(const uint8_t *payload, uint64_t count)
+        : m_words(reinterpret_cast<const uint64_t *>(payload)), m_remaining(count) {}
+
+    uint64_t remaining() const { return m_remaining; }
+
+    /// @return false when all points have been decoded.
+    bool next(double &key, double &value) {
+        if (!m_remaining) {
+            return false;
+        }
+        m_remaining--;
+
+        if (!m_state.count) {
+            key = std::bit_cast<double>(read(64));
+            auto bits = read(64);
+            value = std::bit_cast<double>(bits);
+            m_state.resetKey(key);
+            m_state.setValue(bits);
+            m_state.count++;
+            return true;
+        }
+
+        key = nextKey();
+        value = std::bit_cast<double>(nextValue());
+        m_state.count++;
+        return true;
+    }
+
+    /**
+     * @brief Decode up to maxCount points.
+     * @param out Anything with double key and value members, such as QCPGraphData.
+     * @return Number of points decoded.
+     */
+    template<typename Point>
+    size_t decode(Point *out, size_t maxCount) {
+        size_t n = 0;
+        while (n < maxCount && next(out[n].key, out[n].value)) {
+            n++;
+        }
+        return n;
+    }
+
+private:
+    double nextKey() {
+        using namespace BlockCodecDetail;
+        uint64_t deltaOfDelta;
+        if (!read(1)) {
+            deltaOfDelta = 0;
+        } else if (!read(1)) {
+            deltaOfDelta = read(7);
+        } else if (!read(1)) {
+            deltaOfDelta = read(12);
+        } else if (!read(1)) {
+            deltaOfDelta = read(20);
+        } else if (!read(1)) {
+            deltaOfDelta = read(64);
+        } else {
+            auto key = std::bit_cast<double>(read(64));
+            m_state.resetKey(key);
+            return key;
+        }
+
+        auto delta = uint64_t(m_state.previousDeltaUs) + unzigzag(deltaOfDelta);
+        auto us = int64_t(uint64_t(m_state.previousUs) + delta);
+        m_state.previousUs = us;
+        m_state.previousDeltaUs = int64_t(delta);
+        return double(us) / 1000.0;
+    }
+
+    uint64_t nextValue() {
+        using namespace BlockCodecDetail;
+        uint64_t bits;
+        if (!read(1)) {
+            return m_state.previousValue;
+        } else if (!read(1)) {
+            auto sizeClass = unsigned(read(2));
+            auto delta = int64_t(unzigzag(read(4u << sizeClass)));
+            bits = std::bit_cast<uint64_t>(double(m_state.previousInteger + delta));
+        } else if (!read(1)) {
+            auto meaningful = 64 - m_state.previousLeading - m_state.previousTrailing;
+            bits = m_state.previousValue ^ (read(meaningful) << m_state.previousTrailing);
+        } else {
+            auto leading = unsigned(read(5));
+            auto meaningful = unsigned(read(6)) + 1;
+            auto trailing = 64 - leading - meaningful;
+            bits = m_state.previousValue ^ (read(meaningful) << trailing);
+            m_state.previousLeading = leading;
+            m_state.previousTrailing = trailing;
+        }
+        m_state.setValue(bits);
+        return bits;
+    }
+
+    /// @brief Read the next n bits, n is 1 to 64.
+    uint64_t read(unsigned n) {
+        auto index = m_bitPosition / 64;
+        auto used = unsigned(m_bitPosition % 64);
+        auto free = 64 - used;
+        auto word = m_words[index] << used;
+        auto result = word >> (64 - n);
+        if (n > free) {
+            result |= m_words[index + 1] >> (64 - (n - free));
+        }
+        m_bitPosition += n;
+        return result;
+    }
+
+private:
+    const uint64_t *m_words;
+    uint64_t m_remaining;
+    size_t m_bitPosition = 0;
+    BlockCodecDetail::State m_state;
+};
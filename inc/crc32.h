@@ -0,0 +1,43 @@
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief CRC-32 (the zlib one, reflected polynomial 0xEDB88320), computed incrementally. Used for checksums in the
+ * cache file.
+ */
+class Crc32 {
+public:
+    void update(const void *data, size_t size) {
+        auto bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; i++) {
+            m_state = Table[(m_state ^ bytes[i]) & 0xFF] ^ (m_state >> 8);
+        }
+    }
+
+    uint32_t value() const { return ~m_state; }
+
+    static uint32_t compute(const void *data, size_t size) {
+        Crc32 crc;
+        crc.update(data, size);
+        return crc.value();
+    }
+
+private:
+    static constexpr std::array<uint32_t, 256> Table = []() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    uint32_t m_state = 0xFFFFFFFFu;
+};
@@ -6,7 +6,6 @@
 #include <QByteArray>
 #include <QVariant>
 #include <QVector>
-#include <functional>
 #include <optional>
 #include <variant>
 
@@ -31,11 +30,21 @@ struct Bytecode {
     bool pushInstruction(Opcode opcode, std::optional<QVariant> immediate);
     bool forwardInstruction(Opcode opcode, std::optional<QVariant> immediate);
     QString disassemble(bool integerInHex = true);
-    ExecutionResult execute(ExecutionState &state,
-                            std::function<ExecutionResult(ExecutionState &, Opcode, ImmType)> runner);
+    /**
+     * @brief Run the bytecode from state.PC. Each instruction is decoded and handed to the runner, which is called as
+     * ExecutionResult runner(ExecutionState &, Opcode, ImmType). The runner is a template parameter so that it's
+     * inlined into the decoding loop, rather than called indirectly on every instruction.
+     * @return Completed when the end of bytecode is reached (the state is reset). Otherwise whatever the runner
+     * returned when it stopped the execution, with state.PC left on that instruction.
+     */
+    template <typename Runner>
+    ExecutionResult execute(ExecutionState &state, Runner &&runner);
     static ExecutionResult genericComputationExecutor(ExecutionState &es, Opcode op, ImmType imm);
 
 private:
+    void decodeImmediate(uint8_t insn, size_t &PC, ImmType &imm) const;
+    void reportInvalidPC(const ExecutionState &state);
+
     static bool checkIfRequiredImmediateValid(Opcode opcode, const std::optional<QVariant> &immediate);
 
     uint16_t handleIntegerImmediates(Opcode opcode, const QVariant immediate);
@@ -46,4 +55,41 @@ private:
     std::variant<uint64_t, int64_t> getIntegerImmediateFromQVariant(const QVariant &immediate);
 };
 
+template <typename Runner>
+Bytecode::ExecutionResult Bytecode::execute(ExecutionState &state, Runner &&runner) {
+    if (state.PC > instructions.size()) {
+        reportInvalidPC(state);
+        state.PC = 0;
+        return InvalidPC;
+    }
+
+    // Try execute all instructions if the executor is satisfied
+    ExecutionResult ret = Completed;
+    for (auto &PC = state.PC; PC < instructions.size(); ++PC) {
+        // Fetch instruction and immediate
+        uint8_t insn = instructions.at(PC);
+        ImmType imm{std::nullopt};
+        decodeImmediate(insn, PC, imm);
+
+        // Give it to execution engine and see if it wants to continue
+        switch (ret = runner(state, Opcode(insn), imm)) {
+            case Completed: break;
+            case Continue: continue;
+            case MemAccess: break;
+            case BeginErrors:
+            case ErrorBreak: break;
+            case InvalidPC: return InvalidPC;
+        }
+        break;
+    }
+
+    // If at last the execution finished, reset the execution state
+    if (state.PC == instructions.size()) {
+        state.resetAll();
+        ret = Completed;
+    }
+
+    return ret;
+}
+
 } // namespace ExpressionEvaluator
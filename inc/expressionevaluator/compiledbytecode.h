@@ -0,0 +1,140 @@
+#pragma once
+
+#include "expressionevaluator/bytecode.h"
+#include "expressionevaluator/executionstate.h"
+#include "opcodes.h"
+#include "result.h"
+#include <cstdint>
+#include <vector>
+
+namespace ExpressionEvaluator {
+
+/**
+ * @brief A decoded instruction. Integer immediates are resolved into 64-bit words (sign extended for signed immediate
+ * opcodes), so the executor never has to look into the constant table.
+ */
+struct CompiledInstruction {
+    Opcode op;
+    uint64_t imm;
+};
+
+/**
+ * @brief CompiledBytecode is the runtime form of a Bytecode. Bytecode is a compact format that is easy to generate and
+ * to rewrite in optimization passes, but each instruction has to be decoded every time it runs. CompiledBytecode is
+ * decoded once, into a flat array of fixed-size instructions, and its executor does no heap allocation, no QVariant
+ * conversion and no opcode set lookups.
+ *
+ * Only instructions that may appear in a runtime bytecode are accepted, that is, the ones that manipulate the stack
+ * and the memory access and return instructions. Instructions that need symbol information must have been removed by
+ * StaticOptimize. The stack depth is also tracked while compiling, and a bytecode that could underflow the stack or
+ * overflow RuntimeState::StackCapacity is rejected, so the executor doesn't need to check on every push and pop.
+ */
+class CompiledBytecode {
+public:
+    /**
+     * @brief Decode a bytecode into its compiled form.
+     * @param bytecode Runtime bytecode.
+     * @return On success: compiled bytecode. On fail: error message.
+     */
+    static Result<CompiledBytecode, QString> compile(Bytecode &bytecode);
+
+    /**
+     * @brief Run the bytecode from state.PC. Stack manipulating instructions are executed in place. Memory access and
+     * return instructions are handed to the runner, called as ExecutionResult runner(RuntimeState &, const
+     * CompiledInstruction &). If the runner returns Bytecode::Continue the execution goes on, otherwise it breaks with
+     * state.PC left on the instruction, so the same instruction is handed to the runner again on next execute.
+     * @return Bytecode::Completed when the end of the bytecode is reached (the state is reset), or whatever the runner
+     * returned when it stopped the execution.
+     */
+    template <typename Runner>
+    Bytecode::ExecutionResult execute(RuntimeState &state, Runner &&runner) const;
+
+    /**
+     * @brief Run the bytecode from state.PC. Memory access and return instructions break the execution with
+     * Bytecode::MemAccess, and the caller carries out the instruction (use at(state.PC)), advances state.PC and calls
+     * execute again to continue.
+     */
+    Bytecode::ExecutionResult execute(RuntimeState &state) const {
+        return execute(state, [](RuntimeState &, const CompiledInstruction &) { return Bytecode::MemAccess; });
+    }
+
+    const CompiledInstruction &at(size_t PC) const { return m_instructions[PC]; }
+    size_t size() const { return m_instructions.size(); }
+    bool isEmpty() const { return m_instructions.empty(); }
+    size_t maxStackDepth() const { return m_maxStackDepth; }
+
+private:
+    void reportInvalidPC(const RuntimeState &state) const;
+
+    std::vector<CompiledInstruction> m_instructions;
+    size_t m_maxStackDepth = 0;
+};
+
+template <typename Runner>
+Bytecode::ExecutionResult CompiledBytecode::execute(RuntimeState &state, Runner &&runner) const {
+    union {
+        uint64_t u;
+        int64_t i;
+    } tmp1, tmp2;
+
+    if (state.PC > m_instructions.size()) {
+        reportInvalidPC(state);
+        state.PC = 0;
+        return Bytecode::InvalidPC;
+    }
+
+    auto &stack = state.stack;
+    for (auto &PC = state.PC; PC < m_instructions.size(); ++PC) {
+        auto &insn = m_instructions[PC];
+        switch (insn.op) {
+            case LoadI16:
+            case LoadU16:
+            case LoadI32:
+            case LoadU32:
+            case LoadI64:
+            case LoadU64: stack.push_back(insn.imm); break;
+            case Add: {
+                uint64_t a = stack.takeLast();
+                stack.back() += a;
+                break;
+            }
+            case AddI16:
+            case AddI32:
+            case AddI64: stack.back() += insn.imm; break;
+            case Mul: {
+                tmp1.u = stack.takeLast();
+                tmp2.u = stack.back();
+                stack.back() = tmp1.i * tmp2.i;
+                break;
+            }
+            case MulI16:
+            case MulI32:
+            case MulI64: {
+                tmp1.u = stack.back();
+                tmp2.u = insn.imm;
+                stack.back() = tmp1.i * tmp2.i;
+                break;
+            }
+            case LogicalShiftRight: stack.back() >>= insn.imm; break;
+            case MaskBitsZeroExtend: stack.back() &= ((~0ull) >> (64 - insn.imm)); break;
+            case MaskBitsSignExtend: {
+                stack.back() &= ((~0ull) >> (64 - insn.imm));
+                if (stack.back() & (1ull << (insn.imm - 1))) {
+                    stack.back() |= ((~0ull) << insn.imm);
+                }
+                break;
+            }
+            default:
+                // Memory access and return
+                if (auto ret = runner(state, insn); ret != Bytecode::Continue) {
+                    return ret;
+                }
+                break;
+        }
+    }
+
+    state.resetAll();
+    return Bytecode::Completed;
+}
+
+} // namespace ExpressionEvaluator
@@ -1,6 +1,6 @@
-
 #pragma once
 
+#include "expressionevaluator/inlinestack.h"
 #include "typerepresentation.h"
 #include <QFlags>
 #include <QVector>
@@ -8,7 +8,12 @@
 
 namespace ExpressionEvaluator {
 
-struct ExecutionState {
+/**
+ * @brief PC and flag registers of the VM, and the stack, which is the only thing that differs between the runtime and
+ * the static VM state.
+ */
+template <typename Stack>
+struct BasicState {
     enum FlagsEnum {
         BaseDefined = 0x01,
         InSingleEvalBlock = 0x02,
@@ -18,16 +23,10 @@ struct ExecutionState {
     };
     Q_DECLARE_FLAGS(Flags, FlagsEnum);
 
-    QVector<uint64_t> stack;
-    size_t PC;
-    IScope::p regBaseScope;
-    IScope::p regTypeScope;
-    IType::p regBaseType;
-    IType::p regType;
+    Stack stack;
+    size_t PC = 0;
     Flags regFlags;
 
-    ExecutionState() : PC(0) { stack.reserve(8); }
-
     void resetAll() {
         PC = 0;
         stack.clear();
@@ -35,4 +34,26 @@ struct ExecutionState {
     }
 };
 
+/**
+ * @brief The part of VM state needed to run a runtime bytecode, i.e. one that has gone through static optimization.
+ * It is trivially copyable, so AcquisitionHub can keep it inline in its entry array. The stack has a fixed capacity,
+ * which CompiledBytecode::compile checks runtime bytecodes against.
+ */
+struct RuntimeState : BasicState<InlineStack<uint64_t, 32>> {
+    static constexpr size_t StackCapacity = decltype(stack)::Capacity;
+};
+
+/**
+ * @brief Full VM state, with the scope and type registers used by the static optimization passes. These run on
+ * bytecode straight from the parser, whose stack depth is up to the user, so the stack grows as needed.
+ */
+struct ExecutionState : BasicState<QVector<uint64_t>> {
+    IScope::p regBaseScope;
+    IScope::p regTypeScope;
+    IType::p regBaseType;
+    IType::p regType;
+
+    ExecutionState() { stack.reserve(8); }
+};
+
 } // namespace ExpressionEvaluator
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QtGlobal>
+#include <cstddef>
+
+namespace ExpressionEvaluator {
+
+/**
+ * @brief A stack with fixed capacity that lives inline in its owner, so it never allocates and is trivially copyable
+ * when T is. The interface follows the subset of QVector the VM uses.
+ *
+ * Bounds are only checked with Q_ASSERT. Runtime bytecodes have their maximum stack depth checked against the
+ * capacity when they are compiled (see CompiledBytecode::compile), so there is nothing to check on each push.
+ */
+template <typename T, size_t N>
+class InlineStack {
+public:
+    static constexpr size_t Capacity = N;
+
+    void push_back(const T &value) {
+        Q_ASSERT(m_size < N);
+        m_data[m_size++] = value;
+    }
+    T takeLast() {
+        Q_ASSERT(m_size > 0);
+        return m_data[--m_size];
+    }
+    void pop_back() {
+        Q_ASSERT(m_size > 0);
+        --m_size;
+    }
+    T &back() {
+        Q_ASSERT(m_size > 0);
+        return m_data[m_size - 1];
+    }
+    const T &back() const {
+        Q_ASSERT(m_size > 0);
+        return m_data[m_size - 1];
+    }
+    T &last() { return back(); }
+    const T &last() const { return back(); }
+    T &operator[](size_t i) {
+        Q_ASSERT(i < m_size);
+        return m_data[i];
+    }
+    const T &operator[](size_t i) const {
+        Q_ASSERT(i < m_size);
+        return m_data[i];
+    }
+
+    T *data() { return m_data; }
+    const T *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    bool empty() const { return m_size == 0; }
+    void clear() { m_size = 0; }
+
+private:
+    T m_data[N];
+    size_t m_size = 0;
+};
+
+} // namespace ExpressionEvaluator
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "expressionevaluator/bytecode.h"
+#include <optional>
+
+namespace ExpressionEvaluator {
+
+/**
+ * @brief A watch expression that reads one fixed address and optionally extracts a bitfield from it. Most expressions
+ * end up like this after static optimization, and AcquisitionHub samples them without running the bytecode at all.
+ */
+struct StaticRead {
+    uint64_t address;
+    size_t width;       ///< Read width in bytes: 1, 2, 4 or 8
+    uint8_t shift;      ///< Logical right shift applied on the word read
+    uint8_t maskBits;   ///< Keep only this many lowest bits. 0 means no masking.
+    bool signExtend;    ///< Sign extend from maskBits after masking
+    Opcode returnOp;    ///< One of the ReturnXX opcodes, decides the result type
+
+    /// @brief Do the same computation as the bytecode would do on the word read from device.
+    uint64_t extract(uint64_t word) const {
+        word >>= shift;
+        if (maskBits) {
+            word &= ((~0ull) >> (64 - maskBits));
+            if (signExtend && (word & (1ull << (maskBits - 1)))) {
+                word |= ((~0ull) << maskBits);
+            }
+        }
+        return word;
+    }
+};
+
+/**
+ * @brief Checks if a runtime bytecode is just a static address read, i.e. in the form of
+ * Load $addr; DerefN; [LogicalShiftRight $n]; [MaskBitsZeroExtend/MaskBitsSignExtend $w]; ReturnXX.
+ *
+ * @param bytecode Runtime bytecode, which has gone through StaticOptimize.
+ * @return The read description if the bytecode matches, otherwise nothing.
+ */
+std::optional<StaticRead> MatchStaticRead(Bytecode &bytecode);
+
+} // namespace ExpressionEvaluator
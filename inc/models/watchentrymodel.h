@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include "acquisitionbuffer.h"
 #include "serialization/workspace.h"
 #include <QAbstractTableModel>
 #include <QVector>
@@ -21,9 +22,12 @@ public:
         Thickness,
         LineStyle,
         FrequencyLimit,
+        OverflowPolicy,
+        Overflows,
 
         MaxColumns,
         FrequencyFeedback,
+        SpilledCount,
         ExpressionOkay,
     };
 
@@ -68,6 +72,20 @@ public:
      */
     void notifyFrequencyFeedbackChanged();
 
+    /**
+     * @brief Refresh the overflow counter display of an entry. Called periodically while acquisition is active.
+     * @param entryId Watch entry ID.
+     */
+    void notifyOverflowCountChanged(size_t entryId);
+
+    /**
+     * @brief This variant is called when acquisition starts and the counters of all entries are reset.
+     */
+    void notifyOverflowCountChanged();
+
+    /// @brief User visible name of an overflow policy.
+    static QString overflowPolicyName(AcquisitionBuffer::OverflowPolicy policy);
+
     /**
      * @brief Called internally by WorkspaceModel to remove an entry from inside of the model
      * @param entryId Watch entry ID.
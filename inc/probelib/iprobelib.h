@@ -79,7 +79,14 @@ public:
     virtual Result<void, Error> writeMemory64(uint64_t address, const QByteArray &data) = 0;
 
     // Scatter-Gather Read
+    /// @brief Sets the list of memory ranges read by readScatterGather(). ProbeScope only calls this when the list
+    /// changes, so a ProbeLib may prepare (and cache) the whole transaction here. Returning an error makes ProbeScope
+    /// fall back to simple burst reads for this session.
     virtual Result<void, Error> setReadScatterGatherList(const QVector<ScatterGatherEntry> &list) = 0;
+    /// @brief Reads all ranges in the scatter-gather list, ideally in a single probe transaction. Whether it is one
+    /// is up to the ProbeLib: simprobe models a single transaction, but psprobe still does one round trip per range
+    /// as libpsprobe has no batched read.
+    /// @return Data of all ranges concatenated in list order.
     virtual ReadResult readScatterGather() = 0;
 };
 } // namespace probelib
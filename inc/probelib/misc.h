@@ -44,11 +44,13 @@ typedef Result<QByteArray, Error> ReadResult;
 
 /**
  * @brief ProbeScope variable acquisition requires scatter-gather read access to memory. This structure defines the
- * scatter gather list entry.
+ * scatter gather list entry. count is in bytes; the data read for all entries is returned concatenated in list order.
  */
 struct ScatterGatherEntry {
     size_t address;
     size_t count;
+
+    bool operator==(const ScatterGatherEntry &other) const = default;
 };
 
 /**
@@ -0,0 +1,269 @@
+
+#pragma once
+
+#include "acquisitionbufferchannel.h"
+#include <algorithm>
+#include <atomic>
+#include <atomic_queue/atomic_queue.h>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <variant>
+
+/**
+ * @brief Single producer, single consumer ring buffer holding the acquired samples of one channel.
+ *
+ * Samples are kept as structure of arrays: a 32-bit timestamp array and a 64-bit value slot array, 12 bytes per
+ * sample in total. A timestamp is the low 32 bits of the microseconds elapsed since the buffer epoch, a value slot
+ * holds the value in its native type, widened to 64 bits (see encode()). The type of the values and the high 32 bits
+ * of timestamps rarely change, so they are not stored per sample. Instead, whenever either of them changes, the
+ * producer posts a segment marker on a small side queue, and the consumer picks it up when it drains up to there.
+ *
+ * The consumer drains in spans: runs of samples that are contiguous in memory and share the same type and time base.
+ *
+ * The producer may also evict the oldest samples when the ring is full (see evictOldest()). Both sides advance the
+ * tail with compare-and-swap, so if the producer evicts samples the consumer is reading, the consumer notices when it
+ * tries to free them, and discards what it has read instead.
+ */
+class SampleRing {
+public:
+    /// @brief Type of values, in the same order as IAcquisitionBufferChannel::Value alternatives.
+    enum class ValueKind : uint8_t { U8, U16, U32, U64, I8, I16, I32, I64, F32, F64, Invalid };
+    static_assert(size_t(ValueKind::Invalid) == std::variant_size_v<IAcquisitionBufferChannel::Value>);
+
+    /// @brief Contiguous run of samples handed out by drain().
+    struct Span {
+        ValueKind kind;
+        uint64_t timeBaseUs; ///< Add this to timestamps to get microseconds since epoch
+        std::span<const uint32_t> timestamps;
+        std::span<const uint64_t> values;
+
+        size_t size() const { return timestamps.size(); }
+    };
+
+    /// @param capacity Number of samples. Rounded up to a power of 2.
+    explicit SampleRing(size_t capacity)
+        : m_capacity(std::bit_ceil(capacity)), m_mask(m_capacity - 1),
+          m_ownedStorage(std::make_unique<uint64_t[]>(storageWords(m_capacity))),
+          m_values(m_ownedStorage.get()), m_timestamps(reinterpret_cast<uint32_t *>(m_values + m_capacity)) {}
+
+    /**
+     * @brief Construct a ring on storage owned by someone else, such as a block of the disk backed storage.
+     * @param capacity Number of samples, must be a power of 2.
+     * @param storage At least storageSize(capacity) bytes, 8-byte aligned. Must outlive the ring.
+     */
+    SampleRing(size_t capacity, void *storage)
+        : m_capacity(capacity), m_mask(m_capacity - 1), m_values(static_cast<uint64_t *>(storage)),
+          m_timestamps(reinterpret_cast<uint32_t *>(m_values + m_capacity)) {}
+
+    /// @brief Bytes of storage a ring of this capacity needs.
+    static constexpr size_t storageSize(size_t capacity) { return storageWords(capacity) * sizeof(uint64_t); }
+    /// @brief Largest capacity that fits in this many bytes of storage.
+    static constexpr size_t capacityForStorage(size_t bytes) {
+        return std::bit_floor(bytes / (sizeof(uint64_t) + sizeof(uint32_t)));
+    }
+
+    size_t capacity() const { return m_capacity; }
+    /// @brief Consumer side. Number of samples that can be drained right now.
+    size_t size() const { return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire); }
+    /// @brief Producer side. Number of samples the consumer hasn't freed yet.
+    size_t producerSize() const {
+        return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire);
+    }
+
+    /// @brief Split a value into its kind and 64-bit slot. Integers are zero or sign extended, floats are bit casted.
+    static uint64_t encode(const IAcquisitionBufferChannel::Value &value, ValueKind &kind) {
+        kind = ValueKind(value.index());
+        return std::visit(
+            [](auto v) -> uint64_t {
+                using T = decltype(v);
+                if constexpr (std::is_same_v<T, float>) {
+                    return std::bit_cast<uint32_t>(v);
+                } else if constexpr (std::is_same_v<T, double>) {
+                    return std::bit_cast<uint64_t>(v);
+                } else if constexpr (std::is_signed_v<T>) {
+                    return uint64_t(int64_t(v));
+                } else {
+                    return uint64_t(v);
+                }
+            },
+            value);
+    }
+
+    /// @brief Convert a run of value slots of the same kind into doubles, calling store(index, value) for each. The
+    /// type dispatch is hoisted out of the loops, so each loop is a plain conversion the compiler can vectorize.
+    template<typename Store>
+    static void convertValues(ValueKind kind, std::span<const uint64_t> values, Store &&store) {
+        const auto n = values.size();
+        const auto in = values.data();
+        switch (kind) {
+            case ValueKind::U8:
+            case ValueKind::U16:
+            case ValueKind::U32:
+            case ValueKind::U64:
+                for (size_t i = 0; i < n; i++)
+                    store(i, double(in[i]));
+                break;
+            case ValueKind::I8:
+            case ValueKind::I16:
+            case ValueKind::I32:
+            case ValueKind::I64:
+                for (size_t i = 0; i < n; i++)
+                    store(i, double(int64_t(in[i])));
+                break;
+            case ValueKind::F32:
+                for (size_t i = 0; i < n; i++)
+                    store(i, double(std::bit_cast<float>(uint32_t(in[i]))));
+                break;
+            case ValueKind::F64:
+                for (size_t i = 0; i < n; i++)
+                    store(i, std::bit_cast<double>(in[i]));
+                break;
+            case ValueKind::Invalid:
+                for (size_t i = 0; i < n; i++)
+                    store(i, double(NAN));
+                break;
+        }
+    }
+
+    /// @brief Convert a run of value slots of the same kind into a double array.
+    static void toDouble(ValueKind kind, std::span<const uint64_t> values, double *out) {
+        convertValues(kind, values, [out](size_t i, double v) { out[i] = v; });
+    }
+
+    /**
+     * @brief Producer side. Append one sample.
+     * @param timeUs Microseconds since epoch.
+     * @return false if the ring is full, and the sample is dropped.
+     */
+    bool push(uint64_t timeUs, ValueKind kind, uint64_t slot) {
+        auto head = m_head.load(std::memory_order_relaxed);
+        if (head - m_cachedTail == m_capacity) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head - m_cachedTail == m_capacity) {
+                return false;
+            }
+        }
+
+        // The marker is posted before the sample is published, so the consumer always sees it in time
+        auto timeHigh = uint32_t(timeUs >> 32);
+        if (kind != m_producerKind || timeHigh != m_producerTimeHigh) {
+            if (!m_segments.try_push(Segment{head, kind, timeHigh})) {
+                return false;
+            }
+            m_producerKind = kind;
+            m_producerTimeHigh = timeHigh;
+        }
+
+        m_timestamps[head & m_mask] = uint32_t(timeUs);
+        m_values[head & m_mask] = slot;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Producer side. Drop up to count of the oldest samples to make room, when the ring is full.
+     * @return Number of samples dropped. 0 if the consumer has freed some samples in the meantime.
+     */
+    size_t evictOldest(size_t count) {
+        auto tail = m_tail.load(std::memory_order_acquire);
+        count = std::min(count, m_head.load(std::memory_order_relaxed) - tail);
+        if (!m_tail.compare_exchange_strong(tail, tail + count, std::memory_order_acq_rel)) {
+            m_cachedTail = tail;
+            return 0;
+        }
+        m_cachedTail = tail + count;
+        return count;
+    }
+
+    /**
+     * @brief Consumer side. Hands out samples in the ring as spans, and frees them once the processor returns.
+     * @param processor Called as processor(const Span &) for each span, in order.
+     * @param discard Called as discard(size_t count) right after the processor, if the span it was given has been
+     * evicted by the producer meanwhile and may have been overwritten. Whatever was made out of the span must be
+     * thrown away; draining carries on from the oldest sample still in the ring.
+     * @param maxCount Stop after this many samples, the rest is left for the next drain.
+     * @return Number of samples drained, not counting discarded ones.
+     */
+    template<typename Processor, typename Discard>
+    size_t drain(Processor &&processor, Discard &&discard, size_t maxCount = SIZE_MAX) {
+        auto tail = m_tail.load(std::memory_order_acquire);
+        const auto head = m_head.load(std::memory_order_acquire);
+        size_t drained = 0;
+
+        // Evictions may move the tail past the head loaded above, so compare as signed distance
+        while (drained < maxCount && ptrdiff_t(head - tail) > 0) {
+            // Apply the markers that begin here or earlier (those of evicted samples), and find out where the next
+            // one begins
+            for (;;) {
+                if (!m_nextSegment) {
+                    Segment segment;
+                    if (m_segments.try_pop(segment)) {
+                        m_nextSegment = segment;
+                    }
+                }
+                if (!m_nextSegment || m_nextSegment->position > tail) {
+                    break;
+                }
+                m_consumerKind = m_nextSegment->kind;
+                m_consumerTimeHigh = m_nextSegment->timeHigh;
+                m_nextSegment.reset();
+            }
+
+            // tail + maxCount would overflow with the default maxCount, so compare distances
+            auto end = head - tail > maxCount - drained ? tail + (maxCount - drained) : head;
+            if (m_nextSegment && m_nextSegment->position < end) {
+                end = m_nextSegment->position;
+            }
+            // A span must not wrap around the end of the arrays
+            auto begin = tail & m_mask;
+            auto count = std::min<size_t>(end - tail, m_capacity - begin);
+
+            processor(Span{m_consumerKind, uint64_t(m_consumerTimeHigh) << 32,
+                           std::span<const uint32_t>(m_timestamps + begin, count),
+                           std::span<const uint64_t>(m_values + begin, count)});
+
+            // On failure, tail is reloaded with where the producer has evicted up to
+            if (m_tail.compare_exchange_strong(tail, tail + count, std::memory_order_acq_rel)) {
+                tail += count;
+                drained += count;
+            } else {
+                discard(count);
+            }
+        }
+
+        return drained;
+    }
+
+private:
+    struct Segment {
+        size_t position; ///< Sample sequence number from which this segment begins
+        ValueKind kind;
+        uint32_t timeHigh;
+    };
+
+    /// @brief Values come first, so they stay 8-byte aligned. Timestamps take half a word each.
+    static constexpr size_t storageWords(size_t capacity) { return capacity + (capacity + 1) / 2; }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<uint64_t[]> m_ownedStorage; ///< Null if the storage is external
+    uint64_t *const m_values;
+    uint32_t *const m_timestamps;
+    atomic_queue::AtomicQueue2<Segment, 64> m_segments;
+
+    // Producer side
+    alignas(64) std::atomic<size_t> m_head = 0; ///< Sequence number of the next sample to write
+    size_t m_cachedTail = 0;
+    ValueKind m_producerKind = ValueKind::Invalid;
+    uint32_t m_producerTimeHigh = 0;
+
+    // Consumer side
+    alignas(64) std::atomic<size_t> m_tail = 0; ///< Sequence number of the next sample to read. See evictOldest().
+    std::optional<Segment> m_nextSegment;
+    ValueKind m_consumerKind = ValueKind::Invalid;
+    uint32_t m_consumerTimeHigh = 0;
+};
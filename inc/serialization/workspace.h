@@ -1,4 +1,6 @@
 
+#pragma once
+
 #include <QColor>
 #include <qjsonstream.h>
 
@@ -0,0 +1,275 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Summary of a run of consecutive points.
+ */
+struct SummaryBucket {
+    double firstKey;
+    double lastKey;
+    double first; ///< Value of the first point
+    double last;  ///< Value of the last point
+    double min;   ///< Smallest value, NaN values left out. +inf if all of them are NaN.
+    double max;   ///< Largest value, NaN values left out. -inf if all of them are NaN.
+    uint64_t count;
+
+    static SummaryBucket of(double key, double value) {
+        auto bucket = SummaryBucket{key,
+                                    key,
+                                    value,
+                                    value,
+                                    std::numeric_limits<double>::infinity(),
+                                    -std::numeric_limits<double>::infinity(),
+                                    1};
+        bucket.include(value);
+        return bucket;
+    }
+
+    void add(double key, double value) {
+        lastKey = key;
+        last = value;
+        include(value);
+        count++;
+    }
+
+    /// @brief Merge a bucket that comes after this one.
+    void merge(const SummaryBucket &next) {
+        lastKey = next.lastKey;
+        last = next.last;
+        min = std::min(min, next.min);
+        max = std::max(max, next.max);
+        count += next.count;
+    }
+
+private:
+    void include(double value) {
+        // Comparisons are false for NaN, so it's left out
+        if (value < min) {
+            min = value;
+        }
+        if (value > max) {
+            max = value;
+        }
+    }
+};
+static_assert(std::is_trivially_copyable_v<SummaryBucket>, "Summary buckets are written to and mapped from files");
+
+/**
+ * @brief Min/max summaries of a channel's points at several resolutions, built incrementally as points are appended.
+ * Level 0 summarizes every BaseBucketSize points, and each level above merges Fanout buckets of the level below, up to
+ * a level with a single bucket. Every level ends with a bucket that's still open for more points.
+ *
+ * Plotting picks the coarsest level that still has a bucket per pixel column, so a zoomed out view of billions of
+ * points only touches a few thousand buckets. Memory is about 75 bytes per BaseBucketSize points.
+ *
+ * Keys must be appended in ascending order. Buckets of points that are gone can be dropped from the front, see
+ * dropBefore(). A pyramid can also be a view of levels kept elsewhere, see view().
+ */
+class SummaryPyramid {
+public:
+    static constexpr uint64_t BaseBucketSize = 1024;
+    static constexpr size_t Fanout = 4;
+
+    using Level = std::span<const SummaryBucket>;
+
+    /**
+     * @brief A pyramid of levels kept elsewhere, such as in a mapped capture file, which must outlive it. Nothing can
+     * be appended to it.
+     * @param levels Level 0 first, as a pyramid that was built by appending has them.
+     */
+    static SummaryPyramid view(std::vector<Level> levels) {
+        SummaryPyramid pyramid;
+        pyramid.m_views = std::move(levels);
+        pyramid.m_isView = true;
+        return pyramid;
+    }
+
+    uint64_t pointCount() const { return isEmpty() ? 0 : totalCount(level(levelCount() - 1)); }
+    bool isEmpty() const { return !levelCount(); }
+    double firstKey() const { return level(0).front().firstKey; }
+    double lastKey() const { return level(0).back().lastKey; }
+    size_t levelCount() const { return m_isView ? m_views.size() : m_levels.size(); }
+    Level level(size_t index) const { return m_isView ? m_views[index] : m_levels[index].kept(); }
+
+    void clear() {
+        m_levels.clear();
+        m_views.clear();
+        m_isView = false;
+    }
+
+    /**
+     * @brief Append points after the ones already summarized. Only the open buckets of each level are rebuilt, so
+     * appending in chunks costs about the same as appending all at once.
+     * @param points Anything with double key and value members, such as QCPGraphData.
+     */
+    template<typename Point>
+    void append(const Point *points, size_t count) {
+        assert(!m_isView);
+        if (!count) {
+            return;
+        }
+        if (m_levels.empty()) {
+            m_levels.emplace_back();
+        }
+
+        auto &base = m_levels[0].buckets;
+        auto dirty = base.empty() ? 0 : m_levels[0].endIndex() - 1; ///< First bucket changed in the level below
+        for (size_t i = 0; i < count; i++) {
+            if (base.empty() || base.back().count == BaseBucketSize) {
+                base.push_back(SummaryBucket::of(points[i].key, points[i].value));
+            } else {
+                base.back().add(points[i].key, points[i].value);
+            }
+        }
+
+        // Rebuild buckets above the changed ones, adding levels until one has a single bucket
+        for (size_t level = 1; m_levels[level - 1].size() > 1; level++) {
+            if (level == m_levels.size()) {
+                // A new level starts above what's left of the level below
+                dirty = m_levels[level - 1].firstIndex() / Fanout;
+                m_levels.emplace_back().offset = dirty;
+            } else {
+                dirty /= Fanout;
+            }
+
+            auto &below = m_levels[level - 1];
+            auto &current = m_levels[level];
+            current.buckets.resize(dirty - current.offset);
+            for (auto i = dirty * Fanout; i < below.endIndex(); i += Fanout) {
+                current.buckets.push_back(below.merged(i, i + Fanout));
+            }
+        }
+    }
+
+    /**
+     * @brief Drop the buckets that end before key, such as those of points recycled from the cache file. Only whole
+     * level 0 buckets go, so the first one left may begin a little before key. The first bucket left on each level
+     * above is rebuilt from what's left below it. The last bucket of a level is always kept.
+     */
+    void dropBefore(double key) {
+        assert(!m_isView);
+        for (auto &level : m_levels) {
+            while (level.size() > 1 && level.buckets[level.begin].lastKey < key) {
+                level.begin++;
+            }
+        }
+        for (size_t i = 1; i < m_levels.size(); i++) {
+            auto first = m_levels[i].firstIndex();
+            m_levels[i].buckets[m_levels[i].begin] = m_levels[i - 1].merged(first * Fanout, (first + 1) * Fanout);
+        }
+
+        // A level with a single bucket is the top one
+        while (m_levels.size() > 1 && m_levels[m_levels.size() - 2].size() == 1) {
+            m_levels.pop_back();
+        }
+        for (auto &level : m_levels) {
+            level.compact();
+        }
+    }
+
+    /**
+     * @brief Summarize the points with keys in [lower, upper] into columnCount columns of equal width, such as the
+     * pixel columns of a plot. Columns without points are left out, the rest are in order.
+     *
+     * The coarsest level with at least one bucket per column in the range is used. When even level 0 is coarser than
+     * that, columns get whole level 0 buckets, and a bucket may reach outside its column or the range.
+     */
+    std::vector<SummaryBucket> columns(double lower, double upper, size_t columnCount) const {
+        std::vector<SummaryBucket> result;
+        if (isEmpty() || !columnCount || !(upper >= lower)) {
+            return result;
+        }
+
+        // Coarsest level with enough buckets in range. The number of buckets roughly quadruples on each level down.
+        auto levelIndex = levelCount() - 1;
+        auto buckets = bucketsInRange(level(levelIndex), lower, upper);
+        while (levelIndex > 0 && size_t(buckets.second - buckets.first) < columnCount) {
+            levelIndex--;
+            buckets = bucketsInRange(level(levelIndex), lower, upper);
+        }
+
+        auto width = (upper - lower) / double(columnCount);
+        size_t previousColumn = std::numeric_limits<size_t>::max();
+        for (auto it = buckets.first; it != buckets.second; ++it) {
+            auto position = width > 0 ? std::floor((it->firstKey - lower) / width) : 0.0;
+            auto column = size_t(std::clamp(position, 0.0, double(columnCount - 1)));
+            if (column == previousColumn) {
+                result.back().merge(*it);
+            } else {
+                result.push_back(*it);
+                previousColumn = column;
+            }
+        }
+        return result;
+    }
+
+private:
+    using Iterator = Level::iterator;
+
+    static uint64_t totalCount(Level level) {
+        uint64_t count = 0;
+        for (auto &bucket : level) {
+            count += bucket.count;
+        }
+        return count;
+    }
+
+    /// @brief Buckets with any point in [lower, upper].
+    static std::pair<Iterator, Iterator> bucketsInRange(Level level, double lower, double upper) {
+        auto begin = std::partition_point(level.begin(), level.end(),
+                                          [&](const SummaryBucket &bucket) { return bucket.lastKey < lower; });
+        auto end = std::partition_point(begin, level.end(),
+                                        [&](const SummaryBucket &bucket) { return bucket.firstKey <= upper; });
+        return {begin, end};
+    }
+
+    /**
+     * @brief Buckets of a level that's built by appending. Bucket i of a level merges buckets [i * Fanout, (i + 1) *
+     * Fanout) of the level below, counting the dropped ones too. Dropped buckets are only erased once they're half of
+     * the vector, so dropping a few at a time doesn't move all of them every time.
+     */
+    struct Buckets {
+        std::vector<SummaryBucket> buckets;
+        size_t begin = 0;    ///< First bucket that's not dropped
+        uint64_t offset = 0; ///< Index of buckets[0] in the level
+
+        size_t size() const { return buckets.size() - begin; }
+        uint64_t firstIndex() const { return offset + begin; }
+        uint64_t endIndex() const { return offset + buckets.size(); }
+        Level kept() const { return Level(buckets.data() + begin, size()); }
+
+        /// @brief Merge of the buckets left in [first, last), of which there must be one.
+        SummaryBucket merged(uint64_t first, uint64_t last) const {
+            first = std::max(first, firstIndex());
+            last = std::min(last, endIndex());
+            auto bucket = buckets[first - offset];
+            for (auto i = first + 1; i < last; i++) {
+                bucket.merge(buckets[i - offset]);
+            }
+            return bucket;
+        }
+
+        void compact() {
+            if (begin > buckets.size() / 2) {
+                buckets.erase(buckets.begin(), buckets.begin() + begin);
+                offset += begin;
+                begin = 0;
+            }
+        }
+    };
+
+    std::vector<Buckets> m_levels; ///< Level 0 first, empty in a view
+    std::vector<Level> m_views;                       ///< Levels kept elsewhere, only in a view
+    bool m_isView = false;
+};
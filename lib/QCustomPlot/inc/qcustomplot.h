@@ -2632,6 +2632,7 @@ public:
   void add(const QCPDataContainer<DataType> &data);
   void add(const QVector<DataType> &data, bool alreadySorted=false);
   void add(const DataType &data);
+  void add(const DataType *first, const DataType *last, bool alreadySorted=false);
   void removeBefore(double sortKey);
   void removeAfter(double sortKey);
   void remove(double sortKeyFrom, double sortKeyTo);
@@ -2955,6 +2956,43 @@ void QCPDataContainer<DataType>::add(const DataType &data)
   }
 }
 
+/*! \overload
+  
+  Adds the data points in the range [\a first, \a last) to the current data. Unlike the QVector
+  overload, the points are copied straight from the caller's buffer without an intermediate container.
+  
+  If you can guarantee that the data points have ascending order with respect to the DataType's sort
+  key, set \a alreadySorted to true. Then if they all come after the existing data (the usual case when
+  streaming data in), this is a plain copy to the end of the container.
+  
+  \see remove
+*/
+template <class DataType>
+void QCPDataContainer<DataType>::add(const DataType *first, const DataType *last, bool alreadySorted)
+{
+  const int n = int(last-first);
+  if (n <= 0)
+    return;
+  
+  const int oldSize = size();
+  
+  if (alreadySorted && oldSize > 0 && !qcpLessThanSortKey<DataType>(*constBegin(), *(last-1))) // prepend if new data is sorted and keys are all smaller than or equal to existing ones
+  {
+    if (mPreallocSize < n)
+      preallocateGrow(n);
+    mPreallocSize -= n;
+    std::copy(first, last, begin());
+  } else // don't need to prepend, so append and then sort and merge if necessary
+  {
+    mData.resize(mData.size()+n);
+    std::copy(first, last, end()-n);
+    if (!alreadySorted) // sort appended subrange if it wasn't already sorted
+      std::sort(end()-n, end(), qcpLessThanSortKey<DataType>);
+    if (oldSize > 0 && !qcpLessThanSortKey<DataType>(*(constEnd()-n-1), *(constEnd()-n))) // if appended range keys aren't all greater than existing ones, merge the two partitions
+      std::inplace_merge(begin(), end()-n, end(), qcpLessThanSortKey<DataType>);
+  }
+}
+
 /*!
   Removes all data points with (sort-)keys smaller than or equal to \a sortKey.
   
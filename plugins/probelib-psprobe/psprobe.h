@@ -85,12 +85,16 @@ public:
     virtual Result<void, Error> writeMemory32(uint64_t address, const QByteArray &data) override;
     virtual Result<void, Error> writeMemory64(uint64_t address, const QByteArray &data) override;
     virtual Result<void, Error> setReadScatterGatherList(const QVector<ScatterGatherEntry> &list) override;
+    /// @brief Reads the ranges one transaction each, libpsprobe can't batch them yet.
     virtual ReadResult readScatterGather() override;
 
 private:
     void *m_session;
     std::atomic_size_t m_coreSelected;
 
+    QVector<ScatterGatherEntry> m_scatterGatherList;
+    size_t m_scatterGatherTotalBytes = 0;
+
     std::function<void()> m_disconnectCallback;
 };
 } // namespace probelib
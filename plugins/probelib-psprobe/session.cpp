@@ -107,11 +107,38 @@ Result<void, Error> PSProbeSession::writeMemory64(uint64_t address, const QByteA
 }
 
 Result<void, Error> PSProbeSession::setReadScatterGatherList(const QVector<ScatterGatherEntry> &list) {
-    return Err(Error{"Not implemented", true, ErrorClass::UnspecifiedBackendError});
+    m_scatterGatherList = list;
+    m_scatterGatherTotalBytes = 0;
+    for (auto &entry : list) {
+        m_scatterGatherTotalBytes += entry.count;
+    }
+    return Ok();
 }
 
 ReadResult PSProbeSession::readScatterGather() {
-    return Err(Error{"Not implemented", true, ErrorClass::UnspecifiedBackendError});
+    // NOT BATCHED: libpsprobe has no batched read, so every range is still a probe transaction of its own, read with
+    // the widest access its alignment allows. Only the coalescing of neighbouring reads into fewer ranges helps here.
+    // FIXME: forward the whole list to libpsprobe once it can queue the reads into a single probe transaction
+    QByteArray ret(m_scatterGatherTotalBytes, Qt::Initialization::Uninitialized);
+    auto dest = ret.data();
+    for (auto &entry : m_scatterGatherList) {
+        int code;
+        if (entry.address % 4 == 0 && entry.count % 4 == 0) {
+            code = psprobe_session_read_memory_32(m_session, m_coreSelected, entry.address, entry.count / 4, dest);
+        } else if (entry.address % 2 == 0 && entry.count % 2 == 0) {
+            code = psprobe_session_read_memory_16(m_session, m_coreSelected, entry.address, entry.count / 2, dest);
+        } else {
+            code = psprobe_session_read_memory_8(m_session, m_coreSelected, entry.address, entry.count, dest);
+        }
+        if (code) {
+            return Err(Error{QObject::tr("Scatter-gather read error at 0x%1: Backend code: %2")
+                                 .arg(entry.address, 8, 16, QChar('0'))
+                                 .arg(code),
+                             true, ErrorClass::UnspecifiedBackendError});
+        }
+        dest += entry.count;
+    }
+    return Ok(ret);
 }
 
 } // namespace probelib
@@ -0,0 +1,108 @@
+#include "simprobe.h"
+#include <algorithm>
+
+namespace probelib {
+
+SimProbeSession::SimProbeSession(std::unique_ptr<SimTarget> target, std::function<void()> onDisconnect)
+    : m_target(std::move(target)), m_disconnectCallback(onDisconnect) {}
+
+SimProbeSession::~SimProbeSession() {
+    m_disconnectCallback();
+}
+
+Result<QVector<CoreDescriptor>, Error> SimProbeSession::listCores() {
+    return Ok(QVector<CoreDescriptor>{CoreDescriptor{0, QObject::tr("Simulated Core")}});
+}
+
+Result<void, Error> SimProbeSession::selectCore(size_t core) {
+    if (core != 0) {
+        return Err(Error{QObject::tr("No such core: %1").arg(core), false, ErrorClass::UnspecifiedBackendError});
+    }
+    return Ok();
+}
+
+ReadResult SimProbeSession::readMemory8(uint64_t address, size_t count) {
+    return burstRead(address, count, 1);
+}
+
+ReadResult SimProbeSession::readMemory16(uint64_t address, size_t count) {
+    return burstRead(address, count, 2);
+}
+
+ReadResult SimProbeSession::readMemory32(uint64_t address, size_t count) {
+    return burstRead(address, count, 4);
+}
+
+ReadResult SimProbeSession::readMemory64(uint64_t address, size_t count) {
+    return burstRead(address, count, 8);
+}
+
+Result<void, Error> SimProbeSession::writeMemory8(uint64_t address, const QByteArray &data) {
+    return burstWrite(address, data, 1);
+}
+
+Result<void, Error> SimProbeSession::writeMemory16(uint64_t address, const QByteArray &data) {
+    return burstWrite(address, data, 2);
+}
+
+Result<void, Error> SimProbeSession::writeMemory32(uint64_t address, const QByteArray &data) {
+    return burstWrite(address, data, 4);
+}
+
+Result<void, Error> SimProbeSession::writeMemory64(uint64_t address, const QByteArray &data) {
+    return burstWrite(address, data, 8);
+}
+
+Result<void, Error> SimProbeSession::setReadScatterGatherList(const QVector<ScatterGatherEntry> &list) {
+    m_scatterGatherList = list;
+    m_scatterGatherTotalBytes = 0;
+    m_scatterGatherApAccesses = 0;
+    for (auto &entry : list) {
+        m_scatterGatherTotalBytes += entry.count;
+        // Each range is read with the widest access its alignment allows, like a real probe firmware would
+        auto elementSize = (entry.address % 4 == 0 && entry.count % 4 == 0) ? 4
+                           : (entry.address % 2 == 0 && entry.count % 2 == 0) ? 2
+                                                                                 : 1;
+        m_scatterGatherApAccesses += entry.count / elementSize;
+    }
+    return Ok();
+}
+
+ReadResult SimProbeSession::readScatterGather() {
+    QByteArray ret(m_scatterGatherTotalBytes, Qt::Initialization::Uninitialized);
+    auto dest = ret.data();
+    for (auto &entry : m_scatterGatherList) {
+        if (!m_target->read(entry.address, entry.count, dest)) {
+            return Err(Error{QObject::tr("Simulated bus fault at 0x%1").arg(entry.address, 8, 16, QChar('0')), false,
+                             ErrorClass::UnspecifiedBackendError});
+        }
+        dest += entry.count;
+    }
+    // The whole list goes out as one transaction: one latency, one TAR write per range
+    m_target->chargeTransaction(m_scatterGatherApAccesses, m_scatterGatherList.size());
+    return Ok(ret);
+}
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+ReadResult SimProbeSession::burstRead(uint64_t address, size_t count, size_t elementSize) {
+    QByteArray ret(count * elementSize, Qt::Initialization::Uninitialized);
+    if (!m_target->read(address, ret.size(), ret.data())) {
+        return Err(Error{QObject::tr("Simulated bus fault at 0x%1").arg(address, 8, 16, QChar('0')), false,
+                         ErrorClass::UnspecifiedBackendError});
+    }
+    // 64-bit accesses are two AP transfers on a 32-bit AP
+    m_target->chargeTransaction(count * std::max<size_t>(elementSize / 4, 1), 1);
+    return Ok(ret);
+}
+
+Result<void, Error> SimProbeSession::burstWrite(uint64_t address, const QByteArray &data, size_t elementSize) {
+    if (!m_target->write(address, data.constData(), data.size())) {
+        return Err(Error{QObject::tr("Simulated bus fault at 0x%1").arg(address, 8, 16, QChar('0')), false,
+                         ErrorClass::UnspecifiedBackendError});
+    }
+    m_target->chargeTransaction(data.size() / elementSize * std::max<size_t>(elementSize / 4, 1), 1);
+    return Ok();
+}
+
+} // namespace probelib
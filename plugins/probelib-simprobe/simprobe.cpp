@@ -0,0 +1,95 @@
+#include "simprobe.h"
+#include <QSettings>
+
+namespace probelib {
+
+SimProbe::SimProbe() : m_probe(std::make_shared<SimProbeAvailableProbe>()) {}
+
+SimProbe::~SimProbe() {}
+
+QVector<IAvailableProbe::p> SimProbe::availableProbes() {
+    return {m_probe};
+}
+
+Result<void, Error> SimProbe::selectProbe(IAvailableProbe::p probe) {
+    if (probe != m_probe) {
+        return Err(Error{tr("Unknown probe"), true, ErrorClass::PreConfigurationFailure});
+    }
+    m_probeSelected = true;
+    return Ok();
+}
+
+const QVector<DeviceCategory> SimProbe::supportedDevices() {
+    return {DeviceCategory{tr("Simulator"), {std::make_tuple(size_t(1), tr("Simulated Target"))}}};
+}
+
+Result<uint32_t, Error> SimProbe::setConnectionSpeed(uint32_t speed) {
+    if (!m_probeSelected) {
+        return Err(Error{tr("No probe selected"), true, ErrorClass::PreConfigurationFailure});
+    }
+    m_connectionSpeed = speed ? speed : 1;
+    return connectionSpeed();
+}
+
+Result<uint32_t, Error> SimProbe::connectionSpeed() {
+    if (!m_probeSelected) {
+        return Err(Error{tr("No probe selected"), true, ErrorClass::PreConfigurationFailure});
+    }
+    return Ok(m_connectionSpeed);
+}
+
+Result<void, Error> SimProbe::setProtocol(WireProtocol protocol) {
+    if (!m_probeSelected) {
+        return Err(Error{tr("No probe selected"), true, ErrorClass::PreConfigurationFailure});
+    }
+    if (protocol != WireProtocol::Swd) {
+        return Err(Error{tr("Simulator only models SWD"), true, ErrorClass::PreConfigurationFailure});
+    }
+    m_protocol = protocol;
+    return Ok();
+}
+
+Result<WireProtocol, Error> SimProbe::protocol() {
+    if (!m_probeSelected) {
+        return Err(Error{tr("No probe selected"), true, ErrorClass::PreConfigurationFailure});
+    }
+    return Ok(m_protocol);
+}
+
+Result<IProbeSession *, Error> SimProbe::connect(size_t deviceId) {
+    if (!m_probeSelected) {
+        return Err(Error{tr("No probe selected"), true, ErrorClass::BeginConnectionFailure});
+    }
+
+    if (m_connectionActive) {
+        return Err(Error{tr("Connection already active"), true, ErrorClass::BeginConnectionFailure});
+    }
+
+    auto target = std::make_unique<SimTarget>();
+    if (auto path = configPath(); !path.isEmpty()) {
+        if (auto result = target->loadConfig(path); result.isErr()) {
+            return Err(Error{result.unwrapErr(), true, ErrorClass::BeginConnectionFailure});
+        }
+    } else {
+        target->addRegion(0x20000000, 64 * 1024);
+    }
+    if (!target->isClockConfigured()) {
+        target->setClockKhz(m_connectionSpeed);
+    }
+    target->start();
+
+    m_connectionActive = true;
+    return Ok((IProbeSession *) new SimProbeSession(std::move(target), [this]() { m_connectionActive = false; }));
+}
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+QString SimProbe::configPath() const {
+    if (auto env = qEnvironmentVariable("PROBESCOPE_SIMPROBE_CONFIG"); !env.isEmpty()) {
+        return env;
+    }
+    QSettings settings;
+    return settings.value("SimProbe/ConfigPath").toString();
+}
+
+} // namespace probelib
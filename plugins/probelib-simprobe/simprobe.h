@@ -0,0 +1,111 @@
+
+#pragma once
+
+#include "probelib/iprobelib.h"
+#include "target.h"
+#include <QObject>
+#include <functional>
+#include <memory>
+
+namespace probelib {
+
+/**
+ * @brief SimProbe is a ProbeLib without hardware. It serves reads from a SimTarget, and is meant for benchmarking and
+ * regression testing the acquisition pipeline on any machine.
+ *
+ * The simulator is configured with a JSON file. Its path is taken from the PROBESCOPE_SIMPROBE_CONFIG environment
+ * variable, or the SimProbe/ConfigPath setting. Without a config, the target is 64KiB of zeroed RAM at 0x20000000.
+ * @code{.json}
+ * {
+ *     "elf": "firmware.elf",      // Optional. Memory image and symbols. Relative to the config file.
+ *     "latencyUs": 125,           // Optional. Fixed cost of each probe transaction.
+ *     "clockKhz": 4000,           // Optional. SWD clock. Without it, the connection speed set in ProbeScope.
+ *     "waveforms": [
+ *         { "symbol": "g_adcValue", "type": "u16", "shape": "sine", "amplitude": 2000, "offset": 2048,
+ *           "periodMs": 100 },
+ *         { "address": "0x20000010", "byteOffset": 4, "type": "f32", "shape": "noise" }
+ *     ]
+ * }
+ * @endcode
+ * Shapes are constant, ramp (0 to 1), sine, square and noise (-1 to 1), scaled by amplitude and moved by offset.
+ */
+class SimProbe : public QObject, public IProbeLib {
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID "cc.rigoligo.probescope.probelibs.SimProbe")
+    Q_INTERFACES(probelib::IProbeLib)
+public:
+    SimProbe();
+    virtual ~SimProbe() override;
+    virtual QString name() const override { return tr("Simulator"); }
+    virtual QString version() const override { return "1.0"; }
+    virtual QString description() const override { return tr("Simulated probe and target for testing"); }
+
+    // Initialize/terminate
+    virtual bool initialize() override { return true; }
+    virtual void terminate() override{};
+
+    // List of available probes
+    virtual QVector<IAvailableProbe::p> availableProbes() override;
+    virtual Result<void, Error> selectProbe(IAvailableProbe::p probe) override;
+
+    // List of supported devices
+    virtual const QVector<DeviceCategory> supportedDevices() override;
+
+    // Connection
+    virtual Result<uint32_t, Error> setConnectionSpeed(uint32_t speed) override;
+    virtual Result<uint32_t, Error> connectionSpeed() override;
+    virtual Result<void, Error> setProtocol(WireProtocol protocol) override;
+    virtual Result<WireProtocol, Error> protocol() override;
+    virtual Result<IProbeSession *, Error> connect(size_t deviceId) override;
+
+private:
+    QString configPath() const;
+
+private:
+    IAvailableProbe::p m_probe;
+    bool m_probeSelected = false;
+    uint32_t m_connectionSpeed = 4000;
+    WireProtocol m_protocol = WireProtocol::Swd;
+
+    bool m_connectionActive = false;
+};
+
+class SimProbeAvailableProbe : public IAvailableProbe {
+public:
+    virtual QString name() override { return QObject::tr("Simulated Probe"); }
+    virtual QString serialNumber() override { return "SIM0"; }
+    virtual QString description() override { return QObject::tr("Simulated SWD link"); }
+};
+
+class SimProbeSession : public IProbeSession {
+public:
+    SimProbeSession(std::unique_ptr<SimTarget> target, std::function<void()> onDisconnect);
+    virtual ~SimProbeSession();
+    virtual Result<QVector<CoreDescriptor>, Error> listCores() override;
+    virtual Result<void, Error> selectCore(size_t core) override;
+    virtual ReadResult readMemory8(uint64_t address, size_t count) override;
+    virtual ReadResult readMemory16(uint64_t address, size_t count) override;
+    virtual ReadResult readMemory32(uint64_t address, size_t count) override;
+    virtual ReadResult readMemory64(uint64_t address, size_t count) override;
+    virtual Result<void, Error> writeMemory8(uint64_t address, const QByteArray &data) override;
+    virtual Result<void, Error> writeMemory16(uint64_t address, const QByteArray &data) override;
+    virtual Result<void, Error> writeMemory32(uint64_t address, const QByteArray &data) override;
+    virtual Result<void, Error> writeMemory64(uint64_t address, const QByteArray &data) override;
+    virtual Result<void, Error> setReadScatterGatherList(const QVector<ScatterGatherEntry> &list) override;
+    virtual ReadResult readScatterGather() override;
+
+private:
+    /// @brief One burst read of count elements of elementSize bytes, as a single transaction.
+    ReadResult burstRead(uint64_t address, size_t count, size_t elementSize);
+    Result<void, Error> burstWrite(uint64_t address, const QByteArray &data, size_t elementSize);
+
+    std::unique_ptr<SimTarget> m_target;
+
+    QVector<ScatterGatherEntry> m_scatterGatherList;
+    size_t m_scatterGatherTotalBytes = 0;
+    size_t m_scatterGatherApAccesses = 0;
+
+    std::function<void()> m_disconnectCallback;
+};
+
+} // namespace probelib
@@ -0,0 +1,332 @@
+#include "target.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numbers>
+#include <thread>
+
+namespace probelib {
+
+namespace {
+// SWD packet cost in clock cycles: 8 bit request, turnaround, 3 bit ACK, 32 bit data, parity, turnaround and the idle
+// cycles most probes insert between packets.
+constexpr size_t SwdCyclesPerPacket = 8 + 1 + 3 + 32 + 1 + 1 + 2;
+
+// ELF constants, only what we need
+constexpr uint32_t SHT_SYMTAB = 2;
+constexpr uint32_t SHT_NOBITS = 8;
+constexpr uint64_t SHF_ALLOC = 2;
+constexpr uint8_t STT_OBJECT = 1;
+
+template <typename T>
+T readLe(const QByteArray &data, size_t offset) {
+    T ret = 0;
+    if (offset + sizeof(T) <= size_t(data.size())) {
+        memcpy(&ret, data.constData() + offset, sizeof(T));
+    }
+    return ret;
+}
+
+struct SectionHeader {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint64_t entsize;
+};
+} // namespace
+
+Result<void, QString> SimTarget::loadConfig(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return Err(QObject::tr("Cannot open simulator config %1").arg(path));
+    }
+    QJsonParseError parseError;
+    auto doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (doc.isNull()) {
+        return Err(QObject::tr("Simulator config parse error: %1").arg(parseError.errorString()));
+    }
+    auto root = doc.object();
+
+    if (root.contains("elf")) {
+        // Relative ELF paths are relative to the config file
+        auto elfPath = root["elf"].toString();
+        if (QFileInfo(elfPath).isRelative()) {
+            elfPath = QFileInfo(path).dir().filePath(elfPath);
+        }
+        if (auto result = loadElf(elfPath); result.isErr()) {
+            return result;
+        }
+    }
+    if (root.contains("latencyUs")) {
+        m_transactionLatency = std::chrono::microseconds(root["latencyUs"].toInt());
+    }
+    if (root.contains("clockKhz")) {
+        setClockKhz(root["clockKhz"].toInt());
+        m_clockConfigured = true;
+    }
+
+    static const QHash<QString, ValueType> typeNames{
+        {"u8", ValueType::U8},   {"u16", ValueType::U16}, {"u32", ValueType::U32}, {"u64", ValueType::U64},
+        {"i8", ValueType::I8},   {"i16", ValueType::I16}, {"i32", ValueType::I32}, {"i64", ValueType::I64},
+        {"f32", ValueType::F32}, {"f64", ValueType::F64},
+    };
+    static const QHash<QString, Shape> shapeNames{
+        {"constant", Shape::Constant}, {"ramp", Shape::Ramp},   {"sine", Shape::Sine},
+        {"square", Shape::Square},     {"noise", Shape::Noise},
+    };
+
+    for (auto value : root["waveforms"].toArray()) {
+        auto obj = value.toObject();
+        Waveform waveform;
+        if (obj.contains("symbol")) {
+            auto symbol = obj["symbol"].toString();
+            if (!m_symbols.contains(symbol)) {
+                return Err(QObject::tr("Waveform symbol %1 is not in the ELF symbol table").arg(symbol));
+            }
+            waveform.address = std::get<0>(m_symbols[symbol]);
+        } else {
+            bool ok;
+            waveform.address = obj["address"].toString().toULongLong(&ok, 0);
+            if (!ok) {
+                return Err(QObject::tr("Waveform needs either a symbol or an address"));
+            }
+        }
+        waveform.address += obj["byteOffset"].toInteger(0);
+        waveform.type = typeNames.value(obj["type"].toString("u32").toLower(), ValueType::U32);
+        waveform.shape = shapeNames.value(obj["shape"].toString("sine").toLower(), Shape::Sine);
+        waveform.amplitude = obj["amplitude"].toDouble(1.0);
+        waveform.offset = obj["offset"].toDouble(0.0);
+        waveform.periodMs = std::max(obj["periodMs"].toDouble(1000.0), 1e-3);
+        if (!locate(waveform.address, sizeofValueType(waveform.type))) {
+            return Err(QObject::tr("Waveform at 0x%1 is outside target memory")
+                           .arg(waveform.address, 8, 16, QChar('0')));
+        }
+        m_waveforms.append(waveform);
+    }
+
+    return Ok();
+}
+
+Result<void, QString> SimTarget::loadElf(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return Err(QObject::tr("Cannot open ELF file %1").arg(path));
+    }
+    auto elf = file.readAll();
+
+    if (elf.size() < 64 || !elf.startsWith("\x7f" "ELF")) {
+        return Err(QObject::tr("%1 is not an ELF file").arg(path));
+    }
+    bool is64 = elf[4] == 2;
+    if (elf[5] != 1) {
+        return Err(QObject::tr("Only little endian ELF files are supported"));
+    }
+
+    uint64_t shoff = is64 ? readLe<uint64_t>(elf, 0x28) : readLe<uint32_t>(elf, 0x20);
+    uint16_t shentsize = readLe<uint16_t>(elf, is64 ? 0x3A : 0x2E);
+    uint16_t shnum = readLe<uint16_t>(elf, is64 ? 0x3C : 0x30);
+
+    QVector<SectionHeader> sections;
+    for (size_t i = 0; i < shnum; i++) {
+        auto base = shoff + i * shentsize;
+        SectionHeader sh;
+        sh.name = readLe<uint32_t>(elf, base);
+        sh.type = readLe<uint32_t>(elf, base + 4);
+        if (is64) {
+            sh.flags = readLe<uint64_t>(elf, base + 8);
+            sh.addr = readLe<uint64_t>(elf, base + 16);
+            sh.offset = readLe<uint64_t>(elf, base + 24);
+            sh.size = readLe<uint64_t>(elf, base + 32);
+            sh.link = readLe<uint32_t>(elf, base + 40);
+            sh.entsize = readLe<uint64_t>(elf, base + 56);
+        } else {
+            sh.flags = readLe<uint32_t>(elf, base + 8);
+            sh.addr = readLe<uint32_t>(elf, base + 12);
+            sh.offset = readLe<uint32_t>(elf, base + 16);
+            sh.size = readLe<uint32_t>(elf, base + 20);
+            sh.link = readLe<uint32_t>(elf, base + 24);
+            sh.entsize = readLe<uint32_t>(elf, base + 36);
+        }
+        sections.append(sh);
+    }
+
+    // Memory image: every allocated section at its run time address
+    QVector<Region> regions;
+    for (auto &sh : sections) {
+        if (!(sh.flags & SHF_ALLOC) || sh.size == 0) {
+            continue;
+        }
+        Region region{sh.addr, QByteArray(sh.size, '\0')};
+        if (sh.type != SHT_NOBITS) {
+            if (sh.offset + sh.size > size_t(elf.size())) {
+                return Err(QObject::tr("ELF section at 0x%1 is truncated").arg(sh.addr, 8, 16, QChar('0')));
+            }
+            memcpy(region.data.data(), elf.constData() + sh.offset, sh.size);
+        }
+        regions.append(region);
+    }
+    std::sort(regions.begin(), regions.end(), [](const Region &a, const Region &b) { return a.base < b.base; });
+    for (auto &region : regions) {
+        // Coalesce sections that follow each other, so reads can span them (e.g. .data into .bss)
+        if (!m_regions.isEmpty() && m_regions.back().base + m_regions.back().data.size() >= region.base) {
+            auto &last = m_regions.back();
+            auto overlap = last.base + last.data.size() - region.base;
+            if (overlap < size_t(region.data.size())) {
+                last.data.append(region.data.mid(overlap));
+            }
+        } else {
+            m_regions.append(region);
+        }
+    }
+
+    // Symbols, so waveforms can refer to variables by name
+    for (auto &sh : sections) {
+        if (sh.type != SHT_SYMTAB || sh.link >= sections.size()) {
+            continue;
+        }
+        auto &strtab = sections[sh.link];
+        auto entsize = sh.entsize ? sh.entsize : (is64 ? 24 : 16);
+        for (uint64_t off = 0; off + entsize <= sh.size; off += entsize) {
+            auto base = sh.offset + off;
+            uint32_t nameIdx = readLe<uint32_t>(elf, base);
+            uint8_t info = readLe<uint8_t>(elf, base + (is64 ? 4 : 12));
+            uint64_t value = is64 ? readLe<uint64_t>(elf, base + 8) : readLe<uint32_t>(elf, base + 4);
+            uint64_t size = is64 ? readLe<uint64_t>(elf, base + 16) : readLe<uint32_t>(elf, base + 8);
+            if ((info & 0xf) != STT_OBJECT || strtab.offset + nameIdx >= size_t(elf.size())) {
+                continue;
+            }
+            auto name = QString::fromUtf8(elf.constData() + strtab.offset + nameIdx);
+            m_symbols.insert(name, {value, size});
+        }
+    }
+
+    return Ok();
+}
+
+void SimTarget::addRegion(uint64_t base, size_t size) {
+    m_regions.append(Region{base, QByteArray(size, '\0')});
+    std::sort(m_regions.begin(), m_regions.end(), [](const Region &a, const Region &b) { return a.base < b.base; });
+}
+
+bool SimTarget::read(uint64_t address, size_t bytes, char *dest) {
+    auto src = locate(address, bytes);
+    if (!src) {
+        return false;
+    }
+    refreshWaveforms(address, bytes);
+    memcpy(dest, src, bytes);
+    return true;
+}
+
+bool SimTarget::write(uint64_t address, const char *src, size_t bytes) {
+    auto dest = locate(address, bytes);
+    if (!dest) {
+        return false;
+    }
+    memcpy(dest, src, bytes);
+    return true;
+}
+
+void SimTarget::chargeTransaction(size_t apAccesses, size_t tarWrites) {
+    auto cycles = (apAccesses + tarWrites) * SwdCyclesPerPacket;
+    auto wireTime = std::chrono::nanoseconds(cycles * 1000000ull / m_clockKhz);
+    std::this_thread::sleep_for(m_transactionLatency + wireTime);
+}
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+char *SimTarget::locate(uint64_t address, size_t bytes) {
+    auto it = std::upper_bound(m_regions.begin(), m_regions.end(), address,
+                               [](uint64_t address, const Region &region) { return address < region.base; });
+    if (it == m_regions.begin()) {
+        return nullptr;
+    }
+    --it;
+    if (address + bytes > it->base + it->data.size()) {
+        return nullptr;
+    }
+    return it->data.data() + (address - it->base);
+}
+
+void SimTarget::refreshWaveforms(uint64_t address, size_t bytes) {
+    auto t = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_startTime).count();
+    for (auto &waveform : m_waveforms) {
+        auto size = sizeofValueType(waveform.type);
+        if (waveform.address + size <= address || waveform.address >= address + bytes) {
+            continue;
+        }
+
+        auto phase = std::fmod(t, waveform.periodMs) / waveform.periodMs;
+        double v;
+        switch (waveform.shape) {
+            case Shape::Constant: v = 0; break;
+            case Shape::Ramp: v = phase; break;
+            case Shape::Sine: v = std::sin(phase * 2 * std::numbers::pi); break;
+            case Shape::Square: v = phase < 0.5 ? 1 : -1; break;
+            case Shape::Noise: v = QRandomGenerator::global()->generateDouble() * 2 - 1; break;
+        }
+        v = v * waveform.amplitude + waveform.offset;
+
+        auto dest = locate(waveform.address, size);
+        auto store = [&]<typename T>(T t) { memcpy(dest, &t, sizeof(T)); };
+        switch (waveform.type) {
+            // Negative values wrap around on unsigned types, like they do when cast in C
+            case ValueType::U8: store(uint8_t(saturate<int64_t>(v))); break;
+            case ValueType::U16: store(uint16_t(saturate<int64_t>(v))); break;
+            case ValueType::U32: store(uint32_t(saturate<int64_t>(v))); break;
+            case ValueType::U64: store(v < 0 ? uint64_t(saturate<int64_t>(v)) : saturate<uint64_t>(v)); break;
+            case ValueType::I8: store(saturate<int8_t>(v)); break;
+            case ValueType::I16: store(saturate<int16_t>(v)); break;
+            case ValueType::I32: store(saturate<int32_t>(v)); break;
+            case ValueType::I64: store(saturate<int64_t>(v)); break;
+            case ValueType::F32: store(float(v)); break;
+            case ValueType::F64: store(double(v)); break;
+        }
+    }
+}
+
+template <typename T>
+T SimTarget::saturate(double v) {
+    // Converting a double that doesn't fit is undefined behavior, so clamp it first. max() may round up when converted
+    // to double, hence the >=.
+    if (std::isnan(v)) {
+        return 0;
+    }
+    if (v <= double(std::numeric_limits<T>::lowest())) {
+        return std::numeric_limits<T>::lowest();
+    }
+    if (v >= double(std::numeric_limits<T>::max())) {
+        return std::numeric_limits<T>::max();
+    }
+    return T(v);
+}
+
+size_t SimTarget::sizeofValueType(ValueType type) {
+    switch (type) {
+        case ValueType::U8:
+        case ValueType::I8: return 1;
+        case ValueType::U16:
+        case ValueType::I16: return 2;
+        case ValueType::U32:
+        case ValueType::I32:
+        case ValueType::F32: return 4;
+        case ValueType::U64:
+        case ValueType::I64:
+        case ValueType::F64: return 8;
+    }
+    return 4;
+}
+
+} // namespace probelib
@@ -0,0 +1,96 @@
+
+#pragma once
+
+#include "probelib/misc.h"
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include <chrono>
+
+namespace probelib {
+
+/**
+ * @brief SimTarget is the simulated device behind SimProbe: a memory image and the timing of an SWD link to it.
+ *
+ * Memory is loaded from the allocatable sections of an ELF file (.data keeps its initial value, .bss is zeroed), so
+ * the same symbol file used in ProbeScope can be used to pick variables to watch. Waveforms make chosen variables
+ * change over time; they are evaluated lazily when a read touches them.
+ *
+ * The link model charges each probe transaction a fixed latency (USB round trip and probe firmware), plus SWD clock
+ * cycles for every AP access at the configured clock frequency.
+ */
+class SimTarget {
+public:
+    enum class ValueType { U8, U16, U32, U64, I8, I16, I32, I64, F32, F64 };
+    enum class Shape { Constant, Ramp, Sine, Square, Noise };
+
+    struct Waveform {
+        uint64_t address;
+        ValueType type;
+        Shape shape;
+        double amplitude;
+        double offset;
+        double periodMs;
+    };
+
+    /**
+     * @brief Load the configuration file. See simprobe.h for the format.
+     * @return On success: nothing. On fail: error message.
+     */
+    Result<void, QString> loadConfig(const QString &path);
+
+    /// @brief Load memory and symbols from an ELF file. Also called by loadConfig() when the config names an ELF.
+    Result<void, QString> loadElf(const QString &path);
+
+    /// @brief Add a zero filled memory region. Used when no ELF is loaded.
+    void addRegion(uint64_t base, size_t size);
+
+    void setClockKhz(uint32_t khz) { m_clockKhz = khz ? khz : 1; }
+    uint32_t clockKhz() const { return m_clockKhz; }
+    /// @brief Whether the config set the clock, which then takes precedence over the connection speed.
+    bool isClockConfigured() const { return m_clockConfigured; }
+
+    /// @brief Start the waveform time base.
+    void start() { m_startTime = std::chrono::steady_clock::now(); }
+
+    /**
+     * @brief Read memory into dest, after refreshing waveforms that overlap the range. No timing is applied.
+     * @return false if any byte is outside the loaded memory.
+     */
+    bool read(uint64_t address, size_t bytes, char *dest);
+
+    /// @brief Write memory. No timing is applied. @return false if any byte is outside the loaded memory.
+    bool write(uint64_t address, const char *src, size_t bytes);
+
+    /**
+     * @brief Block the caller for as long as a transaction would take on the simulated link.
+     * @param apAccesses Number of AP data transfers in the transaction.
+     * @param tarWrites Number of transfer address register writes (one per non-contiguous range).
+     */
+    void chargeTransaction(size_t apAccesses, size_t tarWrites);
+
+private:
+    struct Region {
+        uint64_t base;
+        QByteArray data;
+    };
+
+    char *locate(uint64_t address, size_t bytes);
+    void refreshWaveforms(uint64_t address, size_t bytes);
+    static size_t sizeofValueType(ValueType type);
+    /// @brief Convert a waveform value to an integer type, saturating where it's out of range. NaN converts to 0.
+    template <typename T>
+    static T saturate(double v);
+
+    QVector<Region> m_regions;                            ///< Sorted by base, never overlapping
+    QHash<QString, std::tuple<uint64_t, size_t>> m_symbols; ///< Symbol name -> address, size
+    QVector<Waveform> m_waveforms;
+
+    uint32_t m_clockKhz = 4000;
+    bool m_clockConfigured = false;
+    std::chrono::microseconds m_transactionLatency{125};
+    std::chrono::steady_clock::time_point m_startTime;
+};
+
+} // namespace probelib
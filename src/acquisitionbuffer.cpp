@@ -1,72 +1,127 @@
 
 #include "acquisitionbuffer.h"
 #include <QDebug>
+#include <algorithm>
+#include <bit>
+#include <cmath>
 
-AcquisitionBuffer::AcquisitionBuffer() : IAcquisitionBufferChannel(), QObject(nullptr) {
+AcquisitionBuffer::AcquisitionBuffer() : IAcquisitionBufferChannel(), QObject(nullptr), m_table(new ChannelTable) {
     //
 }
 
 AcquisitionBuffer::~AcquisitionBuffer() {
-    //
+    // Neither reader is running by now
+    delete m_table.load();
 }
 
 void AcquisitionBuffer::addDataPoint(size_t entryId, std::chrono::steady_clock::time_point timestamp, Value value) {
-    if (auto channel = m_channels.find(entryId); channel == m_channels.end()) {
-        qCritical() << "AcquisitionBuffer: Does not have channel for entry" << entryId;
+    ReadGuard guard(*this, ProducerReader);
+    // The acquisition thread learns of a removed entry a little after its channel is gone, so don't complain
+    auto channel = guard.table()->find(entryId);
+    if (!channel) {
         return;
-    } else if (auto result = channel->second.queue.try_push(std::move(std::pair{timestamp, value})); !result) {
-        qWarning() << "AcquisitionBuffer: Queue for channel" << entryId << "overflowed!";
     }
+
+    auto timeUs = std::chrono::duration_cast<std::chrono::microseconds>(timestamp - m_epoch).count();
+    SampleRing::ValueKind kind;
+    auto slot = SampleRing::encode(value, kind);
+    pushSample(channel, entryId, uint64_t(std::max<int64_t>(timeUs, 0)), kind, slot);
 }
 
 void AcquisitionBuffer::acquisitionFrequencyFeedback(size_t entryId, double frequency) {
-    if (auto channel = m_channels.find(entryId); channel == m_channels.end()) {
-        qCritical() << "AcquisitionBuffer: Does not have channel for entry" << entryId;
-        return;
-    } else {
-        channel->second.frequencyFeedback = frequency;
-        emit frequencyFeedbackArrived(entryId);
+    {
+        ReadGuard guard(*this, ProducerReader);
+        auto channel = guard.table()->find(entryId);
+        if (!channel) {
+            return;
+        }
+        channel->frequencyFeedback.store(frequency, std::memory_order_relaxed);
+    }
+    emit frequencyFeedbackArrived(entryId);
+}
+
+size_t AcquisitionBuffer::capacityForRate(double sampleRate, std::chrono::milliseconds headroom) {
+    if (sampleRate <= 0) {
+        sampleRate = UnlimitedSampleRate;
     }
+    auto samples = size_t(std::ceil(sampleRate * std::chrono::duration<double>(headroom).count()));
+    return std::bit_ceil(std::clamp(samples, MinimumCapacity, MaximumCapacity));
 }
 
-void AcquisitionBuffer::addChannel(size_t entryId) {
-    if (m_channels.contains(entryId)) {
+void AcquisitionBuffer::addChannel(size_t entryId, const ChannelConfig &config) {
+    auto current = m_table.load(std::memory_order_relaxed);
+    auto position = std::lower_bound(current->entryIds.begin(), current->entryIds.end(), entryId);
+    if (position != current->entryIds.end() && *position == entryId) {
         qCritical() << "AcquisitionBuffer: Already have channel for entry" << entryId;
         return;
     }
 
-    m_channels.try_emplace(entryId);
+    auto index = position - current->entryIds.begin();
+    auto table = std::make_unique<ChannelTable>(*current);
+    table->entryIds.insert(table->entryIds.begin() + index, entryId);
+    table->channels.insert(table->channels.begin() + index, std::make_shared<Channel>(config));
+    publishTable(std::move(table));
 }
 
 void AcquisitionBuffer::removeChannel(size_t entryId) {
-    if (!m_channels.contains(entryId)) {
+    auto current = m_table.load(std::memory_order_relaxed);
+    auto position = std::lower_bound(current->entryIds.begin(), current->entryIds.end(), entryId);
+    if (position == current->entryIds.end() || *position != entryId) {
         qCritical() << "AcquisitionBuffer: Does not have channel for entry" << entryId;
         return;
     }
 
-    m_channels.erase(entryId);
+    auto index = position - current->entryIds.begin();
+    auto table = std::make_unique<ChannelTable>(*current);
+    table->entryIds.erase(table->entryIds.begin() + index);
+    table->channels.erase(table->channels.begin() + index);
+    publishTable(std::move(table));
 }
 
-void AcquisitionBuffer::drainChannel(size_t entryId, std::function<void(Timepoint, Value)> processor) {
-    if (!m_channels.contains(entryId)) {
-        qCritical() << "Does not have channel for entry" << entryId;
+void AcquisitionBuffer::reconfigureChannel(size_t entryId, const ChannelConfig &config) {
+    auto current = m_table.load(std::memory_order_relaxed);
+    auto position = std::lower_bound(current->entryIds.begin(), current->entryIds.end(), entryId);
+    if (position == current->entryIds.end() || *position != entryId) {
+        qCritical() << "AcquisitionBuffer: Does not have channel for entry" << entryId;
         return;
     }
 
-    std::tuple<Timepoint, Value> dataPoint;
-    while (m_channels.at(entryId).queue.try_pop(dataPoint)) {
-        auto [timepoint, value] = dataPoint;
-        processor(timepoint, value);
+    // The old channel stays alive for as long as a retired table still holds it
+    auto table = std::make_unique<ChannelTable>(*current);
+    table->channels[position - current->entryIds.begin()] = std::make_shared<Channel>(config);
+    publishTable(std::move(table));
+}
+
+void AcquisitionBuffer::setChannelOverflowPolicy(size_t entryId, OverflowPolicy policy) {
+    auto channel = findChannel(m_table.load(std::memory_order_relaxed), entryId);
+    if (channel) {
+        channel->overflowPolicy.store(policy, std::memory_order_relaxed);
     }
 }
 
-double AcquisitionBuffer::getChannelFrequencyFeedback(size_t entryId) {
-    if (!m_channels.contains(entryId)) {
-        qCritical() << "Does not have channel for entry" << entryId;
-        return NAN;
+size_t AcquisitionBuffer::getChannelBufferedCount(size_t entryId) {
+    ReadGuard guard(*this, ConsumerReader);
+    auto channel = guard.table()->find(entryId); // May have been removed since the consumer last looked
+    if (!channel) {
+        return 0;
     }
+    return channel->ring.size() + (channel->spill ? channel->spill->size() : 0);
+}
 
-    return m_channels.at(entryId).frequencyFeedback;
+double AcquisitionBuffer::getChannelFrequencyFeedback(size_t entryId) {
+    // GUI thread is the only one that frees tables, so it can use the current table as is
+    auto channel = findChannel(m_table.load(std::memory_order_relaxed), entryId);
+    return channel ? channel->frequencyFeedback.load(std::memory_order_relaxed) : NAN;
+}
+
+size_t AcquisitionBuffer::getChannelOverflowCount(size_t entryId) {
+    auto channel = findChannel(m_table.load(std::memory_order_relaxed), entryId);
+    return channel ? channel->overflowCount.load(std::memory_order_relaxed) : 0;
+}
+
+size_t AcquisitionBuffer::getChannelSpilledCount(size_t entryId) {
+    auto channel = findChannel(m_table.load(std::memory_order_relaxed), entryId);
+    return channel ? channel->spilledCount.load(std::memory_order_relaxed) : 0;
 }
 
 double AcquisitionBuffer::valueToDouble(Value value) {
@@ -107,3 +162,113 @@ double AcquisitionBuffer::valueToDouble(Value value) {
 double AcquisitionBuffer::timepointToMillisecond(Timepoint reference, Timepoint timepoint) {
     return std::chrono::duration_cast<std::chrono::microseconds>(timepoint - reference).count() / 1000.0;
 }
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+AcquisitionBuffer::Channel::Channel(const ChannelConfig &config)
+    : ring(config.capacity), overflowPolicy(config.overflowPolicy) {
+    if (config.spillStorage) {
+        auto capacity = SampleRing::capacityForStorage(config.spillStorageSize);
+        if (capacity) {
+            spill = std::make_unique<SampleRing>(capacity, config.spillStorage);
+        }
+    }
+}
+
+void AcquisitionBuffer::pushSample(Channel *channel, size_t entryId, uint64_t timeUs, SampleRing::ValueKind kind,
+                                   uint64_t slot) {
+    auto &ring = channel->ring;
+
+    if (channel->spilling) {
+        // Stay on the spill ring until the consumer has caught up with it, or samples would get out of order
+        if (channel->spill->producerSize()) {
+            if (channel->spill->push(timeUs, kind, slot)) {
+                channel->spilledCount.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                reportOverflow(channel, entryId, 1);
+            }
+            return;
+        }
+        channel->spilling = false;
+    }
+
+    if (channel->decimating) {
+        if (ring.producerSize() <= ring.capacity() / 2) {
+            channel->decimating = false;
+        } else if ((channel->decimationPhase = !channel->decimationPhase)) {
+            reportOverflow(channel, entryId, 1);
+            return;
+        }
+    }
+
+    if (ring.push(timeUs, kind, slot)) {
+        channel->overflowFlag = false;
+        return;
+    }
+
+    switch (channel->overflowPolicy.load(std::memory_order_relaxed)) {
+        case OverflowPolicy::DropNewest: break;
+        case OverflowPolicy::DropOldest:
+            if (auto evicted = ring.evictOldest(ring.capacity() / EvictionDivisor); evicted) {
+                reportOverflow(channel, entryId, evicted);
+            }
+            if (ring.push(timeUs, kind, slot)) {
+                return;
+            }
+            break;
+        case OverflowPolicy::Decimate:
+            channel->decimating = true;
+            channel->decimationPhase = false;
+            break;
+        case OverflowPolicy::SpillToDisk:
+            if (channel->spill && channel->spill->push(timeUs, kind, slot)) {
+                channel->spilling = true;
+                channel->spilledCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            break;
+    }
+    reportOverflow(channel, entryId, 1);
+}
+
+void AcquisitionBuffer::reportOverflow(Channel *channel, size_t entryId, size_t count) {
+    channel->overflowCount.fetch_add(count, std::memory_order_relaxed);
+    if (!channel->overflowFlag) {
+        channel->overflowFlag = true;
+        qWarning() << "AcquisitionBuffer: Queue for channel" << entryId << "overflowed!";
+    }
+}
+
+AcquisitionBuffer::Channel *AcquisitionBuffer::ChannelTable::find(size_t entryId) const {
+    auto position = std::lower_bound(entryIds.begin(), entryIds.end(), entryId);
+    if (position == entryIds.end() || *position != entryId) {
+        return nullptr;
+    }
+    return channels[position - entryIds.begin()].get();
+}
+
+AcquisitionBuffer::Channel *AcquisitionBuffer::findChannel(const ChannelTable *table, size_t entryId) {
+    auto channel = table->find(entryId);
+    if (!channel) {
+        qCritical() << "AcquisitionBuffer: Does not have channel for entry" << entryId;
+    }
+    return channel;
+}
+
+void AcquisitionBuffer::publishTable(std::unique_ptr<ChannelTable> table) {
+    auto old = m_table.exchange(table.release(), std::memory_order_seq_cst);
+    // Readers announcing this epoch or later have loaded m_table after the exchange above
+    auto epoch = m_tableEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    m_retiredTables.push_back({std::unique_ptr<const ChannelTable>(old), epoch});
+    reclaimTables();
+}
+
+void AcquisitionBuffer::reclaimTables() {
+    uint64_t oldestReader = UINT64_MAX;
+    for (auto &reader : m_readerEpochs) {
+        if (auto epoch = reader.epoch.load(std::memory_order_seq_cst); epoch) {
+            oldestReader = std::min(oldestReader, epoch);
+        }
+    }
+    std::erase_if(m_retiredTables, [&](const RetiredTable &retired) { return retired.epoch <= oldestReader; });
+}
@@ -1,11 +1,26 @@
 
 #include "acquisitionhub.h"
 #include "probelibhost.h"
+#include "utils.h"
 #include <QSettings>
+#include <algorithm>
+#include <functional>
+
+#ifdef Q_OS_WIN
+// clang-format off
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+// clang-format on
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
 
 AcquisitionHub::AcquisitionHub(ProbeLibHost *probeLibHost, QObject *parent)
-    : m_plh(probeLibHost), QObject(parent), m_acquisitionThread(acquisitionThread, this), m_acquisitionRunning(false) {
-    //
+    : m_plh(probeLibHost), QObject(parent), m_acquisitionRunning(false), m_scatterGatherUsable(true) {
+    // Start the thread only after all members it touches are constructed
+    m_acquisitionThread = std::thread(acquisitionThread, this);
 }
 
 AcquisitionHub::~AcquisitionHub() {
@@ -27,6 +42,10 @@ void AcquisitionHub::stopAcquisition() {
 
 void AcquisitionHub::setFrequencyFeedbackReportInterval() {}
 
+std::chrono::nanoseconds AcquisitionHub::acquisitionThreadCpuTime() {
+    return ProbeScopeUtil::threadCpuTime(m_acquisitionThread.native_handle());
+}
+
 void AcquisitionHub::addWatchEntry(size_t entryId, bool enabled, ExpressionEvaluator::Bytecode runtimeBytecode,
                                    int freqLimit) {
     sendRequest(RequestAddEntry{entryId, enabled, runtimeBytecode, freqLimit});
@@ -54,6 +73,11 @@ void AcquisitionHub::sendRequest(AcquisitionHub::RuntimeRequest &&request) {
     // FIXME: what if the queue is really full?
     while (!m_requestQueue.try_push(request))
         ;
+    // Take the lock before notifying, otherwise the notification may slip in between the acquisition thread checking
+    // the request queue and actually going to sleep, and the request would wait until the next deadline.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
     m_cond.notify_all();
 }
 
@@ -61,106 +85,39 @@ void AcquisitionHub::acquisitionThread(AcquisitionHub *self) {
     //
     auto &running = self->m_acquisitionRunning;
     bool runLoop = true;
-    std::unique_lock<std::mutex> lock(self->m_mutex);
     while (runLoop) {
-        // Run acquisition for each entry
+        // Run acquisition for each entry that is due
         auto now = std::chrono::steady_clock::now();
         if (running) {
-            for (auto it = self->m_acquisitionEntries.begin(); it != self->m_acquisitionEntries.end(); ++it) {
-                // Check if an entry is enabled
-                if (!it->enabled) {
-                    continue;
-                }
-
-                // Check if deadline reached, if not, don't work on this acquisition just for now
-                // FIXME: use a timer to wake this thread up.
-                if (now - it->lastAcquisitionTime < it->minimumWaitDuration) {
-                    continue;
-                }
-
-                // Update last acquisition time (only for whose PC=0)
-                if (it->es.PC == 0) {
-                    it->lastAcquisitionTime = std::chrono::steady_clock::now();
+            // Collect all due entries first. Slots are popped from the heap, the entries are rescheduled after they
+            // have run.
+            self->m_dueEntries.clear();
+            self->pruneSchedule();
+            while (!self->m_schedule.empty() && self->m_schedule.front().due <= now) {
+                std::pop_heap(self->m_schedule.begin(), self->m_schedule.end(), std::greater<ScheduleSlot>{});
+                auto slot = self->m_schedule.back();
+                self->m_schedule.pop_back();
+                if (auto entry = self->slotEntry(slot); entry) {
+                    self->m_dueEntries.push_back(self->m_entryIndices.value(slot.entryId));
                 }
+                self->pruneSchedule();
+            }
 
-                // Run bytecode
-                // For each acquisition entry, each time we visit it we only give it one chance to access device memory
-                // so we don't waste too much time on a single expression
-                bool memAccessed = false;
-                using namespace ExpressionEvaluator;
-                auto execResult = it->bytecode.execute(
-                    it->es, [&](ExecutionState &es, Opcode op, Bytecode::ImmType imm) -> Bytecode::ExecutionResult {
-                        // Try generic executor
-                        if (Bytecode::genericComputationExecutor(es, op, imm) == Bytecode::Continue) {
-                            return Bytecode::Continue;
-                        }
+            if (!self->m_dueEntries.empty() && !self->runTick(now)) {
+                qCritical() << "Severe execution error occured, acquisition stopping";
+                self->stopAcquisition();
+            }
 
-                        auto processRead = [&](probelib::ReadResult result) {
-                            if (result.isErr()) {
-                                qWarning() << "Read memory 8" << Qt::hex << es.stack.last() << "failed"
-                                           << result.unwrapErr().message;
-                                es.resetAll();
-                                return Bytecode::ErrorBreak;
-                            } else {
-                                es.stack.last() = 0;
-                                memcpy(&es.stack.last(), result.unwrap().data(), result.unwrap().size());
-                                return Bytecode::Continue;
-                            }
-                        };
-                        auto processReturn = [&]<typename T>(uint64_t word, T dummy) {
-                            T t;
-                            memcpy(&t, &word, sizeof(T));
-                            if (self->m_bufferChannel) {
-                                self->m_bufferChannel->addDataPoint(it.key(), now, t);
-                            }
-
-                            // Each time we return a value, we check if we need to report frequency feedback
-                            if (auto interval = now - it->lastFeedbackTime;
-                                interval >= self->m_frequencyFeedbackReportInterval) {
-                                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(interval).count();
-                                self->m_bufferChannel->acquisitionFrequencyFeedback(it.key(), it->acquisitionCounter *
-                                                                                                  1000.0 / ms);
-                                it->acquisitionCounter = 0;
-                                it->lastFeedbackTime = now;
-                            }
-
-                            // After checking feedback, we increment the acquisition counter
-                            ++it->acquisitionCounter;
-                        };
-                        // If generic executor can't handle it, we're facing some complex instructions
-                        switch (op) {
-                            // Memory accesses
-                            case Deref8: return processRead(self->m_plh->readMemory8(es.stack.last(), 1));
-                            case Deref16: return processRead(self->m_plh->readMemory16(es.stack.last(), 1));
-                            case Deref32: return processRead(self->m_plh->readMemory32(es.stack.last(), 1));
-                            case Deref64: return processRead(self->m_plh->readMemory64(es.stack.last(), 1));
-                            case ReturnU8: processReturn(es.stack.last(), uint8_t(0)); break;
-                            case ReturnU16: processReturn(es.stack.last(), uint16_t(0)); break;
-                            case ReturnU32: processReturn(es.stack.last(), uint32_t(0)); break;
-                            case ReturnU64: processReturn(es.stack.last(), uint64_t(0)); break;
-                            case ReturnI8: processReturn(es.stack.last(), int8_t(0)); break;
-                            case ReturnI16: processReturn(es.stack.last(), int16_t(0)); break;
-                            case ReturnI32: processReturn(es.stack.last(), int32_t(0)); break;
-                            case ReturnI64: processReturn(es.stack.last(), int64_t(0)); break;
-                            case ReturnF32: processReturn(es.stack.last(), float(0)); break;
-                            case ReturnF64: processReturn(es.stack.last(), double(0)); break;
-                            default: Q_UNREACHABLE(); return Bytecode::ErrorBreak;
-                        }
-                        return Bytecode::Continue;
-                    });
+            for (auto entryIndex : self->m_dueEntries) {
+                auto &entry = self->m_acquisitionEntries[entryIndex];
 
-                if (execResult >= Bytecode::BeginErrors) {
-                    qCritical() << "Severe execution error occured, acquisition stopping";
-                    self->stopAcquisition();
-                }
+                // Advance the deadline by exactly one period so the rate doesn't drift with our own latency. If we've
+                // fallen behind by more than a period, don't try to catch up with a burst, just resync to now.
+                auto due = entry.nextDueTime + entry.minimumWaitDuration;
+                self->scheduleEntry(entry, due < now ? now : due);
             }
         }
 
-        // If acquisition is not running, wait for events. Otherwise we loop directly.
-        if (!running) {
-            self->m_cond.wait(lock);
-        }
-
         // Check for runtime requests. If there isn't any, do acquisition.
         RuntimeRequest req;
         while (self->m_requestQueue.try_pop(req)) {
@@ -171,67 +128,443 @@ void AcquisitionHub::acquisitionThread(AcquisitionHub *self) {
                     /*  */ if MATCH (RequestStartAcquisition) {
                         running = true;
                         self->readFrequencyFeedbackReportIntervalFromQSettings();
+                        self->readCoalescerSettingsFromQSettings();
+                        self->startAcquisitionTimer();
+                        // The probe session may have changed since last acquisition, hand over the list again
+                        self->m_activeScatterGatherList.clear();
+                        self->m_scatterGatherUsable = true;
+                        self->rebuildSchedule(now);
                     } else if MATCH (RequestStopAcquisition) {
                         running = false;
+                        self->m_schedule.clear();
+                        self->stopAcquisitionTimer();
                         emit self->acquisitionStopped();
                     } else if MATCH (RequestExit) {
                         runLoop = false;
                     } else if MATCH (RequestAddEntry) {
-                        if (self->m_acquisitionEntries.contains(arg.entryId)) {
+                        if (self->m_entryIndices.contains(arg.entryId)) {
                             qCritical() << "AcquisitionHub already has entry" << arg.entryId;
                             return;
                         }
-                        self->m_acquisitionEntries[arg.entryId] = {.bytecode = arg.runtimeBytecode,
-                                                                   .es = {},
-                                                                   .frequencyLimit = arg.acquisitionFrequencyLimit,
-                                                                   .enabled = arg.enabled,
-                                                                   .acquisitionCounter = 0};
+                        self->m_entryIndices.insert(arg.entryId, self->m_acquisitionEntries.size());
+                        auto &entry = self->m_acquisitionEntries.emplace_back(AcquisitionEntry{
+                            .entryId = arg.entryId,
+                            .bytecode = {},
+                            .rs = {},
+                            .runnable = false,
+                            .frequencyLimit = arg.acquisitionFrequencyLimit,
+                            .enabled = arg.enabled,
+                            .minimumWaitDuration = periodFromFrequencyLimit(arg.acquisitionFrequencyLimit),
+                            .readValue = 0,
+                            .scheduleGeneration = 0,
+                            .acquisitionCounter = 0});
+                        setEntryBytecode(entry, std::move(arg.runtimeBytecode));
+                        if (running && arg.enabled) {
+                            self->scheduleEntry(entry, now);
+                        }
                     } else if MATCH (RequestRemoveEntry) {
-                        if (!self->m_acquisitionEntries.contains(arg.entryId)) {
+                        if (!self->m_entryIndices.contains(arg.entryId)) {
                             qCritical() << "AcquisitionHub does not have entry" << arg.entryId;
                             return;
                         }
-                        self->m_acquisitionEntries.remove(arg.entryId);
+                        // Its slot in the schedule (if any) goes stale and is dropped lazily
+                        self->removeEntry(arg.entryId);
                     } else if MATCH (RequestSetEntryEnabled) {
-                        if (!self->m_acquisitionEntries.contains(arg.entryId)) {
+                        auto entry = self->findEntry(arg.entryId);
+                        if (!entry) {
                             qCritical() << "AcquisitionHub does not have entry" << arg.entryId;
                             return;
                         }
                         if (!arg.enable && running) {
                             // Insert QNaN here to break the graph line. This is a documented valid usage of QCustomPlot
                             self->m_bufferChannel->addDataPoint(arg.entryId, now, qQNaN());
-                            self->m_acquisitionEntries[arg.entryId].es.resetAll();
+                            entry->rs.resetAll();
+                            self->unscheduleEntry(*entry);
+                        } else if (arg.enable && !entry->enabled && running) {
+                            self->scheduleEntry(*entry, now);
                         }
-                        self->m_acquisitionEntries[arg.entryId].enabled = arg.enable;
+                        entry->enabled = arg.enable;
                     } else if MATCH (RequestChangeEntryBytecode) {
-                        if (!self->m_acquisitionEntries.contains(arg.entryId)) {
+                        auto entry = self->findEntry(arg.entryId);
+                        if (!entry) {
                             qCritical() << "AcquisitionHub does not have entry" << arg.entryId;
                             return;
                         }
-                        self->m_acquisitionEntries[arg.entryId].bytecode = arg.runtimeBytecode;
+                        auto wasRunnable = entry->runnable;
+                        setEntryBytecode(*entry, std::move(arg.runtimeBytecode));
+                        if (running && entry->enabled && entry->runnable && !wasRunnable) {
+                            self->scheduleEntry(*entry, now);
+                        }
                     } else if MATCH (RequestChangeEntryFrequencyLimit) {
-                        if (!self->m_acquisitionEntries.contains(arg.entryId)) {
+                        auto entry = self->findEntry(arg.entryId);
+                        if (!entry) {
                             qCritical() << "AcquisitionHub does not have entry" << arg.entryId;
                             return;
                         }
-                        self->m_acquisitionEntries[arg.entryId].frequencyLimit = arg.acquisitionFrequencyLimit;
-                        self->m_acquisitionEntries[arg.entryId].minimumWaitDuration =
-                            std::chrono::steady_clock::duration(
-                                std::chrono::nanoseconds(1000000000ull / arg.acquisitionFrequencyLimit));
+                        entry->frequencyLimit = arg.acquisitionFrequencyLimit;
+                        entry->minimumWaitDuration = periodFromFrequencyLimit(arg.acquisitionFrequencyLimit);
+                        if (running && entry->enabled) {
+                            // Reschedule relative to the last acquisition, so a faster rate takes effect immediately
+                            auto due = entry->lastAcquisitionTime + entry->minimumWaitDuration;
+                            self->scheduleEntry(*entry, due < now ? now : due);
+                        }
                     }
 #undef MATCH
                 },
                 req);
         }
+
+        // Sleep until the earliest deadline. If acquisition is not running, wait for requests only.
+        if (runLoop) {
+            self->pruneSchedule();
+            if (running && !self->m_schedule.empty()) {
+                self->waitUntil(self->m_schedule.front().due);
+            } else {
+                std::unique_lock<std::mutex> lock(self->m_mutex);
+                self->m_cond.wait(lock, [self]() { return !self->m_requestQueue.was_empty(); });
+            }
+        }
+    }
+
+    self->stopAcquisitionTimer();
+}
+
+bool AcquisitionHub::runTick(std::chrono::steady_clock::time_point now) {
+    using namespace ExpressionEvaluator;
+
+    m_pendingEntries.clear();
+    for (auto entryIndex : m_dueEntries) {
+        auto &entry = m_acquisitionEntries[entryIndex];
+        // Update last acquisition time (only for whose PC=0)
+        if (entry.rs.PC == 0) {
+            entry.lastAcquisitionTime = now;
+        }
+        m_pendingEntries.push_back(entryIndex);
+    }
+
+    // When the tick fails acquisition stops, and no entry may be left halfway through its bytecode to be resumed when
+    // it's started again. Entries that did complete are back at PC=0 anyway.
+    auto abortTick = [this]() {
+        for (auto entryIndex : m_dueEntries) {
+            m_acquisitionEntries[entryIndex].rs.resetAll();
+        }
+        return false;
+    };
+
+    // Every round runs all pending entries up to their next Deref, then does all the reads at once. Entries that only
+    // read a static address finish in the second round; pointer chasing takes one more round per indirection.
+    while (!m_pendingEntries.empty()) {
+        m_readPlan.clear();
+        auto stillPending = m_pendingEntries.begin();
+        for (auto entryIndex : m_pendingEntries) {
+            auto &entry = m_acquisitionEntries[entryIndex];
+            auto execResult = entry.staticRead ? runStaticEntry(entryIndex, now) : runEntry(entryIndex, now);
+            if (execResult >= Bytecode::BeginErrors) {
+                return abortTick();
+            }
+            if (execResult == Bytecode::MemAccess) {
+                *stillPending++ = entryIndex;
+            }
+        }
+        m_pendingEntries.erase(stillPending, m_pendingEntries.end());
+
+        if (m_readPlan.empty()) {
+            break;
+        }
+        if (!executeReadPlan()) {
+            return abortTick();
+        }
+    }
+    return true;
+}
+
+ExpressionEvaluator::Bytecode::ExecutionResult AcquisitionHub::runEntry(size_t entryIndex,
+                                                                        std::chrono::steady_clock::time_point now) {
+    using namespace ExpressionEvaluator;
+    auto &entry = m_acquisitionEntries[entryIndex];
+    return entry.bytecode.execute(
+        entry.rs, [&](RuntimeState &rs, const CompiledInstruction &insn) -> Bytecode::ExecutionResult {
+            switch (insn.op) {
+                case Deref8:
+                case Deref16:
+                case Deref32:
+                case Deref64:
+                    // The bytecode stops at the Deref and resumes on it once the read is done, so we'll be called on
+                    // the same instruction twice: first to plan the read, then to take the value.
+                    if (!rs.regFlags.testFlag(RuntimeState::PendingMemAccess)) {
+                        m_readPlan.push_back({entryIndex, rs.stack.last(), size_t(1) << (insn.op - Deref8)});
+                        rs.regFlags |= RuntimeState::PendingMemAccess;
+                        return Bytecode::MemAccess;
+                    }
+                    rs.regFlags.setFlag(RuntimeState::PendingMemAccess, false);
+                    rs.stack.last() = entry.readValue;
+                    return Bytecode::Continue;
+                default: submitResult(entry, insn.op, rs.stack.last(), now); return Bytecode::Continue;
+            }
+        });
+}
+
+ExpressionEvaluator::Bytecode::ExecutionResult
+    AcquisitionHub::runStaticEntry(size_t entryIndex, std::chrono::steady_clock::time_point now) {
+    using namespace ExpressionEvaluator;
+    auto &entry = m_acquisitionEntries[entryIndex];
+    auto &staticRead = *entry.staticRead;
+    if (entry.rs.regFlags.testFlag(RuntimeState::PendingMemAccess)) {
+        entry.rs.regFlags.setFlag(RuntimeState::PendingMemAccess, false);
+        submitResult(entry, staticRead.returnOp, staticRead.extract(entry.readValue), now);
+        return Bytecode::Completed;
+    }
+    m_readPlan.push_back({entryIndex, staticRead.address, staticRead.width});
+    entry.rs.regFlags |= RuntimeState::PendingMemAccess;
+    return Bytecode::MemAccess;
+}
+
+void AcquisitionHub::submitResult(AcquisitionEntry &entry, ExpressionEvaluator::Opcode returnOp, uint64_t word,
+                                  std::chrono::steady_clock::time_point now) {
+    using namespace ExpressionEvaluator;
+    auto addDataPoint = [&]<typename T>(T dummy) {
+        T t;
+        memcpy(&t, &word, sizeof(T));
+        if (m_bufferChannel) {
+            m_bufferChannel->addDataPoint(entry.entryId, now, t);
+        }
+    };
+    switch (returnOp) {
+        case ReturnU8: addDataPoint(uint8_t(0)); break;
+        case ReturnU16: addDataPoint(uint16_t(0)); break;
+        case ReturnU32: addDataPoint(uint32_t(0)); break;
+        case ReturnU64: addDataPoint(uint64_t(0)); break;
+        case ReturnI8: addDataPoint(int8_t(0)); break;
+        case ReturnI16: addDataPoint(int16_t(0)); break;
+        case ReturnI32: addDataPoint(int32_t(0)); break;
+        case ReturnI64: addDataPoint(int64_t(0)); break;
+        case ReturnF32: addDataPoint(float(0)); break;
+        case ReturnF64: addDataPoint(double(0)); break;
+        default: Q_UNREACHABLE(); return;
+    }
+
+    // Each time we return a value, we check if we need to report frequency feedback
+    if (auto interval = now - entry.lastFeedbackTime; interval >= m_frequencyFeedbackReportInterval) {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(interval).count();
+        m_bufferChannel->acquisitionFrequencyFeedback(entry.entryId, entry.acquisitionCounter * 1000.0 / ms);
+        entry.acquisitionCounter = 0;
+        entry.lastFeedbackTime = now;
+    }
+
+    // After checking feedback, we increment the acquisition counter
+    ++entry.acquisitionCounter;
+}
+
+void AcquisitionHub::setEntryBytecode(AcquisitionEntry &entry, ExpressionEvaluator::Bytecode bytecode) {
+    entry.rs.resetAll();
+    entry.staticRead = ExpressionEvaluator::MatchStaticRead(bytecode);
+    if (auto compiled = ExpressionEvaluator::CompiledBytecode::compile(bytecode); compiled.isOk()) {
+        entry.bytecode = compiled.unwrap();
+        entry.runnable = true;
+    } else {
+        qCritical() << "Bytecode of entry" << entry.entryId << "cannot be compiled, it won't be acquired:"
+                    << compiled.unwrapErr();
+        entry.bytecode = {};
+        entry.staticRead.reset();
+        entry.runnable = false;
+    }
+}
+
+bool AcquisitionHub::executeReadPlan() {
+    m_coalescerReads.clear();
+    for (auto &read : m_readPlan) {
+        m_coalescerReads.push_back({read.address, read.width});
+    }
+    m_readCoalescer.plan(m_coalescerReads);
+    auto &blocks = m_readCoalescer.blocks();
+
+    // The block layout is usually the same tick after tick, only hand it over to the probe when it has changed
+    if (m_scatterGatherUsable && blocks != m_activeScatterGatherList) {
+        if (auto result = m_plh->setReadScatterGatherList(blocks); result.isErr()) {
+            qWarning() << "Probe rejected scatter-gather list, falling back to block reads:"
+                       << result.unwrapErr().message;
+            m_scatterGatherUsable = false;
+            m_activeScatterGatherList.clear();
+        } else {
+            m_activeScatterGatherList = blocks;
+        }
     }
+
+    if (m_scatterGatherUsable) {
+        auto result = m_plh->readScatterGather();
+        if (result.isErr()) {
+            qWarning() << "Scatter-gather read of" << blocks.size() << "blocks failed" << result.unwrapErr().message;
+            return false;
+        }
+        m_blockReadBuffer = result.unwrap();
+    } else {
+        // Each block is a single burst of the widest access its alignment allows. Coalesced blocks are word aligned,
+        // so they're always read 32 bits at a time.
+        m_blockReadBuffer.resize(m_readCoalescer.totalBytes());
+        size_t offset = 0;
+        for (auto &block : blocks) {
+            auto elementSize = (block.address % 4 == 0 && block.count % 4 == 0) ? 4
+                               : (block.address % 2 == 0 && block.count % 2 == 0) ? 2
+                                                                                   : 1;
+            auto result = elementSize == 4   ? m_plh->readMemory32(block.address, block.count / 4)
+                          : elementSize == 2 ? m_plh->readMemory16(block.address, block.count / 2)
+                                             : m_plh->readMemory8(block.address, block.count);
+            if (result.isErr()) {
+                qWarning() << "Read memory" << elementSize * 8 << Qt::hex << block.address << "count" << Qt::dec
+                           << block.count / elementSize << "failed" << result.unwrapErr().message;
+                return false;
+            }
+            auto data = result.unwrap();
+            memcpy(m_blockReadBuffer.data() + offset, data.constData(), std::min<size_t>(data.size(), block.count));
+            offset += block.count;
+        }
+    }
+
+    for (size_t i = 0; i < m_readPlan.size(); i++) {
+        m_acquisitionEntries[m_readPlan[i].entryIndex].readValue = m_readCoalescer.fanOut(m_blockReadBuffer, i);
+    }
+    return true;
 }
 
 void AcquisitionHub::startAcquisitionTimer() {
-    //
+#ifdef Q_OS_WIN
+    // Default Windows timer resolution is ~15.6ms, which makes every blocking wait oversleep by that much. Request the
+    // finest resolution the system supports for the duration of acquisition.
+    TIMECAPS caps;
+    if (m_platformTimer.periodMs == 0 && timeGetDevCaps(&caps, sizeof(caps)) == MMSYSERR_NOERROR &&
+        timeBeginPeriod(caps.wPeriodMin) == TIMERR_NOERROR) {
+        m_platformTimer.periodMs = caps.wPeriodMin;
+    }
+    m_platformTimer.slack = std::chrono::milliseconds(m_platformTimer.periodMs ? m_platformTimer.periodMs : 16);
+    // Waits on a high resolution timer typically wake up within a couple hundred microseconds, whatever the timer
+    // resolution is. Only available since Windows 10 1803.
+    if (!m_platformTimer.waitableTimer) {
+        m_platformTimer.waitableTimer =
+            CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    }
+    m_platformTimer.spin = m_platformTimer.waitableTimer ? WaitableTimerSpin : MaximumSpin;
+#else
+    m_platformTimer.slack = std::chrono::microseconds(100);
+    m_platformTimer.spin = m_platformTimer.slack;
+#endif
 }
 
 void AcquisitionHub::stopAcquisitionTimer() {
-    //
+#ifdef Q_OS_WIN
+    if (m_platformTimer.periodMs) {
+        timeEndPeriod(m_platformTimer.periodMs);
+        m_platformTimer.periodMs = 0;
+    }
+    if (m_platformTimer.waitableTimer) {
+        CloseHandle(m_platformTimer.waitableTimer);
+        m_platformTimer.waitableTimer = nullptr;
+    }
+#endif
+}
+
+void AcquisitionHub::waitUntil(std::chrono::steady_clock::time_point deadline) {
+    auto hasRequest = [this]() { return !m_requestQueue.was_empty(); };
+
+    // Block for the bulk of the wait. The OS wakes us up late by up to the timer slack, so leave that part out.
+    if (auto blockUntil = deadline - m_platformTimer.slack; std::chrono::steady_clock::now() < blockUntil) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_cond.wait_until(lock, blockUntil, hasRequest)) {
+            return;
+        }
+    }
+
+    // The slack can be a whole timer period on Windows, far too long to yield away at any sampling rate. Sleep in
+    // shorter waits until the deadline is as close as sleepFor can wake up to.
+    for (auto now = std::chrono::steady_clock::now(); deadline - now > m_platformTimer.spin && !hasRequest();
+         now = std::chrono::steady_clock::now()) {
+        sleepFor(deadline - now - m_platformTimer.spin);
+    }
+
+    // Yield away the last stretch, at most MaximumSpin per deadline
+    while (std::chrono::steady_clock::now() < deadline && !hasRequest()) {
+        std::this_thread::yield();
+    }
+}
+
+void AcquisitionHub::sleepFor(std::chrono::steady_clock::duration duration) {
+#ifdef Q_OS_WIN
+    if (m_platformTimer.waitableTimer) {
+        // Negative due time is relative, in 100ns units
+        auto ticks = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / 100;
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -std::max<LONGLONG>(1, ticks);
+        if (SetWaitableTimerEx(m_platformTimer.waitableTimer, &dueTime, 0, nullptr, nullptr, nullptr, 0)) {
+            WaitForSingleObject(m_platformTimer.waitableTimer, INFINITE);
+            return;
+        }
+    }
+#endif
+    // Without a precise timer this may oversleep by the slack, which still beats spinning through it
+    std::this_thread::sleep_for(duration);
+}
+
+AcquisitionHub::AcquisitionEntry *AcquisitionHub::findEntry(size_t entryId) {
+    if (auto it = m_entryIndices.constFind(entryId); it != m_entryIndices.constEnd()) {
+        return &m_acquisitionEntries[it.value()];
+    }
+    return nullptr;
+}
+
+void AcquisitionHub::removeEntry(size_t entryId) {
+    // Move the last entry into the hole, so the array stays dense
+    auto index = m_entryIndices.take(entryId);
+    if (index != m_acquisitionEntries.size() - 1) {
+        m_acquisitionEntries[index] = std::move(m_acquisitionEntries.back());
+        m_entryIndices[m_acquisitionEntries[index].entryId] = index;
+    }
+    m_acquisitionEntries.pop_back();
+}
+
+void AcquisitionHub::scheduleEntry(AcquisitionEntry &entry, std::chrono::steady_clock::time_point due) {
+    entry.nextDueTime = due;
+    m_schedule.push_back({due, entry.entryId, ++entry.scheduleGeneration});
+    std::push_heap(m_schedule.begin(), m_schedule.end(), std::greater<ScheduleSlot>{});
+}
+
+void AcquisitionHub::unscheduleEntry(AcquisitionEntry &entry) {
+    // Invalidate the slot, it will be dropped once it reaches the front
+    ++entry.scheduleGeneration;
+}
+
+void AcquisitionHub::rebuildSchedule(std::chrono::steady_clock::time_point now) {
+    m_schedule.clear();
+    for (auto &entry : m_acquisitionEntries) {
+        entry.rs.resetAll();
+        entry.lastFeedbackTime = now;
+        entry.acquisitionCounter = 0;
+        if (entry.enabled && entry.runnable) {
+            scheduleEntry(entry, now);
+        }
+    }
+}
+
+AcquisitionHub::AcquisitionEntry *AcquisitionHub::slotEntry(const ScheduleSlot &slot) {
+    auto entry = findEntry(slot.entryId);
+    if (entry && entry->enabled && entry->runnable && entry->scheduleGeneration == slot.generation) {
+        return entry;
+    }
+    return nullptr;
+}
+
+void AcquisitionHub::pruneSchedule() {
+    while (!m_schedule.empty() && !slotEntry(m_schedule.front())) {
+        std::pop_heap(m_schedule.begin(), m_schedule.end(), std::greater<ScheduleSlot>{});
+        m_schedule.pop_back();
+    }
+}
+
+std::chrono::steady_clock::duration AcquisitionHub::periodFromFrequencyLimit(int freqLimit) {
+    // A limit of 0 means "as fast as possible"
+    if (freqLimit <= 0) {
+        return std::chrono::steady_clock::duration::zero();
+    }
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::nanoseconds(1000000000ull / freqLimit));
 }
 
 void AcquisitionHub::readFrequencyFeedbackReportIntervalFromQSettings() {
@@ -241,3 +574,12 @@ void AcquisitionHub::readFrequencyFeedbackReportIntervalFromQSettings() {
     auto value = settings.value("Acquisition/FrequencyFeedbackReportInterval", 200).toInt();
     m_frequencyFeedbackReportInterval = 1ms * value;
 }
+
+void AcquisitionHub::readCoalescerSettingsFromQSettings() {
+    QSettings settings;
+
+    auto value = settings.value("Acquisition/CoalesceGapBytes", 16).toInt();
+    m_readCoalescer.setGapThreshold(std::max(value, 0));
+    // Turned off for targets where reading bytes no entry asked for has side effects, see ReadCoalescer
+    m_readCoalescer.setCoalescingEnabled(settings.value("Acquisition/CoalesceReads", true).toBool());
+}
@@ -4,11 +4,17 @@
 #include "acquisitionbufferchannel.h"
 #include "atomic_queue/atomic_queue.h"
 #include "expressionevaluator/bytecode.h"
+#include "expressionevaluator/compiledbytecode.h"
+#include "expressionevaluator/staticread.h"
+#include "probelib/misc.h"
+#include "readcoalescer.h"
+#include <QHash>
 #include <QObject>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 class ProbeLibHost;
 
@@ -24,6 +30,9 @@ public:
     void stopAcquisition();
     bool isAcquisitionActive() const { return m_acquisitionRunning; }
 
+    /// @brief CPU time the acquisition thread has consumed since the hub was created. Used for profiling.
+    std::chrono::nanoseconds acquisitionThreadCpuTime();
+
     void setFrequencyFeedbackReportInterval();
 
     void addWatchEntry(size_t entryId, bool enabled, ExpressionEvaluator::Bytecode runtimeBytecode, int freqLimit);
@@ -74,31 +83,77 @@ private:
     >; // clang-format on
 
     //
-    // Acquisition entry. This data structure keeps the acquisition bytecode, the current execution status of a watch
-    // entry.
+    // Acquisition entry. This data structure keeps the compiled acquisition bytecode, the current execution status of a
+    // watch entry. Entries are kept in a flat array, everything that's touched on each tick lives inline.
     //
     struct AcquisitionEntry {
-        ExpressionEvaluator::Bytecode bytecode;
-        ExpressionEvaluator::ExecutionState es;
+        size_t entryId;
+        ExpressionEvaluator::CompiledBytecode bytecode;
+        ExpressionEvaluator::RuntimeState rs;
+        std::optional<ExpressionEvaluator::StaticRead> staticRead; ///< Set if the bytecode can bypass the VM
+        bool runnable; ///< Cleared if the bytecode couldn't be compiled, such entry is never scheduled
         int frequencyLimit;
         bool enabled;
         std::chrono::steady_clock::time_point lastAcquisitionTime;
         std::chrono::steady_clock::duration minimumWaitDuration;
+        uint64_t readValue; ///< Result of the read planned on last Deref, consumed when the bytecode resumes
+
+        // Scheduling context
+        std::chrono::steady_clock::time_point nextDueTime; ///< Absolute deadline of the next acquisition
+        uint64_t scheduleGeneration; ///< Bumped on every reschedule, stale slots in the schedule heap are skipped
 
         // Feedback context
         std::chrono::steady_clock::time_point lastFeedbackTime;
         size_t acquisitionCounter;
     };
 
+    //
+    // Schedule slot. The acquisition thread keeps a min-heap of these ordered by due time, and only ever looks at the
+    // front of the heap to decide when to wake up next. Slots are never removed from the middle of the heap; when an
+    // entry is rescheduled, removed or disabled, its old slot becomes stale (generation mismatch) and is dropped when
+    // it reaches the front.
+    //
+    struct ScheduleSlot {
+        std::chrono::steady_clock::time_point due;
+        size_t entryId;
+        uint64_t generation;
+
+        bool operator>(const ScheduleSlot &other) const { return due > other.due; }
+    };
+
+    //
+    // Planned read. While a tick is running, each due entry executes until it hits a Deref, which is recorded here
+    // instead of being read right away. All planned reads are then done as one scatter-gather transaction.
+    //
+    struct PlannedRead {
+        size_t entryIndex;
+        uint64_t address;
+        size_t width;
+    };
+
     //
     // Platform-dependent precision timer context
     //
     struct PlatformTimer {
 #ifdef Q_OS_WIN
-
+        unsigned int periodMs = 0; ///< Resolution requested with timeBeginPeriod. 0 when no request is in effect.
+        void *waitableTimer = nullptr; ///< High resolution waitable timer, nullptr if the system doesn't have them
 #endif
+        /// @brief The OS may oversleep by about this much, so blocking waits end this early and the remaining time is
+        /// spent in sleepFor, then yielding for the last spin until the deadline.
+        std::chrono::steady_clock::duration slack;
+        /// @brief How late sleepFor may wake up, so the stretch before a deadline that is yielded away. At most
+        /// MaximumSpin.
+        std::chrono::steady_clock::duration spin;
     };
 
+    /// @brief Stretch before a deadline that is yielded away when sleepFor can't do better than a plain sleep. That
+    /// oversleeps by the slack, so with a slack no longer than this (1 ms with timeBeginPeriod(1)), all of the slack is
+    /// yielded away. Only a finer timer, such as a high resolution waitable timer, gets a shorter PlatformTimer::spin.
+    static constexpr auto MaximumSpin = std::chrono::milliseconds(1);
+    /// @brief Wake-up error of a high resolution waitable timer, which is what's left to yield away when there is one.
+    static constexpr auto WaitableTimerSpin = std::chrono::microseconds(200);
+
 private:
     void sendRequest(RuntimeRequest &&request);
 
@@ -106,8 +161,49 @@ private:
     void startAcquisitionTimer();
     void stopAcquisitionTimer();
 
+    /// @brief Blocks the acquisition thread until the deadline has passed, or until a runtime request arrives.
+    void waitUntil(std::chrono::steady_clock::time_point deadline);
+    /// @brief Sleeps as precisely as the platform allows, doesn't wake up on runtime requests.
+    void sleepFor(std::chrono::steady_clock::duration duration);
+
+    // Entry bookkeeping. These must only be called on the acquisition thread.
+    /// @brief Look up an entry by ID. Returns nullptr if there's no such entry.
+    AcquisitionEntry *findEntry(size_t entryId);
+    void removeEntry(size_t entryId);
+
+    // Schedule maintenance. These must only be called on the acquisition thread.
+    void scheduleEntry(AcquisitionEntry &entry, std::chrono::steady_clock::time_point due);
+    void unscheduleEntry(AcquisitionEntry &entry);
+    void rebuildSchedule(std::chrono::steady_clock::time_point now);
+    /// @brief Returns the entry a slot schedules, or nullptr if the slot is stale.
+    AcquisitionEntry *slotEntry(const ScheduleSlot &slot);
+    /// @brief Drop stale slots on the front of the heap, so the front (if any) is a real deadline.
+    void pruneSchedule();
+
+    static std::chrono::steady_clock::duration periodFromFrequencyLimit(int freqLimit);
+
+    // Tick execution. These must only be called on the acquisition thread.
+    /// @brief Runs all due entries to completion, batching their memory reads round by round.
+    /// @return false if a memory read or execution failed, in which case acquisition should stop.
+    bool runTick(std::chrono::steady_clock::time_point now);
+    /// @brief Runs an entry until it completes or plans a memory read.
+    ExpressionEvaluator::Bytecode::ExecutionResult runEntry(size_t entryIndex,
+                                                            std::chrono::steady_clock::time_point now);
+    /// @brief Same as runEntry, but for entries with a StaticRead: the bytecode is not run at all.
+    ExpressionEvaluator::Bytecode::ExecutionResult runStaticEntry(size_t entryIndex,
+                                                                  std::chrono::steady_clock::time_point now);
+    /// @brief Hands an entry's result over to the buffer channel, and does frequency feedback bookkeeping.
+    void submitResult(AcquisitionEntry &entry, ExpressionEvaluator::Opcode returnOp, uint64_t word,
+                      std::chrono::steady_clock::time_point now);
+    /// @brief Replace the bytecode of an entry, compile it and see if it qualifies for the static read fast path.
+    static void setEntryBytecode(AcquisitionEntry &entry, ExpressionEvaluator::Bytecode bytecode);
+    /// @brief Reads all memory in m_readPlan, coalesced into blocks, and hands the values back to the entries.
+    bool executeReadPlan();
+
     /// @brief This is read each time the acquisition starts
     void readFrequencyFeedbackReportIntervalFromQSettings();
+    /// @brief This is read each time the acquisition starts
+    void readCoalescerSettingsFromQSettings();
 
 private:
     ProbeLibHost *m_plh;
@@ -121,8 +217,24 @@ private:
     atomic_queue::AtomicQueue2<RuntimeRequest, 128> m_requestQueue;
     IAcquisitionBufferChannel::p m_bufferChannel;
 
-    // All acquisition entries
-    QMap<size_t, AcquisitionEntry> m_acquisitionEntries;
+    // All acquisition entries. Entries are swapped around on removal, so anything that outlives a tick must refer to
+    // an entry by its ID rather than its index.
+    std::vector<AcquisitionEntry> m_acquisitionEntries;
+    QHash<size_t, size_t> m_entryIndices; ///< Entry ID -> index into m_acquisitionEntries
+
+    // Deadline schedule (min-heap on due time) and the indices of entries due on current tick
+    std::vector<ScheduleSlot> m_schedule;
+    std::vector<size_t> m_dueEntries;
+    std::vector<size_t> m_pendingEntries;
+    PlatformTimer m_platformTimer;
+
+    // Read plan of the current round, its coalesced blocks, and the scatter-gather list last handed to the probe
+    std::vector<PlannedRead> m_readPlan;
+    std::vector<ReadCoalescer::Read> m_coalescerReads;
+    ReadCoalescer m_readCoalescer;
+    QVector<probelib::ScatterGatherEntry> m_activeScatterGatherList;
+    QByteArray m_blockReadBuffer;
+    bool m_scatterGatherUsable; ///< Cleared when the probe rejects the list, then plain reads are used instead
 
     std::chrono::milliseconds m_frequencyFeedbackReportInterval;
 
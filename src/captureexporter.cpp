@@ -0,0 +1,285 @@
+#include "captureexporter.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <string>
+
+static_assert(std::endian::native == std::endian::little, "Psrec files are written in host byte order");
+
+namespace {
+
+/**
+ * @brief Split [0, count) into up to threadCount contiguous ranges and call fn(index, begin, end) for each on a thread
+ * of its own, the calling thread doing the first one. Returns when all of them are done.
+ */
+template<typename Fn>
+void ParallelFor(size_t count, size_t threadCount, Fn &&fn) {
+    threadCount = std::max<size_t>(1, std::min(threadCount, count));
+    auto perThread = (count + threadCount - 1) / threadCount;
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        auto begin = std::min(i * perThread, count);
+        threads.emplace_back([&, i, begin]() { fn(i, begin, std::min(begin + perThread, count)); });
+    }
+    fn(0, 0, std::min(perThread, count));
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+/// @brief Append a cell of the CSV, with the shortest text that reads back as the same double.
+void AppendNumber(std::string &text, double number) {
+    char buffer[32];
+    auto end = std::to_chars(buffer, buffer + sizeof(buffer), number).ptr;
+    text.append(buffer, end);
+    text += ',';
+}
+
+} // namespace
+
+CaptureExporter::CaptureExporter(DiskBackedStorage &storage, QString fileName, Format format,
+                                 std::vector<Channel> channels, QByteArray workspace, std::function<void()> notify)
+    : m_storage(storage), m_file(fileName), m_format(format), m_channels(std::move(channels)),
+      m_workspace(std::move(workspace)), m_notify(std::move(notify)) {
+    for (auto &channel : m_channels) {
+        m_totalPointCount += channel.snapshot.pointCount();
+        for (auto &columns : channel.columns) {
+            m_totalPointCount += columns.keys.size();
+        }
+    }
+    m_exportThread = std::thread(exportThread, this);
+}
+
+CaptureExporter::~CaptureExporter() {
+    cancel();
+    m_exportThread.join();
+}
+
+Result<void, CaptureExporter::Error> CaptureExporter::result() const {
+    if (m_error) {
+        return Err(*m_error);
+    }
+    return Ok();
+}
+
+QString CaptureExporter::errorString(Error error) {
+    switch (error) {
+        case Error::FileCannotOpen: return tr("The file cannot be opened for writing.");
+        case Error::FileWriteFailed: return tr("Writing to the file failed, the disk may be full.");
+        case Error::DataDiscarded:
+            return tr("Part of the data was recycled from the cache file before it could be exported.");
+        case Error::Canceled: return tr("The export was canceled.");
+        default: return tr("Unknown error");
+    }
+}
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+size_t CaptureExporter::ChannelReader::read(DiskBackedStorage::LoggedPoint *out, size_t maxCount) {
+    // A channel has either a snapshot or columns, reading the other one gives nothing
+    auto count = m_snapshotReader.read(out, maxCount);
+    while (count < maxCount && m_column < m_columns.size()) {
+        auto &columns = m_columns[m_column];
+        auto n = std::min(maxCount - count, columns.keys.size() - m_index);
+        for (size_t i = 0; i < n; i++) {
+            out[count + i] = {columns.keys[m_index + i], columns.values[m_index + i]};
+        }
+        count += n;
+        m_index += n;
+        if (m_index == columns.keys.size()) {
+            m_column++;
+            m_index = 0;
+        }
+    }
+    return count;
+}
+
+void CaptureExporter::exportThread(CaptureExporter *self) {
+    std::optional<Error> error;
+    if (!self->m_file.open(QFile::WriteOnly)) {
+        error = Error::FileCannotOpen;
+    } else {
+        self->m_lastNotify = std::chrono::steady_clock::now();
+        error = self->m_format == Format::Psrec ? self->writePsrec() : self->writeCsv();
+        self->m_file.close();
+        if (error) {
+            self->m_file.remove();
+        }
+    }
+
+    self->m_error = error;
+    self->m_finished.store(true, std::memory_order_release);
+    if (self->m_notify) {
+        self->m_notify();
+    }
+}
+
+std::optional<CaptureExporter::Error> CaptureExporter::writePsrec() {
+    PsrecHeader header{PsrecMagic, PsrecVersion, uint32_t(m_channels.size()), 0, 0, 0};
+    if (!write(&header, sizeof(header))) {
+        return Error::FileWriteFailed;
+    }
+
+    // Points are read into the buffer and split into the key and value columns of a batch
+    std::vector<DiskBackedStorage::LoggedPoint> points(ChunkSize);
+    std::vector<double> keys(ChunkSize), values(ChunkSize);
+    std::vector<PsrecChannel> table;
+    for (auto &channel : m_channels) {
+        auto &entry = table.emplace_back(PsrecChannel{m_offset, 0, 0, 0, 0, 0, uint32_t(channel.name.toUtf8().size())});
+        std::vector<PsrecBatchIndex> batches;
+        SummaryPyramid summary; // Of what's exported, the chain's own may have recycled points or be out of range
+        ChannelReader reader(m_storage, channel);
+        while (true) {
+            if (m_canceled.load(std::memory_order_relaxed)) {
+                return Error::Canceled;
+            }
+
+            auto count = reader.read(points.data(), ChunkSize);
+            if (reader.hasFailed()) {
+                return Error::DataDiscarded;
+            }
+            for (size_t i = 0; i < count; i++) {
+                keys[i] = points[i].key;
+                values[i] = points[i].value;
+            }
+            if (count) {
+                batches.push_back({m_offset, count, points[0].key, points[count - 1].key});
+                summary.append(points.data(), count);
+            }
+            PsrecBatch batch{count};
+            if (!write(&batch, sizeof(batch)) || !write(keys.data(), count * sizeof(double)) ||
+                !write(values.data(), count * sizeof(double))) {
+                return Error::FileWriteFailed;
+            }
+            if (!count) {
+                break;
+            }
+            entry.pointCount += count;
+            progress(count);
+        }
+
+        entry.batchIndexOffset = m_offset;
+        entry.batchCount = batches.size();
+        if (!write(batches.data(), batches.size() * sizeof(PsrecBatchIndex))) {
+            return Error::FileWriteFailed;
+        }
+        entry.summaryOffset = m_offset;
+        entry.summaryLevelCount = uint32_t(summary.levelCount());
+        for (size_t i = 0; i < summary.levelCount(); i++) {
+            auto level = summary.level(i);
+            uint64_t bucketCount = level.size();
+            if (!write(&bucketCount, sizeof(bucketCount)) || !write(level.data(), level.size_bytes())) {
+                return Error::FileWriteFailed;
+            }
+        }
+    }
+
+    header.tableOffset = m_offset;
+    for (size_t i = 0; i < m_channels.size(); i++) {
+        auto name = m_channels[i].name.toUtf8();
+        name.append((8 - name.size() % 8) % 8, '\0');
+        if (!write(&table[i], sizeof(PsrecChannel)) || !write(name.constData(), name.size())) {
+            return Error::FileWriteFailed;
+        }
+    }
+
+    header.workspaceOffset = m_offset;
+    header.workspaceBytes = m_workspace.size();
+    if (!write(m_workspace.constData(), m_workspace.size())) {
+        return Error::FileWriteFailed;
+    }
+
+    // The table offset goes in last, so a file cut short is never taken for a complete one
+    if (!m_file.seek(0) || !write(&header, sizeof(header))) {
+        return Error::FileWriteFailed;
+    }
+    return std::nullopt;
+}
+
+std::optional<CaptureExporter::Error> CaptureExporter::writeCsv() {
+    std::string text;
+    for (auto &channel : m_channels) {
+        text += "time_" + channel.name.toStdString() + ",val_" + channel.name.toStdString() + ',';
+    }
+    text += '\n';
+    if (!write(text.data(), text.size())) {
+        return Error::FileWriteFailed;
+    }
+
+    // Every chunk of rows is decoded a channel per thread, then formatted a range of rows per thread, and written in
+    // order. Chunks are large enough that starting threads for each costs next to nothing.
+    auto threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<ChannelReader> readers;
+    for (auto &channel : m_channels) {
+        readers.emplace_back(m_storage, channel);
+    }
+    using Points = std::vector<DiskBackedStorage::LoggedPoint>;
+    std::vector<Points> points(m_channels.size(), Points(ChunkSize));
+    std::vector<size_t> counts(m_channels.size());
+    std::vector<std::string> texts(threadCount);
+
+    while (true) {
+        if (m_canceled.load(std::memory_order_relaxed)) {
+            return Error::Canceled;
+        }
+
+        ParallelFor(readers.size(), threadCount, [&](size_t, size_t begin, size_t end) {
+            for (auto i = begin; i < end; i++) {
+                counts[i] = readers[i].read(points[i].data(), ChunkSize);
+            }
+        });
+        if (std::any_of(readers.begin(), readers.end(),
+                        [](const ChannelReader &reader) { return reader.hasFailed(); })) {
+            return Error::DataDiscarded;
+        }
+        auto rowCount = counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+        if (!rowCount) {
+            return std::nullopt;
+        }
+
+        ParallelFor(rowCount, threadCount, [&](size_t index, size_t begin, size_t end) {
+            auto &text = texts[index];
+            text.clear();
+            for (auto row = begin; row < end; row++) {
+                for (size_t i = 0; i < points.size(); i++) {
+                    if (row < counts[i]) {
+                        AppendNumber(text, points[i][row].key);
+                        AppendNumber(text, points[i][row].value);
+                    } else {
+                        text += ",,";
+                    }
+                }
+                text += '\n';
+            }
+        });
+        for (auto &text : texts) {
+            if (!write(text.data(), text.size())) {
+                return Error::FileWriteFailed;
+            }
+            text.clear();
+        }
+
+        uint64_t pointCount = 0;
+        for (auto count : counts) {
+            pointCount += count;
+        }
+        progress(pointCount);
+    }
+}
+
+bool CaptureExporter::write(const void *data, size_t size) {
+    if (m_file.write(static_cast<const char *>(data), qint64(size)) != qint64(size)) {
+        return false;
+    }
+    m_offset += size;
+    return true;
+}
+
+void CaptureExporter::progress(uint64_t pointCount) {
+    m_writtenPointCount.fetch_add(pointCount, std::memory_order_relaxed);
+    auto now = std::chrono::steady_clock::now();
+    if (m_notify && now - m_lastNotify >= NotifyInterval) {
+        m_lastNotify = now;
+        m_notify();
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "diskbackedstorage.h"
+#include "result.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QString>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+class CaptureFile;
+
+/**
+ * @brief Writes logged channels to a file on a thread of its own, so exporting a long capture neither freezes the UI
+ * nor has to wait for acquisition to stop. Channels are exported from snapshots taken up front: points logged after
+ * that aren't included, and if blocks are recycled before they're read, the export fails. Channels of a capture file
+ * that was opened again are exported from its mapping instead.
+ *
+ * Psrec files are columnar and laid out so they can be mapped and plotted without parsing, see PsrecHeader and
+ * CaptureFile. They also hold the summaries of the channels, and their watch entries as workspace JSON. CSV files have
+ * the same layout as always, a time and a value column for each channel, the n-th row holding the n-th point of every
+ * channel; their rows are decoded and formatted on all cores.
+ */
+class CaptureExporter {
+    Q_DECLARE_TR_FUNCTIONS(CaptureExporter)
+
+public:
+    enum class Format {
+        Psrec,
+        Csv,
+    };
+
+    enum class Error {
+        FileCannotOpen,
+        FileWriteFailed,
+        DataDiscarded, ///< Blocks were recycled or freed before they could be exported
+        Canceled,
+    };
+
+    /// @brief Points already in memory, as runs of key and value columns. See CaptureFile::pointsInRange().
+    struct Columns {
+        std::span<const double> keys;
+        std::span<const double> values;
+    };
+
+    /// @brief Exported from its snapshot, or from its columns if it was opened from a capture file.
+    struct Channel {
+        QString name;
+        DiskBackedStorage::ChainSnapshot snapshot;
+        std::vector<Columns> columns;
+        std::shared_ptr<const CaptureFile> capture; ///< Keeps the columns mapped until the export is done
+    };
+
+    /**
+     * @brief Start of a .psrec file. Everything in the file is little endian and 8-byte aligned, and keys are
+     * milliseconds since the start of acquisition, as in the graphs.
+     *
+     * Channel data follows the header, one channel after another. A channel is a series of batches, each a
+     * PsrecBatch followed by double keys[pointCount] then double values[pointCount]; a batch of no points ends it.
+     * After them come a PsrecBatchIndex for each batch, then the levels of the channel's SummaryPyramid, level 0 first,
+     * each a uint64 bucket count followed by its SummaryBucket array. The channel table follows the last channel, a
+     * PsrecChannel for each channel, each followed by its name. The workspace JSON is last.
+     */
+    struct PsrecHeader {
+        uint64_t magic;          ///< PsrecMagic
+        uint32_t version;        ///< PsrecVersion
+        uint32_t channelCount;   ///< Entries of the channel table
+        uint64_t tableOffset;    ///< Where the channel table starts, 0 if the export didn't finish
+        uint64_t workspaceOffset;
+        uint64_t workspaceBytes; ///< Of the UTF-8 JSON, {"watch_entries": [Serialization::WatchEntry per channel]}
+    };
+    struct PsrecBatch {
+        uint64_t pointCount;
+    };
+    struct PsrecBatchIndex {
+        uint64_t offset; ///< Of the PsrecBatch
+        uint64_t pointCount;
+        double firstKey;
+        double lastKey;
+    };
+    struct PsrecChannel {
+        uint64_t dataOffset;        ///< Where the channel's first batch starts
+        uint64_t pointCount;        ///< In all of its batches
+        uint64_t batchIndexOffset;  ///< Where its PsrecBatchIndex array starts
+        uint64_t batchCount;        ///< Entries of the batch index, not counting the empty batch at the end
+        uint64_t summaryOffset;     ///< Where its first summary level starts
+        uint32_t summaryLevelCount;
+        uint32_t nameBytes;         ///< Of the UTF-8 name that follows, which is padded to a multiple of 8 bytes
+    };
+    static constexpr uint64_t PsrecMagic = 0x44524f4345525350; ///< "PSRECORD"
+    static constexpr uint32_t PsrecVersion = 2;
+
+    /**
+     * @brief Start exporting right away. The file is removed if the export fails or is canceled.
+     * @param workspace JSON describing the channels, only written to Psrec files.
+     * @param notify Called on the export thread now and then as the export progresses, and once when it's finished.
+     */
+    CaptureExporter(DiskBackedStorage &storage, QString fileName, Format format, std::vector<Channel> channels,
+                    QByteArray workspace, std::function<void()> notify);
+    /// @brief Cancels the export if it's still running.
+    ~CaptureExporter();
+
+    /// @brief Stop the export as soon as possible. It finishes with Error::Canceled.
+    void cancel() { m_canceled.store(true, std::memory_order_relaxed); }
+
+    uint64_t writtenPointCount() const { return m_writtenPointCount.load(std::memory_order_relaxed); }
+    /// @brief Points in the snapshots' blocks, a few more than are exported when the range cuts blocks.
+    uint64_t totalPointCount() const { return m_totalPointCount; }
+
+    bool isFinished() const { return m_finished.load(std::memory_order_acquire); }
+    /// @brief Only valid once isFinished().
+    Result<void, Error> result() const;
+
+    static QString errorString(Error error);
+
+private:
+    /// @brief Reads the points of a channel from wherever they are.
+    class ChannelReader {
+    public:
+        ChannelReader(DiskBackedStorage &storage, const Channel &channel)
+            : m_snapshotReader(storage, channel.snapshot), m_columns(channel.columns) {}
+
+        /// @return How many points were read into out, less than maxCount only when the end is reached or it failed.
+        size_t read(DiskBackedStorage::LoggedPoint *out, size_t maxCount);
+        bool hasFailed() const { return m_snapshotReader.hasFailed(); }
+
+    private:
+        DiskBackedStorage::SnapshotReader m_snapshotReader;
+        std::span<const Columns> m_columns;
+        size_t m_column = 0; ///< Run being read
+        size_t m_index = 0;  ///< Next point in it
+    };
+
+    static void exportThread(CaptureExporter *self);
+    std::optional<Error> writePsrec();
+    std::optional<Error> writeCsv();
+    bool write(const void *data, size_t size);
+    /// @brief Called on every chunk written, notifies at most every NotifyInterval.
+    void progress(uint64_t pointCount);
+
+private:
+    static constexpr auto NotifyInterval = std::chrono::milliseconds(100);
+    static constexpr size_t ChunkSize = 65536; ///< Points per channel read at a time
+
+    DiskBackedStorage &m_storage;
+    QFile m_file;
+    Format m_format;
+    std::vector<Channel> m_channels;
+    QByteArray m_workspace;
+    std::function<void()> m_notify;
+    uint64_t m_totalPointCount = 0;
+    uint64_t m_offset = 0; ///< Bytes written so far
+    std::chrono::steady_clock::time_point m_lastNotify;
+
+    std::thread m_exportThread;
+    std::atomic<bool> m_canceled = false;
+    std::atomic<uint64_t> m_writtenPointCount = 0;
+    std::atomic<bool> m_finished = false;
+    std::optional<Error> m_error; ///< Set before m_finished
+};
@@ -0,0 +1,114 @@
+#include "capturefile.h"
+#include <algorithm>
+#include <cstring>
+
+using PsrecHeader = CaptureExporter::PsrecHeader;
+using PsrecBatch = CaptureExporter::PsrecBatch;
+using PsrecBatchIndex = CaptureExporter::PsrecBatchIndex;
+using PsrecChannel = CaptureExporter::PsrecChannel;
+
+Result<void, CaptureFile::Error> CaptureFile::open(QString fileName) {
+    m_file.setFileName(fileName);
+    if (!m_file.open(QFile::ReadOnly)) {
+        return Err(Error::FileCannotOpen);
+    }
+    m_size = m_file.size();
+    if (m_size < sizeof(PsrecHeader)) {
+        return Err(Error::NotACaptureFile);
+    }
+    m_mapping = m_file.map(0, m_size);
+    if (!m_mapping) {
+        return Err(Error::FileMappingFail);
+    }
+
+    std::memcpy(&m_header, m_mapping, sizeof(m_header));
+    if (m_header.magic != CaptureExporter::PsrecMagic) {
+        return Err(Error::NotACaptureFile);
+    } else if (m_header.version != CaptureExporter::PsrecVersion) {
+        return Err(Error::UnsupportedVersion);
+    } else if (!m_header.tableOffset) {
+        return Err(Error::Incomplete);
+    } else if (!isInFile(m_header.workspaceOffset, m_header.workspaceBytes, 1)) {
+        return Err(Error::Corrupted);
+    }
+
+    // Only the tables are checked, points are left alone so they don't have to be read from disk
+    auto offset = m_header.tableOffset;
+    for (uint32_t i = 0; i < m_header.channelCount; i++) {
+        if (!isInFile(offset, 1, sizeof(PsrecChannel))) {
+            return Err(Error::Corrupted);
+        }
+        auto entry = at<PsrecChannel>(offset);
+        offset += sizeof(PsrecChannel);
+        if (!isInFile(offset, entry->nameBytes, 1) ||
+            !isInFile(entry->batchIndexOffset, entry->batchCount, sizeof(PsrecBatchIndex))) {
+            return Err(Error::Corrupted);
+        }
+        auto name = QString::fromUtf8(at<char>(offset), entry->nameBytes);
+        offset += (uint64_t(entry->nameBytes) + 7) / 8 * 8;
+
+        std::span batches(at<PsrecBatchIndex>(entry->batchIndexOffset), entry->batchCount);
+        for (auto &batch : batches) {
+            if (!isInFile(batch.offset, 1, sizeof(PsrecBatch)) ||
+                !isInFile(batch.offset + sizeof(PsrecBatch), batch.pointCount, 2 * sizeof(double))) {
+                return Err(Error::Corrupted);
+            }
+        }
+
+        std::vector<SummaryPyramid::Level> levels;
+        auto levelOffset = entry->summaryOffset;
+        for (uint32_t level = 0; level < entry->summaryLevelCount; level++) {
+            if (!isInFile(levelOffset, 1, sizeof(uint64_t))) {
+                return Err(Error::Corrupted);
+            }
+            auto bucketCount = *at<uint64_t>(levelOffset);
+            levelOffset += sizeof(uint64_t);
+            if (!bucketCount || !isInFile(levelOffset, bucketCount, sizeof(SummaryBucket))) {
+                return Err(Error::Corrupted);
+            }
+            levels.emplace_back(at<SummaryBucket>(levelOffset), bucketCount);
+            levelOffset += bucketCount * sizeof(SummaryBucket);
+        }
+
+        m_channels.push_back({name, entry->pointCount, batches, SummaryPyramid::view(std::move(levels))});
+    }
+    return Ok();
+}
+
+QString CaptureFile::errorString(Error error) {
+    switch (error) {
+        case Error::FileCannotOpen: return tr("The file cannot be opened for reading.");
+        case Error::FileMappingFail: return tr("The file cannot be mapped to system memory.");
+        case Error::NotACaptureFile: return tr("The file is not a ProbeScope recording.");
+        case Error::UnsupportedVersion: return tr("The recording was made by another version of ProbeScope.");
+        case Error::Incomplete: return tr("The recording is incomplete, its export didn't finish.");
+        case Error::Corrupted: return tr("The recording is corrupted.");
+        default: return tr("Unknown error");
+    }
+}
+
+QByteArray CaptureFile::workspace() const {
+    return QByteArray::fromRawData(at<char>(m_header.workspaceOffset), qsizetype(m_header.workspaceBytes));
+}
+
+std::vector<CaptureFile::Columns> CaptureFile::pointsInRange(size_t channel, double lower, double upper) const {
+    std::vector<Columns> result;
+    auto &batches = m_channels[channel].batches;
+    auto batch = std::partition_point(batches.begin(), batches.end(),
+                                      [&](const PsrecBatchIndex &batch) { return batch.lastKey < lower; });
+    for (; batch != batches.end() && batch->firstKey <= upper; ++batch) {
+        std::span keys(at<double>(batch->offset + sizeof(PsrecBatch)), batch->pointCount);
+        std::span values(keys.data() + keys.size(), keys.size());
+        auto begin = std::lower_bound(keys.begin(), keys.end(), lower) - keys.begin();
+        auto end = std::upper_bound(keys.begin(), keys.end(), upper) - keys.begin();
+        result.push_back({keys.subspan(begin, end - begin), values.subspan(begin, end - begin)});
+    }
+    return result;
+}
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+bool CaptureFile::isInFile(uint64_t offset, uint64_t count, uint64_t size) const {
+    // Everything in the file is 8-byte aligned. Written so that it can't overflow on bogus counts.
+    return offset % 8 == 0 && offset <= m_size && count <= (m_size - offset) / size;
+}
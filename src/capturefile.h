@@ -0,0 +1,71 @@
+#pragma once
+
+#include "captureexporter.h"
+#include "result.h"
+#include "summarypyramid.h"
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QFile>
+#include <QString>
+#include <span>
+#include <vector>
+
+/**
+ * @brief A .psrec file written by CaptureExporter, opened read-only for looking at a capture again. The file is mapped
+ * as a whole and nothing is read up front but its tables: summaries and points are used straight from the mapping, so
+ * the system only pages in what's looked at. Opening is about as quick for a file of gigabytes as for a small one.
+ */
+class CaptureFile {
+    Q_DECLARE_TR_FUNCTIONS(CaptureFile)
+
+public:
+    enum class Error {
+        FileCannotOpen,
+        FileMappingFail,
+        NotACaptureFile,
+        UnsupportedVersion,
+        Incomplete, ///< The export didn't finish
+        Corrupted,  ///< Tables point outside the file
+    };
+
+    struct Channel {
+        QString name;
+        uint64_t pointCount;
+        std::span<const CaptureExporter::PsrecBatchIndex> batches;
+        SummaryPyramid summary; ///< A view of the levels in the file
+    };
+
+    /// @brief Points of a batch, in the file.
+    using Columns = CaptureExporter::Columns;
+
+    CaptureFile() = default;
+    CaptureFile(const CaptureFile &) = delete;
+    CaptureFile &operator=(const CaptureFile &) = delete;
+
+    /// @brief Map a file and check its tables. A CaptureFile is opened only once.
+    Result<void, Error> open(QString fileName);
+    static QString errorString(Error error);
+
+    QString fileName() const { return m_file.fileName(); }
+    const std::vector<Channel> &channels() const { return m_channels; }
+    /// @brief The workspace JSON, see CaptureExporter::PsrecHeader. Refers to the mapping.
+    QByteArray workspace() const;
+
+    /// @brief Points of a channel with keys in [lower, upper], in order, as runs of columns in the file.
+    std::vector<Columns> pointsInRange(size_t channel, double lower, double upper) const;
+
+private:
+    /// @brief Whether [offset, offset + count * size) is in the file.
+    bool isInFile(uint64_t offset, uint64_t count, uint64_t size) const;
+    template<typename T>
+    const T *at(uint64_t offset) const {
+        return reinterpret_cast<const T *>(m_mapping + offset);
+    }
+
+private:
+    QFile m_file;
+    const uint8_t *m_mapping = nullptr; ///< Unmapped when m_file is closed or destroyed
+    uint64_t m_size = 0;
+    CaptureExporter::PsrecHeader m_header{};
+    std::vector<Channel> m_channels;
+};
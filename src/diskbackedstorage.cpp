@@ -1,230 +1,616 @@
 
 #include "diskbackedstorage.h"
 #include <QDebug>
+#include <cstring>
+#include <map>
+#include <random>
+
+#if defined(Q_OS_WIN)
+#define _WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static void FlushMapping(uint8_t *address, uint64_t size) {
+#if defined(Q_OS_WIN)
+    FlushViewOfFile(address, size);
+#else
+    msync(address, size, MS_SYNC);
+#endif
+}
+
+DiskBackedStorage::DiskBackedStorage() {
+    m_syncThread = std::thread(syncThread, this);
+    m_readerThread = std::thread(readerThread, this);
+}
 
 DiskBackedStorage::~DiskBackedStorage() {
-    m_backingStore.unmap(m_storageMapping);
+    {
+        std::lock_guard<std::mutex> lock(m_syncMutex);
+        m_syncExit = true;
+    }
+    m_syncCond.notify_all();
+    m_syncThread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        m_readExit = true;
+    }
+    m_readCond.notify_all();
+    m_readerThread.join();
+
+    unmapSegments();
 
     // Delete cache file on complete destruction
     m_backingStore.remove();
 }
 
 void DiskBackedStorage::clearStorage() {
-    m_storageOccupationBitmap.clear();
-    m_storageOccupationBitmap.resize(m_backingFileBlockCountLimit, false);
-    m_occupiedBlockCount = 0;
-    m_backingFileBlockCount = 1;
+    m_allocator.reset(m_backingFileBlockCountLimit);
+    m_captureId = 0;
+
+    // Start over from one segment
+    unmapSegments();
+    m_backingFileBlockCount = 0;
+    m_backingStore.resize(0);
+    if (!growToBlocksLong(1)) {
+        return;
+    }
 
-    // Just assume this works
-    m_backingStore.unmap(m_storageMapping);
+    // Block 0 is the superblock
+    m_allocator.claim(0);
+    writeSuperblock({});
+}
 
-    // Refresh mapping
-    m_backingStore.resize(m_backingFileBlockCount * m_blockSize);
-    m_storageMapping = m_backingStore.map(0, m_backingFileBlockCount * m_blockSize);
+bool DiskBackedStorage::growToBlocksLong(uint64_t blockCount) {
+    blockCount = std::min(blockCount, m_backingFileBlockCountLimit);
+    while (m_backingFileBlockCount < blockCount) {
+        auto segmentBlocks = std::min(m_segmentBlockCount, m_backingFileBlockCountLimit - m_backingFileBlockCount);
+        auto offset = m_backingFileBlockCount * m_blockSize;
+        auto end = offset + segmentBlocks * m_blockSize;
+        // The file may be longer already when a capture is being recovered
+        if (uint64_t(m_backingStore.size()) < end && !m_backingStore.resize(end)) {
+            return false;
+        }
 
-    Q_ASSERT(m_storageMapping);
+        auto segment = m_backingStore.map(offset, segmentBlocks * m_blockSize);
+        if (!segment) {
+            return false;
+        }
 
-    auto unallocBlk = reinterpret_cast<UnallocatedBlockHeader *>(m_storageMapping);
-    unallocBlk->nextUnallocated = std::numeric_limits<uint64_t>::max();
-    unallocBlk->unallocatedId = std::numeric_limits<uint64_t>::max();
-    unallocBlk->numberOfBlocks = m_backingFileBlockCountLimit;
+        m_segments.push_back(segment);
+        m_backingFileBlockCount += segmentBlocks;
 
-    m_freeListFirstBlockSeq = 0;
+        std::unique_lock<std::shared_mutex> lock(m_blockLock);
+        m_blockGenerations.resize(m_backingFileBlockCount);
+    }
+    return true;
 }
 
-uint8_t *DiskBackedStorage::blockFromSequenceNumber(uint64_t blockSeqNumber) {
-    return (m_storageMapping + blockSeqNumber * m_blockSize);
+Result<uint64_t, DiskBackedStorage::Error> DiskBackedStorage::allocateBlock() {
+    auto ret = m_allocator.lowestFree();
+    if (ret == BlockAllocator::NoBlock) {
+        return Err(Error::DataStorageFull);
+    }
+
+    // The block may be in a segment not mapped yet. Only the new segment is mapped, so nothing handed out before is
+    // affected.
+    if (!growToBlocksLong(ret + 1)) {
+        return Err(Error::CacheMemoryMappingFail);
+    }
+    m_allocator.allocate();
+
+#ifdef BLOCK_ALLOC_DEBUG_MSG
+    qDebug() << "Allocated block" << ret;
+    printFreeList();
+#endif
+    return Ok(ret);
 }
 
-uint64_t DiskBackedStorage::sequenceNumberFromBlock(uint8_t *block) {
-    return (block - m_storageMapping) / m_blockSize;
+void DiskBackedStorage::freeBlock(uint64_t blockSeqNumber) {
+    // Blocks out of range or not allocated are ignored
+    if (!m_allocator.free(blockSeqNumber)) {
+        return;
+    }
+
+    // The reader thread may be about to read the block, it must not once it can be reused
+    {
+        std::unique_lock<std::shared_mutex> lock(m_blockLock);
+        m_blockGenerations[blockSeqNumber]++;
+    }
+
+    // Forget the header, so the block isn't taken for a logged one on recovery
+    std::memset(blockFromSequenceNumber(blockSeqNumber), 0, sizeof(StorageBlockHeader));
+
+#ifdef BLOCK_ALLOC_DEBUG_MSG
+    qDebug() << "Freed block" << blockSeqNumber;
+    printFreeList();
+#endif
 }
 
-bool DiskBackedStorage::growToBlocksLong(uint64_t blockCount) {
-    if (m_backingFileBlockCount >= blockCount) {
-        return true;
+void DiskBackedStorage::freeChain(BlockChain &chain) {
+    for (auto block : chain.blocks) {
+        freeBlock(block);
     }
+    chain = BlockChain();
+}
 
-    if (!m_backingStore.resize(blockCount * m_blockSize)) {
-        return false;
+std::pair<size_t, size_t> DiskBackedStorage::blocksInRange(const BlockChain &chain, double lower, double upper) {
+    if (!(lower <= upper)) {
+        return {0, 0};
     }
 
-    m_backingStore.unmap(m_storageMapping);
-    m_storageMapping = m_backingStore.map(0, blockCount * m_blockSize);
+    // The block before the first one starting at or after lower may still reach into the range
+    auto begin = std::lower_bound(chain.firstKeys.begin(), chain.firstKeys.end(), lower);
+    if (begin != chain.firstKeys.begin()) {
+        --begin;
+    }
+    auto end = std::upper_bound(begin, chain.firstKeys.end(), upper);
+    return {size_t(begin - chain.firstKeys.begin()), size_t(end - chain.firstKeys.begin())};
+}
 
-    if (!m_storageMapping) {
+bool DiskBackedStorage::recycleOldestBlock(std::span<BlockChain *const> chains) {
+    // A front block ends where the next one begins, so the oldest block is the one whose next block begins first
+    BlockChain *oldest = nullptr;
+    for (auto chain : chains) {
+        if (chain->blocks.size() > 1 && (!oldest || chain->firstKeys[1] < oldest->firstKeys[1])) {
+            oldest = chain;
+        }
+    }
+    if (!oldest) {
         return false;
     }
 
-    m_backingFileBlockCount = blockCount;
+    auto block = oldest->blocks.front();
+    auto count = blockHeader(block)->loggedDataPointsCount;
+    freeBlock(block);
+    oldest->blocks.pop_front();
+    oldest->firstKeys.pop_front();
+    oldest->pointCount -= count;
+    oldest->droppedPointCount += count;
+    oldest->droppedBlockCount++;
+    oldest->summary.dropBefore(oldest->firstKeys.front());
     return true;
 }
 
-Result<uint64_t, DiskBackedStorage::Error> DiskBackedStorage::allocateBlock() {
-    // Sanity check
-    Q_ASSERT((m_freeListFirstBlockSeq == std::numeric_limits<uint64_t>::max()) ==
-             (m_occupiedBlockCount == m_backingFileBlockCountLimit));
+void DiskBackedStorage::beginCapture() {
+    std::random_device random;
+    do {
+        m_captureId = uint64_t(random()) << 32 | random();
+    } while (!m_captureId);
+    writeSuperblock({});
+    requestSync();
+}
 
-    // No memory case
-    if (m_freeListFirstBlockSeq == std::numeric_limits<uint64_t>::max()) {
-        return Err(Error::DataStorageFull);
+void DiskBackedStorage::checkpoint(std::span<const CaptureChannel> channels) {
+    for (auto &channel : channels) {
+        if (channel.chain) {
+            updateTailChecksums(*channel.chain);
+        }
     }
+    writeSuperblock(channels);
+    requestSync();
+}
 
-    // The block allocated
-    auto allocdBlkSeq = m_freeListFirstBlockSeq;
-    auto allocdBlk = reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(allocdBlkSeq));
+std::vector<DiskBackedStorage::RecoveredChannel> DiskBackedStorage::recoverCapture() {
+    // Map what's in the file
+    unmapSegments();
+    m_backingFileBlockCount = 0;
+    auto fileBlocks = std::min(uint64_t(m_backingStore.size()) / m_blockSize, m_backingFileBlockCountLimit);
+    if (!fileBlocks || !growToBlocksLong(fileBlocks)) {
+        return {};
+    }
 
-    // Property sanity check
-    Q_ASSERT(allocdBlk->numberOfBlocks <= m_backingFileBlockCountLimit);
+    Superblock superblock;
+    std::vector<CaptureChannel> channels;
+    if (!readSuperblock(superblock, channels) || !superblock.captureId) {
+        return {};
+    }
 
-    // Set in bitmap
-    // Sanity check
-    Q_ASSERT(!m_storageOccupationBitmap[m_freeListFirstBlockSeq]);
-    m_storageOccupationBitmap[m_freeListFirstBlockSeq] = true;
+    // Only headers are read here: find the blocks of the capture, and sort them out by watch entry
+    std::map<uint64_t, std::vector<std::pair<uint64_t, uint64_t>>> entryBlocks; ///< Sequence number, block
+    for (uint64_t block = 1; block < fileBlocks; block++) {
+        auto header = blockHeader(block);
+        if (header->captureId != superblock.captureId || header->headerCrc != headerChecksum(*header) ||
+            header->codec != BlockCodec::Compressed || header->durableBits > m_blockPayloadSize * 8) {
+            continue;
+        }
+        entryBlocks[header->watchEntryId].push_back({header->blockSequenceNumber, block});
+    }
 
-    if (allocdBlk->numberOfBlocks == 1) {
-        // If the current range of unallocated blocks are drained, use next range in free list next time
-        m_freeListFirstBlockSeq = allocdBlk->nextUnallocated;
-        growToBlocksLong(m_freeListFirstBlockSeq + 1);
-        allocdBlk = reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(allocdBlkSeq));
-    } else {
-        // Else, move to next
-        m_freeListFirstBlockSeq++;
+    m_allocator.reset(m_backingFileBlockCountLimit);
+    m_allocator.claim(0);
+    std::vector<RecoveredChannel> recovered;
+    for (auto &channel : channels) {
+        auto it = entryBlocks.find(channel.watchEntryId);
+        if (it == entryBlocks.end()) {
+            continue;
+        }
+        auto &blocks = it->second;
+        std::sort(blocks.begin(), blocks.end());
+
+        RecoveredChannel result{channel, {}};
+        result.channel.chain = nullptr;
+        result.chain.droppedBlockCount = blocks.front().first;
+        for (auto [sequence, block] : blocks) {
+            auto header = blockHeader(block);
+            // The last block may have been written to while the file was only partly flushed; full blocks were
+            // checksummed once and for all, so their payloads aren't read
+            if (block == blocks.back().second &&
+                payloadChecksum({}, blockPayload(block), 0, header->durableBits) != header->payloadCrc) {
+                qWarning() << "Last block of watch entry" << channel.watchEntryId << "is damaged, skipping it";
+                continue;
+            }
+            header->loggedDataPointsCount = header->durablePointCount;
+            m_allocator.claim(block);
+            result.chain.blocks.push_back(block);
+            result.chain.firstKeys.push_back(header->firstKey);
+            result.chain.pointCount += header->durablePointCount;
+        }
+        if (!result.chain.blocks.empty()) {
+            recovered.push_back(std::move(result));
+        }
+    }
 
-        // Update unalloc block metadata
-        growToBlocksLong(m_freeListFirstBlockSeq + 1);
-        auto freeBlock = reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(m_freeListFirstBlockSeq));
-        allocdBlk = reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(allocdBlkSeq));
-        *freeBlock = *allocdBlk;
-        freeBlock->numberOfBlocks--;
+    if (!recovered.empty()) {
+        m_captureId = superblock.captureId;
+        m_superblockSequence = superblock.sequence;
     }
+    return recovered;
+}
 
-    // Now which block is allocated is determined
-    auto ret = sequenceNumberFromBlock(reinterpret_cast<uint8_t *>(allocdBlk));
+void DiskBackedStorage::printFreeList() {
+    qDebug() << "-----------printFreeList----";
+    uint64_t freeCount = 0;
 
-    // Increment occupied block count
-    m_occupiedBlockCount++;
+    m_allocator.forEachFreeRange([&](uint64_t first, uint64_t count) {
+        qDebug() << "Block" << first << ", count = " << count;
+        freeCount += count;
+    });
 
-    // // Check if needs to grow file
-    // if (m_backingFileBlockCount < ret + 1) {
-    //     if (!growToBlocksLong(ret + 1)) {
-    //         return Err(Error::CacheMemoryMappingFail);
-    //     }
-    // }
+    qDebug() << "Free counted:" << freeCount << ", Used:" << m_allocator.allocatedCount();
+    Q_ASSERT(freeCount + m_allocator.allocatedCount() == m_backingFileBlockCountLimit);
+}
 
-    // Return block sequence number
-#ifdef BLOCK_ALLOC_DEBUG_MSG
-    qDebug() << "Allocated block" << ret;
-    printFreeList();
-#endif
-    return Ok(ret);
+void DiskBackedStorage::unmapSegments() {
+    // The sync thread must not be flushing what's about to be unmapped
+    std::unique_lock<std::mutex> lock(m_syncMutex);
+    m_syncRequested = false;
+    m_syncCond.wait(lock, [&]() { return !m_syncBusy; });
+
+    // Nor should the reader thread be reading from it
+    std::unique_lock<std::shared_mutex> blockLock(m_blockLock);
+    m_mappingGeneration++;
+    m_blockGenerations.clear();
+
+    for (auto segment : m_segments) {
+        m_backingStore.unmap(segment);
+    }
+    m_segments.clear();
 }
 
-void DiskBackedStorage::freeBlock(uint64_t blockSeqNumber) {
-    // Check if block is valid
-    if (blockSeqNumber >= m_backingFileBlockCountLimit) {
+DiskBackedStorage::StorageBlockHeader *DiskBackedStorage::startTailBlock(BlockChain &chain, uint64_t block,
+                                                                         uint64_t watchEntryId, double firstKey) {
+    chain.blocks.push_back(block);
+    chain.firstKeys.push_back(firstKey);
+
+    // The header is left without a valid checksum until the next checkpoint, the block isn't recovered before then
+    auto header = blockHeader(block);
+    *header = {};
+    header->watchEntryId = watchEntryId;
+    header->blockSequenceNumber = chain.droppedBlockCount + chain.blocks.size() - 1;
+    header->codec = BlockCodec::Compressed;
+    header->captureId = m_captureId;
+    header->firstKey = firstKey;
+
+    chain.encoder.begin(blockPayload(block), m_blockPayloadSize);
+    chain.tailCrc = {};
+    chain.tailCrcBytes = 0;
+    return header;
+}
+
+void DiskBackedStorage::updateTailChecksums(BlockChain &chain) {
+    // Nothing encoded in this session, like a recovered chain
+    if (chain.blocks.empty() || !chain.encoder.count()) {
         return;
     }
 
-    // Check if block to be freed is actually allocated
-    if (!m_storageOccupationBitmap[blockSeqNumber]) {
-        return;
+    auto header = blockHeader(chain.blocks.back());
+    auto payload = blockPayload(chain.blocks.back());
+    auto bits = chain.encoder.usedBits();
+
+    // Words before the one being filled won't change anymore, so each of them only goes into the checksum once
+    auto finalBytes = bits / 64 * 8;
+    chain.tailCrc.update(payload + chain.tailCrcBytes, finalBytes - chain.tailCrcBytes);
+    chain.tailCrcBytes = finalBytes;
+
+    header->durablePointCount = chain.encoder.count();
+    header->durableBits = bits;
+    header->payloadCrc = payloadChecksum(chain.tailCrc, payload, finalBytes, bits);
+    header->headerCrc = headerChecksum(*header);
+}
+
+uint32_t DiskBackedStorage::payloadChecksum(Crc32 crc, const uint8_t *payload, size_t fromBytes, size_t bits) {
+    auto finalBytes = bits / 64 * 8;
+    crc.update(payload + fromBytes, finalBytes - fromBytes);
+    if (bits % 64) {
+        uint64_t word;
+        std::memcpy(&word, payload + finalBytes, sizeof(word));
+        word &= ~uint64_t(0) << (64 - bits % 64);
+        crc.update(&word, sizeof(word));
     }
+    return crc.value();
+}
 
-    // Clear the block from bitmap
-    m_storageOccupationBitmap[blockSeqNumber] = false;
+uint32_t DiskBackedStorage::headerChecksum(const StorageBlockHeader &header) {
+    auto copy = header;
+    copy.loggedDataPointsCount = 0;
+    copy.headerCrc = 0;
+    return Crc32::compute(&copy, sizeof(copy));
+}
 
-    // Decrement occupied block count
-    m_occupiedBlockCount--;
+void DiskBackedStorage::writeSuperblock(std::span<const CaptureChannel> channels) {
+    // Channel table records: watch entry ID, sizes of expression and display name, then both in UTF-8, padded to 8
+    QByteArray table;
+    uint64_t channelCount = 0;
+    for (auto &channel : channels) {
+        auto expression = channel.expression.toUtf8();
+        auto displayName = channel.displayName.toUtf8();
+        uint32_t sizes[2] = {uint32_t(expression.size()), uint32_t(displayName.size())};
+
+        QByteArray record;
+        record.append(reinterpret_cast<const char *>(&channel.watchEntryId), sizeof(channel.watchEntryId));
+        record.append(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+        record.append(expression);
+        record.append(displayName);
+        record.append((8 - record.size() % 8) % 8, '\0');
+        if (sizeof(Superblock) + table.size() + record.size() > SuperblockCopySize) {
+            qWarning() << "Too many watch entries to record in the cache file, the rest can't be recovered";
+            break;
+        }
+        table.append(record);
+        channelCount++;
+    }
 
-    // If block to be freed is before the first in free list...
-    if (blockSeqNumber < m_freeListFirstBlockSeq) {
-        // ... check also if the block immediately follows our known free list head
-        auto newFreeListHead = reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(blockSeqNumber));
-        if (blockSeqNumber + 1 == m_freeListFirstBlockSeq) {
-            // Merge the two
-            auto oldFreeListHead =
-                reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(m_freeListFirstBlockSeq));
+    Superblock superblock = {};
+    superblock.magic = SuperblockMagic;
+    superblock.version = SuperblockVersion;
+    superblock.sequence = ++m_superblockSequence;
+    superblock.blockSize = m_blockSize;
+    superblock.captureId = m_captureId;
+    superblock.channelCount = channelCount;
+    superblock.tableBytes = table.size();
+    Crc32 crc;
+    crc.update(&superblock, sizeof(superblock));
+    crc.update(table.constData(), table.size());
+    superblock.crc = crc.value();
+
+    // Write over the older copy
+    auto copy = blockFromSequenceNumber(0) + m_superblockSequence % 2 * SuperblockCopySize;
+    std::memcpy(copy + sizeof(Superblock), table.constData(), table.size());
+    std::memcpy(copy, &superblock, sizeof(superblock));
+}
 
-            *newFreeListHead = *oldFreeListHead;
-            newFreeListHead->numberOfBlocks++;
-        } else {
-            // Link the new head to the old
-            newFreeListHead->unallocatedId = std::numeric_limits<uint64_t>::max();
-            newFreeListHead->numberOfBlocks = 1;
-            newFreeListHead->nextUnallocated = m_freeListFirstBlockSeq;
-        }
-
-        // Replace known free list head
-        m_freeListFirstBlockSeq = blockSeqNumber;
-    } else {
-        // Block is after the current known first free block
-        // We want to find the first unallocated range after the block to free,
-        // but preserving the range before that one
-
-        // Make a good start
-        uint64_t currentUnallocRange = m_freeListFirstBlockSeq;
-        auto currentUnallocRangeBlock =
-            reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(m_freeListFirstBlockSeq));
-
-        // Go down the list until we discover that next unallocated range is after freed block
-        // Technically, nextUnallocated couldn't be equal to blockSeqNumber (when data is consistent)
-        // And when we're at the end of the free list, the nextUnallocated would be maximum of uint64,
-        // also satisfying this criteria, and also, we don't care if the nextUnallocated is valid,
-        // we simply put that thing into the nextUnallocated field of the just freed block
-        while (currentUnallocRangeBlock->nextUnallocated < blockSeqNumber) {
-            currentUnallocRange = currentUnallocRangeBlock->nextUnallocated;
-            currentUnallocRangeBlock =
-                reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(blockSeqNumber));
-        }
-
-        auto freedBlock = reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(blockSeqNumber));
-        bool besidesCurrent = blockSeqNumber == currentUnallocRange + currentUnallocRangeBlock->numberOfBlocks;
-        bool besidesNext = blockSeqNumber + 1 == currentUnallocRangeBlock->nextUnallocated;
-
-        if (besidesNext && besidesCurrent) {
-            // The block is the very block separates next and current free range, merge them all
-            auto nextRange = reinterpret_cast<UnallocatedBlockHeader *>(
-                blockFromSequenceNumber(currentUnallocRangeBlock->nextUnallocated));
-            currentUnallocRangeBlock->numberOfBlocks += (1 + nextRange->numberOfBlocks);
-            currentUnallocRangeBlock->nextUnallocated = nextRange->nextUnallocated;
-        } else if (besidesCurrent) {
-            // If it immediately follows current free range, merge it with current
-            currentUnallocRangeBlock->numberOfBlocks++;
-        } else if (besidesNext) {
-            // If it immediately followed by next free range, then merge it with next
-            auto nextRange = reinterpret_cast<UnallocatedBlockHeader *>(
-                blockFromSequenceNumber(currentUnallocRangeBlock->nextUnallocated));
-            *freedBlock = *nextRange;
-            freedBlock->numberOfBlocks++;
+bool DiskBackedStorage::readSuperblock(Superblock &superblock, std::vector<CaptureChannel> &channels) {
+    const uint8_t *current = nullptr;
+    for (uint64_t i = 0; i < 2; i++) {
+        auto copy = blockFromSequenceNumber(0) + i * SuperblockCopySize;
+        Superblock candidate;
+        std::memcpy(&candidate, copy, sizeof(candidate));
+        if (candidate.magic != SuperblockMagic || candidate.version != SuperblockVersion ||
+            candidate.blockSize != m_blockSize || candidate.tableBytes > SuperblockCopySize - sizeof(Superblock)) {
+            continue;
+        }
+
+        auto expected = candidate.crc;
+        candidate.crc = 0;
+        Crc32 crc;
+        crc.update(&candidate, sizeof(candidate));
+        crc.update(copy + sizeof(Superblock), candidate.tableBytes);
+        if (crc.value() != expected) {
+            continue;
+        }
+
+        if (!current || candidate.sequence > superblock.sequence) {
+            superblock = candidate;
+            current = copy;
+        }
+    }
+    if (!current) {
+        return false;
+    }
+
+    auto record = current + sizeof(Superblock);
+    auto end = record + superblock.tableBytes;
+    channels.clear();
+    for (uint64_t i = 0; i < superblock.channelCount; i++) {
+        uint64_t watchEntryId;
+        uint32_t sizes[2];
+        if (end - record < ptrdiff_t(sizeof(watchEntryId) + sizeof(sizes))) {
+            return false;
+        }
+        std::memcpy(&watchEntryId, record, sizeof(watchEntryId));
+        std::memcpy(sizes, record + sizeof(watchEntryId), sizeof(sizes));
+        auto strings = reinterpret_cast<const char *>(record + sizeof(watchEntryId) + sizeof(sizes));
+        auto recordSize = (sizeof(watchEntryId) + sizeof(sizes) + uint64_t(sizes[0]) + sizes[1] + 7) / 8 * 8;
+        if (uint64_t(end - record) < recordSize) {
+            return false;
+        }
+        channels.push_back({watchEntryId, QString::fromUtf8(strings, sizes[0]),
+                            QString::fromUtf8(strings + sizes[0], sizes[1]), nullptr});
+        record += recordSize;
+    }
+    return true;
+}
+
+void DiskBackedStorage::syncThread(DiskBackedStorage *self) {
+    std::unique_lock<std::mutex> lock(self->m_syncMutex);
+    while (true) {
+        self->m_syncCond.wait(lock, [&]() { return self->m_syncExit || self->m_syncRequested; });
+        if (self->m_syncExit) {
+            return;
+        }
+
+        // Segments stay mapped while busy, unmapSegments() waits for that
+        self->m_syncRequested = false;
+        self->m_syncBusy = true;
+        auto segments = self->m_syncSegments;
+        lock.unlock();
+        for (auto [address, size] : segments) {
+            FlushMapping(address, size);
+        }
+        lock.lock();
+        self->m_syncBusy = false;
+        self->m_syncCond.notify_all();
+    }
+}
+
+void DiskBackedStorage::requestSync() {
+    {
+        std::lock_guard<std::mutex> lock(m_syncMutex);
+        m_syncSegments.clear();
+        for (uint64_t i = 0; i < m_segments.size(); i++) {
+            auto blocks = std::min(m_segmentBlockCount, m_backingFileBlockCount - i * m_segmentBlockCount);
+            m_syncSegments.push_back({m_segments[i], blocks * m_blockSize});
+        }
+        m_syncRequested = true;
+    }
+    m_syncCond.notify_all();
+}
+
+DiskBackedStorage::ChainSnapshot DiskBackedStorage::snapshotChain(const BlockChain &chain, double lower, double upper) {
+    ChainSnapshot snapshot{lower, upper, m_mappingGeneration, {}, {}};
+    auto [begin, end] = blocksInRange(chain, lower, upper);
+    for (auto i = begin; i < end; i++) {
+        auto block = chain.blocks[i];
+        auto header = blockHeader(block);
+        snapshot.blocks.push_back({blockPayload(block), block, m_blockGenerations[block], header->codec,
+                                   header->loggedDataPointsCount, false});
+    }
+
+    // Copy the last block, as it's still being appended to. The encoder only knows about it if it's been appended to
+    // since the chain was started or recovered.
+    if (begin < end && end == chain.blocks.size()) {
+        auto &tail = snapshot.blocks.back();
+        auto bytes = m_blockPayloadSize;
+        if (tail.codec == BlockCodec::Raw) {
+            bytes = tail.pointCount * sizeof(LoggedPoint);
+        } else if (chain.encoder.count() == tail.pointCount) {
+            bytes = chain.encoder.usedBytes();
+        }
+        auto copy = std::make_shared<std::vector<uint64_t>>(bytes / sizeof(uint64_t) + 1);
+        std::memcpy(copy->data(), tail.payload, bytes);
+        tail.payload = reinterpret_cast<const uint8_t *>(copy->data());
+        tail.isCopy = true;
+        snapshot.tailCopy = std::move(copy);
+    }
+    return snapshot;
+}
+
+size_t DiskBackedStorage::SnapshotReader::read(LoggedPoint *out, size_t maxCount) {
+    size_t count = 0;
+    std::shared_lock<std::shared_mutex> lock(m_storage->m_blockLock);
+    // The block being read may have been freed while the lock wasn't held
+    if (m_remaining && !isBlockValid(m_snapshot.blocks[m_nextBlock - 1])) {
+        m_failed = m_finished = true;
+    }
+
+    while (count < maxCount && !m_finished) {
+        if (!m_remaining) {
+            if (m_nextBlock == m_snapshot.blocks.size()) {
+                m_finished = true;
+                break;
+            }
+            auto &block = m_snapshot.blocks[m_nextBlock++];
+            if (!isBlockValid(block)) {
+                m_failed = m_finished = true;
+                break;
+            }
+            if (block.codec == BlockCodec::Raw) {
+                m_raw = reinterpret_cast<const LoggedPoint *>(block.payload);
+            } else {
+                m_decoder = BlockDecoder(block.payload, block.pointCount);
+            }
+            m_remaining = block.pointCount;
+            continue;
+        }
+
+        LoggedPoint point;
+        if (m_snapshot.blocks[m_nextBlock - 1].codec == BlockCodec::Raw) {
+            point = *m_raw++;
         } else {
-            // Like said in the loop above, just put the block in the list
-            freedBlock->nextUnallocated = currentUnallocRangeBlock->nextUnallocated;
-            currentUnallocRangeBlock->nextUnallocated = blockSeqNumber;
+            m_decoder.next(point.key, point.value);
+        }
+        m_remaining--;
 
-            freedBlock->unallocatedId = std::numeric_limits<uint64_t>::max();
-            freedBlock->numberOfBlocks = 1;
+        // Keys are in order, so the first point after the range ends the read
+        if (point.key > m_snapshot.upper) {
+            m_finished = true;
+        } else if (point.key >= m_snapshot.lower) {
+            out[count++] = point;
         }
     }
-    // Done
-#ifdef BLOCK_ALLOC_DEBUG_MSG
-    qDebug() << "Freed block" << blockSeqNumber;
-    printFreeList();
-#endif
+    return count;
 }
 
-void DiskBackedStorage::printFreeList() {
-    qDebug() << "-----------printFreeList----";
-    auto freeBlkSeq = m_freeListFirstBlockSeq;
-    uint64_t freeCount = 0;
+bool DiskBackedStorage::SnapshotReader::isBlockValid(const ChainSnapshot::Block &block) const {
+    return m_storage->m_mappingGeneration == m_snapshot.mappingGeneration &&
+           (block.isCopy || m_storage->m_blockGenerations[block.block] == block.generation);
+}
 
-    while (freeBlkSeq != std::numeric_limits<uint64_t>::max()) {
-        auto freeRange = reinterpret_cast<UnallocatedBlockHeader *>(blockFromSequenceNumber(freeBlkSeq));
-        qDebug() << "Block" << freeBlkSeq << ", count = " << freeRange->numberOfBlocks;
-        freeCount += freeRange->numberOfBlocks;
-        freeBlkSeq = freeRange->nextUnallocated;
+void DiskBackedStorage::requestRead(const BlockChain &chain, uint64_t tag, double lower, double upper) {
+    ReadRequest request{&chain, tag, snapshotChain(chain, lower, upper)};
+    {
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        auto it = std::find_if(m_readRequests.begin(), m_readRequests.end(),
+                               [&](const ReadRequest &pending) { return pending.chain == &chain; });
+        if (it != m_readRequests.end()) {
+            *it = std::move(request);
+        } else {
+            m_readRequests.push_back(std::move(request));
+        }
     }
+    m_readCond.notify_all();
+}
+
+std::vector<DiskBackedStorage::ReadResult> DiskBackedStorage::takeReadResults() {
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    return std::exchange(m_readResults, {});
+}
+
+void DiskBackedStorage::readerThread(DiskBackedStorage *self) {
+    constexpr size_t ChunkSize = 65536;
+    std::unique_lock<std::mutex> lock(self->m_readMutex);
+    while (true) {
+        self->m_readCond.wait(lock, [&]() { return self->m_readExit || !self->m_readRequests.empty(); });
+        if (self->m_readExit) {
+            return;
+        }
 
-    qDebug() << "Free counted:" << freeCount << ", Used:" << m_occupiedBlockCount;
-    Q_ASSERT(freeCount + m_occupiedBlockCount == m_backingFileBlockCountLimit);
+        auto request = std::move(self->m_readRequests.front());
+        self->m_readRequests.pop_front();
+        lock.unlock();
+
+        ReadResult result{request.tag, request.snapshot.lower, request.snapshot.upper, {}, false};
+        SnapshotReader reader(*self, std::move(request.snapshot));
+        while (true) {
+            auto size = result.points.size();
+            result.points.resize(size + ChunkSize);
+            auto count = reader.read(result.points.data() + size, ChunkSize);
+            result.points.resize(size + count);
+            if (count < ChunkSize) {
+                break;
+            }
+        }
+        result.isComplete = !reader.hasFailed();
+
+        lock.lock();
+        self->m_readResults.push_back(std::move(result));
+        if (self->m_readCallback) {
+            lock.unlock();
+            self->m_readCallback();
+            lock.lock();
+        }
+    }
 }
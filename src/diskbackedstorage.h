@@ -1,16 +1,32 @@
 
 #pragma once
 
+#include "blockallocator.h"
+#include "blockcodec.h"
+#include "crc32.h"
 #include "result.h"
+#include "summarypyramid.h"
 #include <QByteArray>
 #include <QFile>
 #include <QSet>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 
 
 class DiskBackedStorage {
 public:
+    DiskBackedStorage();
     ~DiskBackedStorage();
 
     enum class Error {
@@ -18,13 +34,273 @@ public:
         CacheMemoryMappingFail,
     };
 
+    /// @brief What happens when the storage is full and a chain needs another block.
+    enum class RetentionMode {
+        StopWhenFull, ///< Logging fails, and the acquisition is stopped
+        KeepLatest,   ///< The oldest logged blocks are recycled, keeping a rolling window of the latest data
+    };
+
+    /// @brief One logged sample, as read back from a chain. Also the layout of BlockCodec::Raw blocks.
+    struct LoggedPoint {
+        double key; ///< Milliseconds since acquisition start
+        double value;
+    };
+
+    /**
+     * @brief The blocks a watch entry has logged its samples into, in order. Every block but the last one is full.
+     * Owned by whoever logs into it, the storage itself doesn't keep track of chains.
+     */
+    struct BlockChain {
+        std::deque<uint64_t> blocks;
+        std::deque<double> firstKeys;   ///< Key of the first point in each block, the chain's time index
+        uint64_t pointCount = 0;        ///< Points in the blocks of the chain
+        uint64_t droppedPointCount = 0; ///< Points recycled from the front of the chain
+        uint64_t droppedBlockCount = 0; ///< Blocks recycled from the front of the chain
+        BlockEncoder encoder;           ///< Encoder of the last block
+        Crc32 tailCrc;                  ///< Running checksum of the last block's payload...
+        size_t tailCrcBytes = 0;        ///< ...over this many bytes, which won't change anymore
+        SummaryPyramid summary;         ///< Of the points in the blocks, give or take a bucket. Not in the file.
+    };
+
+    /// @brief A watch entry as recorded in the superblock, so its chain can be told apart on recovery.
+    struct CaptureChannel {
+        uint64_t watchEntryId;
+        QString expression;
+        QString displayName;
+        BlockChain *chain; ///< Used by checkpoint(), null in recovered channels
+    };
+    struct RecoveredChannel {
+        CaptureChannel channel;
+        BlockChain chain;
+    };
+
+    /**
+     * @brief Append points to the end of a chain, allocating blocks as needed. Points are compressed with
+     * BlockEncoder.
+     * @param points Anything with double key and value members, such as QCPGraphData.
+     * @return On storage full: the points that fit are logged, the rest are not.
+     */
+    template<typename Point>
+    Result<void, Error> appendToChain(BlockChain &chain, uint64_t watchEntryId, const Point *points, size_t count) {
+        auto header = chain.blocks.empty() ? nullptr : blockHeader(chain.blocks.back());
+        for (size_t i = 0; i < count; i++) {
+            if (!header || !chain.encoder.append(points[i].key, points[i].value)) {
+                auto result = allocateBlock();
+                if (result.isErr()) {
+                    chain.summary.append(points, i);
+                    return Err(result.unwrapErr());
+                }
+                updateTailChecksums(chain); // Final ones for the full block
+                header = startTailBlock(chain, result.unwrap(), watchEntryId, points[i].key);
+                chain.encoder.append(points[i].key, points[i].value); // Always fits in an empty block
+            }
+            header->loggedDataPointsCount++;
+            chain.pointCount++;
+        }
+        chain.summary.append(points, count);
+        return Ok();
+    }
+
+    /// @brief Free all blocks of a chain and empty it.
+    void freeChain(BlockChain &chain);
+
+    /**
+     * @brief Free the front block of whichever chain has the oldest data in it, to make room for newer data. Used in
+     * RetentionMode::KeepLatest. The last block of a chain is never taken, as it's still being appended to.
+     * @return false if no chain has a block to spare.
+     */
+    bool recycleOldestBlock(std::span<BlockChain *const> chains);
+
+    /**
+     * @brief Start a new capture in the superblock. Blocks logged from now on are tagged with it, and only those are
+     * considered on recovery.
+     */
+    void beginCapture();
+
+    /**
+     * @brief Make everything logged so far recoverable: checksum what's new in the last block of each chain, record
+     * the channels in the superblock, and have the background thread flush the mapping to disk. Cheap enough to be
+     * called every few seconds during acquisition.
+     */
+    void checkpoint(std::span<const CaptureChannel> channels);
+
+    /**
+     * @brief Look for a capture left in the file by a session that didn't exit properly. Only block headers are
+     * read, except for the payload checksum of the last block of each chain. Found blocks stay allocated, and the
+     * rest of the storage is usable as if it had been cleared.
+     * @return The chains of the capture, or nothing if there's no capture to recover; clearStorage() has to be called
+     * then.
+     */
+    std::vector<RecoveredChannel> recoverCapture();
+
+    /**
+     * @brief Find the blocks of a chain that may have points with keys in [lower, upper], by binary search in its
+     * first keys. Block i of the chain has sequence number droppedBlockCount + i.
+     * @return Indices into chain.blocks, first and one past the last.
+     */
+    static std::pair<size_t, size_t> blocksInRange(const BlockChain &chain, double lower, double upper);
+
+    /// @brief Points of a chain read in the background, see requestRead().
+    struct ReadResult {
+        uint64_t tag; ///< As given to requestRead()
+        double lower;
+        double upper;
+        std::vector<LoggedPoint> points; ///< With keys in [lower, upper], in order
+        bool isComplete;                 ///< False when blocks in the range were freed before they could be read
+    };
+
+    /**
+     * @brief The blocks of a chain with points in a key range, as they were when it was taken. It can be read on any
+     * thread with a SnapshotReader, while the chain is appended to or freed: the last block is copied, and a block
+     * freed before it's read fails the read.
+     */
+    struct ChainSnapshot {
+        struct Block {
+            const uint8_t *payload;
+            uint64_t block;
+            uint32_t generation; ///< Of the block in m_blockGenerations, it's not read if that has changed since
+            BlockCodec codec;
+            uint64_t pointCount;
+            bool isCopy; ///< Whether payload is in tailCopy
+        };
+        double lower;
+        double upper;
+        uint64_t mappingGeneration;
+        std::vector<Block> blocks;
+        std::shared_ptr<const std::vector<uint64_t>> tailCopy; ///< Payload of the chain's last block, if in range
+
+        /// @brief Points in the blocks, some of which may be out of range.
+        uint64_t pointCount() const {
+            uint64_t count = 0;
+            for (auto &block : blocks) {
+                count += block.pointCount;
+            }
+            return count;
+        }
+    };
+
+    ChainSnapshot snapshotChain(const BlockChain &chain, double lower = -std::numeric_limits<double>::infinity(),
+                                double upper = std::numeric_limits<double>::infinity());
+
+    /**
+     * @brief Reads the points in range of a ChainSnapshot, in order. Can be used on any thread, as long as the storage
+     * outlives it. Blocks are checked before each read, and read with the storage's block lock held, so one can't be
+     * freed and reused halfway through.
+     */
+    class SnapshotReader {
+    public:
+        SnapshotReader(DiskBackedStorage &storage, ChainSnapshot snapshot)
+            : m_storage(&storage), m_snapshot(std::move(snapshot)) {}
+
+        /// @return How many points were read into out, less than maxCount only when the end is reached or it failed.
+        size_t read(LoggedPoint *out, size_t maxCount);
+
+        /// @brief Whether the storage was unmapped or a block freed before it could be read. Nothing is read after.
+        bool hasFailed() const { return m_failed; }
+
+    private:
+        bool isBlockValid(const ChainSnapshot::Block &block) const;
+
+        DiskBackedStorage *m_storage;
+        ChainSnapshot m_snapshot;
+        size_t m_nextBlock = 0;
+        uint64_t m_remaining = 0; ///< Points left in the current block
+        BlockDecoder m_decoder{nullptr, 0};
+        const LoggedPoint *m_raw = nullptr;
+        bool m_finished = false;
+        bool m_failed = false;
+    };
+
+    /**
+     * @brief Read the points of a chain with keys in [lower, upper] on the reader thread, so neither decoding nor page
+     * faults hold up the caller. The chain is snapshotted with snapshotChain(). A request replaces one for the same
+     * chain that hasn't been started yet.
+     * @param tag Handed back in the result.
+     */
+    void requestRead(const BlockChain &chain, uint64_t tag, double lower, double upper);
+
+    /// @brief Take the results of finished reads.
+    std::vector<ReadResult> takeReadResults();
+
+    /// @brief Called on the reader thread whenever a result is ready. Must be set before any read is requested.
+    void setReadCallback(std::function<void()> callback) { m_readCallback = std::move(callback); }
+
+    /**
+     * @brief Reads the points of a chain front to back, decoding blocks by the codec in their headers. Blocks are
+     * decoded in place in the mapping. The chain must not be appended to or freed while it's being read.
+     */
+    class ChainReader {
+    public:
+        ChainReader(DiskBackedStorage &storage, const BlockChain &chain)
+            : m_storage(&storage), m_chain(&chain), m_endBlock(chain.blocks.size()) {}
+
+        /// @brief Read only the points with keys in [lower, upper]. Blocks before and after the range aren't decoded.
+        ChainReader(DiskBackedStorage &storage, const BlockChain &chain, double lower, double upper)
+            : m_storage(&storage), m_chain(&chain), m_lower(lower), m_upper(upper) {
+            std::tie(m_nextBlock, m_endBlock) = blocksInRange(chain, lower, upper);
+        }
+
+        /// @return false when all points have been read.
+        bool next(LoggedPoint &point) {
+            while (!m_finished && nextInChain(point)) {
+                if (point.key > m_upper) {
+                    m_finished = true;
+                } else if (point.key >= m_lower) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        bool nextInChain(LoggedPoint &point) {
+            while (true) {
+                if (m_rawRemaining) {
+                    point = *m_raw++;
+                    m_rawRemaining--;
+                    return true;
+                }
+                if (m_decoder.next(point.key, point.value)) {
+                    return true;
+                }
+                if (m_nextBlock == m_endBlock) {
+                    return false;
+                }
+                openBlock(m_chain->blocks[m_nextBlock++]);
+            }
+        }
+
+        void openBlock(uint64_t block) {
+            auto header = m_storage->blockHeader(block);
+            auto payload = m_storage->blockPayload(block);
+            if (header->codec == BlockCodec::Raw) {
+                m_raw = reinterpret_cast<const LoggedPoint *>(payload);
+                m_rawRemaining = header->loggedDataPointsCount;
+            } else {
+                m_decoder = BlockDecoder(payload, header->loggedDataPointsCount);
+            }
+        }
+
+        DiskBackedStorage *m_storage;
+        const BlockChain *m_chain;
+        double m_lower = -std::numeric_limits<double>::infinity();
+        double m_upper = std::numeric_limits<double>::infinity();
+        size_t m_nextBlock = 0;
+        size_t m_endBlock;
+        bool m_finished = false;
+        BlockDecoder m_decoder{nullptr, 0};
+        const LoggedPoint *m_raw = nullptr;
+        uint64_t m_rawRemaining = 0;
+    };
+
     QString fileName() const { return m_backingStore.fileName(); }
     void setFileName(QString name) { m_backingStore.setFileName(name); }
     bool open(QIODevice::OpenMode mode) { return m_backingStore.open(mode); }
 
     void setBlockCountLimit(uint64_t blockCount) { m_backingFileBlockCountLimit = blockCount; }
 
-    uint8_t *storageMapping() { return m_storageMapping; }
+    /// @brief Whether the cache file is mapped. False when the first segment couldn't be mapped on clear.
+    bool isMapped() const { return !m_segments.empty(); }
 
     /**
      * @brief Get the internal storage block size.
@@ -34,41 +310,108 @@ public:
     uint64_t getStorageBlockSize() { return m_blockSize; }
 
     /**
-     * @brief Clear backing store. Can be inconsistent with other components.
+     * @brief Clear backing store and shrink it back to one segment, which also forgets the capture in the superblock.
+     * Can be inconsistent with other components.
      */
     void clearStorage();
 
     /**
-     * @brief Tries to grow the cache file to specified block count long. This would refresh the file mapping.
-     * @return Whether grow succeeded. When grow fails, the file mapping could also become invalid. The acquisition must
-     * immediately stop and restore file mapping; otherwise the application would need a hard reset.
+     * @brief Tries to grow the cache file to at least the specified block count long, a whole segment at a time. New
+     * segments are mapped on their own, existing ones are left in place.
+     * @return Whether grow succeeded. When grow fails, the existing mapping is still valid.
      */
     bool growToBlocksLong(uint64_t blockCount);
 
-    inline uint8_t *blockFromSequenceNumber(uint64_t blockSeqNumber);
-    inline uint64_t sequenceNumberFromBlock(uint8_t *block);
+    /**
+     * @brief Address of a block. Segments never move once mapped, so this stays valid until the next clear.
+     */
+    uint8_t *blockFromSequenceNumber(uint64_t blockSeqNumber) {
+        return m_segments[blockSeqNumber / m_segmentBlockCount] + blockSeqNumber % m_segmentBlockCount * m_blockSize;
+    }
 
     Result<uint64_t, Error> allocateBlock();
     void freeBlock(uint64_t blockSeqNumber);
     void printFreeList();
 
 private:
-    constexpr static uint64_t m_blockSize = 1048576; ///< Storage block size.
+    constexpr static uint64_t m_blockSize = 1048576;   ///< Storage block size.
+    constexpr static uint64_t m_segmentBlockCount = 64; ///< Blocks in each separately mapped segment of the file.
+
+    void unmapSegments();
+
+    /// @brief Write the header of a new last block and start encoding into it.
+    struct StorageBlockHeader;
+    StorageBlockHeader *startTailBlock(BlockChain &chain, uint64_t block, uint64_t watchEntryId, double firstKey);
+    /// @brief Bring the payload checksum in the last block's header up to date with what's been encoded.
+    void updateTailChecksums(BlockChain &chain);
+    /// @brief Checksum of the first bits of a payload. Bits after them in the last word don't count.
+    static uint32_t payloadChecksum(Crc32 crc, const uint8_t *payload, size_t fromBytes, size_t bits);
+    static uint32_t headerChecksum(const StorageBlockHeader &header);
+
+    void writeSuperblock(std::span<const CaptureChannel> channels);
+    struct Superblock;
+    /// @brief The current superblock and its channel table, if a copy of it is valid.
+    bool readSuperblock(Superblock &superblock, std::vector<CaptureChannel> &channels);
+
+    /// @brief Flushes the mapped segments to disk whenever requested, so checkpoints don't block the UI thread.
+    static void syncThread(DiskBackedStorage *self);
+    void requestSync();
+
+    struct ReadRequest {
+        const BlockChain *chain; ///< Only to tell which request a newer one replaces, never dereferenced
+        uint64_t tag;
+        ChainSnapshot snapshot;
+    };
+
+    /// @brief Carries out read requests one at a time.
+    static void readerThread(DiskBackedStorage *self);
+
+    StorageBlockHeader *blockHeader(uint64_t blockSeqNumber) {
+        return reinterpret_cast<StorageBlockHeader *>(blockFromSequenceNumber(blockSeqNumber));
+    }
+    /// @brief Where the encoded points of a block begin, right after the header.
+    uint8_t *blockPayload(uint64_t blockSeqNumber) {
+        return blockFromSequenceNumber(blockSeqNumber) + sizeof(StorageBlockHeader);
+    }
 
     /**
-     * @brief Useful information of each storage block. This only contains the most important properties for data
-     * logging, but if we need recoverability in the future, this can be expanded to realize that.
+     * @brief Useful information of each storage block. Everything but loggedDataPointsCount is covered by headerCrc,
+     * which is only brought up to date at checkpoints and when the block is full. A block whose header doesn't check
+     * out is not recovered.
      */
     struct StorageBlockHeader {
         uint64_t watchEntryId;          ///< ID of the watch entry that supposed to occupy this block
         uint64_t blockSequenceNumber;   ///< Sequence number among all the blocks a watch entry (backwards reference)
         uint64_t loggedDataPointsCount; ///< How many data points has already been logged into this block
+        BlockCodec codec;               ///< How the data points are encoded
+        uint32_t headerCrc;             ///< Checksum of the header, with this and loggedDataPointsCount as 0
+        uint64_t captureId;             ///< Capture the block was logged in, see Superblock
+        double firstKey;                ///< Key of the first data point
+        uint64_t durablePointCount;     ///< Data points covered by payloadCrc
+        uint64_t durableBits;           ///< Payload bits those data points take
+        uint32_t payloadCrc;            ///< Checksum of the first durableBits bits of payload
+        uint32_t reserved;
     };
-    struct UnallocatedBlockHeader {
-        uint64_t unallocatedId;   ///< ID for unallocated (maximum of u64)
-        uint64_t nextUnallocated; ///< Next unallocated block sequence number
-        uint64_t numberOfBlocks;  ///< How many contigious blocks, including this one, are free
+
+    /**
+     * @brief Block 0 holds two copies of the superblock, one in each half, written in turn. If writing one is cut
+     * short, the other one is still good. The newer valid copy is the current one. The channel table follows it.
+     */
+    struct Superblock {
+        uint64_t magic;        ///< SuperblockMagic
+        uint32_t version;      ///< SuperblockVersion
+        uint32_t crc;          ///< Checksum of the superblock and channel table, with this as 0
+        uint64_t sequence;     ///< Incremented on every write
+        uint64_t blockSize;    ///< Must match m_blockSize
+        uint64_t captureId;    ///< 0 when there's no capture in the file
+        uint64_t channelCount; ///< Entries of the channel table
+        uint64_t tableBytes;   ///< Size of the channel table
     };
+    static constexpr uint64_t SuperblockMagic = 0x3130484341435350; ///< "PSCACH01"
+    static constexpr uint32_t SuperblockVersion = 1;
+    static constexpr uint64_t SuperblockCopySize = m_blockSize / 2;
+
+    static constexpr uint64_t m_blockPayloadSize = m_blockSize - sizeof(StorageBlockHeader);
 
     /**
      * @brief Self incrementing ID for watch entries, used solely to index entries between GUI and model
@@ -92,19 +435,47 @@ private:
      *
      * We define the blocks to be 1MB for now. Most users' systems don't even use pages this large yet. Each watch entry
      * have to at least occupy one block, and fill its data points into it. When a block is full, new block will be
-     * requested. When reaching the file size limit, the acquisition will be forcibly aborted.
+     * requested. When reaching the file size limit, the acquisition will be forcibly aborted, unless the oldest blocks
+     * are recycled with recycleOldestBlock().
+     *
+     * The file grows a segment of blocks at a time, and each segment gets a mapping of its own. Growing only maps the
+     * new segment, so it's cheap, and what's already mapped never moves: block addresses can be held onto, even by the
+     * acquisition thread.
      */
     QFile m_backingStore;
 
-    uint8_t *m_storageMapping;
-    uint64_t m_freeListFirstBlockSeq;
+    std::vector<uint8_t *> m_segments; ///< Mapping of each segment of the file, in order
 
     uint64_t m_backingFileBlockCountLimit; ///< Only written to at initialization
-    uint64_t m_occupiedBlockCount = 0;     ///< Maintained dynamically
-    uint64_t m_backingFileBlockCount;      ///< Dynamically grows
+    uint64_t m_backingFileBlockCount = 0;  ///< Dynamically grows, a segment at a time
+
+    BlockAllocator m_allocator; ///< Which blocks in the storage are occupied
+
+    uint64_t m_captureId = 0;         ///< Current capture, random so blocks of an earlier one never match
+    uint64_t m_superblockSequence = 0; ///< Sequence of the last superblock written
+
+    std::thread m_syncThread;
+    std::mutex m_syncMutex; ///< Protects everything below
+    std::condition_variable m_syncCond;
+    std::vector<std::pair<uint8_t *, uint64_t>> m_syncSegments; ///< What to flush, set when a sync is requested
+    bool m_syncRequested = false;
+    bool m_syncBusy = false;
+    bool m_syncExit = false;
+
+    std::thread m_readerThread;
+    std::mutex m_readMutex; ///< Protects the requests and results
+    std::condition_variable m_readCond;
+    std::deque<ReadRequest> m_readRequests;
+    std::vector<ReadResult> m_readResults;
+    bool m_readExit = false;
+    std::function<void()> m_readCallback;
 
     /**
-     * @brief Represents the occupied blocks in the storage.
+     * @brief Held shared by the reader thread while it reads a block, and exclusively to free a block or to change the
+     * mapping. Protects the generations below, which tell the reader thread whether a block it was asked to read is
+     * still what it was.
      */
-    std::vector<bool> m_storageOccupationBitmap;
+    std::shared_mutex m_blockLock;
+    std::vector<uint32_t> m_blockGenerations; ///< Of each mapped block, incremented when it's freed
+    uint64_t m_mappingGeneration = 0;         ///< Incremented when segments are unmapped
 };
@@ -163,93 +163,6 @@ QString Bytecode::disassemble(bool integerInHex) {
     return ret;
 }
 
-Bytecode::ExecutionResult
-    Bytecode::execute(ExecutionState &state,
-                      std::function<Bytecode::ExecutionResult(ExecutionState &, Opcode, ImmType)> runner) {
-    auto getImmIndex = [this](size_t &offset) -> auto {
-        auto dataPtr = reinterpret_cast<const uint8_t *>(instructions.constData());
-        uint16_t ret = dataPtr[offset];
-        ++offset;
-        ret |= (dataPtr[offset] << 8);
-        return ret;
-    };
-
-    auto getConstant = [this](uint16_t immIndex) {
-        Q_ASSERT(constants.size() > immIndex);
-        return constants[immIndex];
-    };
-
-    if (state.PC > instructions.size()) {
-        qCritical() << "Bytecode execution PC overflow: insn count" << instructions.size() << "PC=" << state.PC;
-        qCritical() << disassemble();
-        state.PC = 0;
-        return InvalidPC;
-    }
-
-    // Try execute all instructions if the executor is satisfied
-    ExecutionResult ret;
-    for (auto &PC = state.PC; PC < instructions.size(); ++PC) {
-        // Fetch instruction and immediate
-        uint8_t insn = instructions.at(PC);
-        ImmType imm{std::nullopt};
-        // Resolve immediate
-        uint16_t immIdx;
-        union {
-            int64_t i;
-            uint64_t u;
-        } SignExtender;
-        if (IntImmSet.contains(insn)) {
-            // Do integer immediate specific processing
-            ++PC;
-            immIdx = getImmIndex(PC);
-            if (U16ImmSet.contains(insn)) {
-                imm = immIdx;
-            } else if (U32ImmSet.contains(insn)) {
-                imm = getConstant(immIdx).toULongLong();
-            } else if (U64ImmSet.contains(insn)) {
-                imm = getConstant(immIdx).toULongLong();
-            } else if (I16ImmSet.contains(insn)) {
-                int16_t signedImmIdx;
-                memcpy(&signedImmIdx, &immIdx, 2);
-                SignExtender.i = signedImmIdx;
-                imm = SignExtender.u;
-            } else if (I32ImmSet.contains(insn)) {
-                SignExtender.i = getConstant(immIdx).toLongLong();
-                imm = SignExtender.u;
-            } else if (I64ImmSet.contains(insn)) {
-                SignExtender.i = getConstant(immIdx).toLongLong();
-                imm = SignExtender.u;
-            } else {
-                Q_UNREACHABLE();
-            }
-        } else if (StrImmSet.contains(insn)) {
-            // String immediate specific processing
-            immIdx = getImmIndex(++PC);
-            imm = getConstant(immIdx).toString();
-        }
-
-        // Give it to execution engine and see if it wants to continue
-        // qDebug() << "Executing" << Opcode(insn);
-        switch (ret = runner(state, Opcode(insn), imm)) {
-            case Completed: break;
-            case Continue: continue;
-            case MemAccess: break;
-            case BeginErrors:
-            case ErrorBreak: break;
-            case InvalidPC: return InvalidPC;
-        }
-        break;
-    }
-
-    // If at last the execution finished, reset the execution state
-    if (state.PC == instructions.size()) {
-        state.resetAll();
-        ret = Completed;
-    }
-
-    return ret;
-}
-
 Bytecode::ExecutionResult Bytecode::genericComputationExecutor(ExecutionState &es, Opcode op, ImmType imm) {
     union {
         uint64_t u;
@@ -341,6 +254,61 @@ Bytecode::ExecutionResult Bytecode::genericComputationExecutor(ExecutionState &e
 
 /***************************************** INTERNAL UTILS *****************************************/
 
+void Bytecode::decodeImmediate(uint8_t insn, size_t &PC, ImmType &imm) const {
+    auto getImmIndex = [this](size_t &offset) -> auto {
+        auto dataPtr = reinterpret_cast<const uint8_t *>(instructions.constData());
+        uint16_t ret = dataPtr[offset];
+        ++offset;
+        ret |= (dataPtr[offset] << 8);
+        return ret;
+    };
+
+    auto getConstant = [this](uint16_t immIndex) {
+        Q_ASSERT(constants.size() > immIndex);
+        return constants[immIndex];
+    };
+
+    uint16_t immIdx;
+    union {
+        int64_t i;
+        uint64_t u;
+    } SignExtender;
+    if (IntImmSet.contains(insn)) {
+        // Do integer immediate specific processing
+        ++PC;
+        immIdx = getImmIndex(PC);
+        if (U16ImmSet.contains(insn)) {
+            imm = immIdx;
+        } else if (U32ImmSet.contains(insn)) {
+            imm = getConstant(immIdx).toULongLong();
+        } else if (U64ImmSet.contains(insn)) {
+            imm = getConstant(immIdx).toULongLong();
+        } else if (I16ImmSet.contains(insn)) {
+            int16_t signedImmIdx;
+            memcpy(&signedImmIdx, &immIdx, 2);
+            SignExtender.i = signedImmIdx;
+            imm = SignExtender.u;
+        } else if (I32ImmSet.contains(insn)) {
+            SignExtender.i = getConstant(immIdx).toLongLong();
+            imm = SignExtender.u;
+        } else if (I64ImmSet.contains(insn)) {
+            SignExtender.i = getConstant(immIdx).toLongLong();
+            imm = SignExtender.u;
+        } else {
+            Q_UNREACHABLE();
+        }
+    } else if (StrImmSet.contains(insn)) {
+        // String immediate specific processing
+        immIdx = getImmIndex(++PC);
+        imm = getConstant(immIdx).toString();
+    }
+}
+
+void Bytecode::reportInvalidPC(const ExecutionState &state) {
+    qCritical() << "Bytecode execution PC overflow: insn count" << instructions.size() << "PC=" << state.PC;
+    qCritical() << disassemble();
+}
+
 bool Bytecode::checkIfRequiredImmediateValid(Opcode opcode, const std::optional<QVariant> &immediate) {
     switch (opcode) {
         case MetaLoadInt:
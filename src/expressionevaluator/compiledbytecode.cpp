@@ -0,0 +1,104 @@
+
+#include "expressionevaluator/compiledbytecode.h"
+#include <QDebug>
+#include <QObject>
+#include <algorithm>
+
+namespace ExpressionEvaluator {
+
+Result<CompiledBytecode, QString> CompiledBytecode::compile(Bytecode &bytecode) {
+    CompiledBytecode ret;
+    QString err;
+    ExecutionState es;
+
+    // Let the bytecode decode itself, and record every instruction instead of running it
+    auto result =
+        bytecode.execute(es, [&](ExecutionState &es, Opcode op, Bytecode::ImmType imm) -> Bytecode::ExecutionResult {
+            switch (op) {
+                case Nop: return Bytecode::Continue;
+                case LoadI16:
+                case LoadU16:
+                case LoadI32:
+                case LoadU32:
+                case LoadI64:
+                case LoadU64:
+                case AddI16:
+                case AddI32:
+                case AddI64:
+                case MulI16:
+                case MulI32:
+                case MulI64:
+                case LogicalShiftRight:
+                case MaskBitsZeroExtend:
+                case MaskBitsSignExtend: ret.m_instructions.push_back({op, std::get<uint64_t>(imm)}); break;
+                case Add:
+                case Mul:
+                case Deref8:
+                case Deref16:
+                case Deref32:
+                case Deref64:
+                case ReturnU8:
+                case ReturnU16:
+                case ReturnU32:
+                case ReturnU64:
+                case ReturnI8:
+                case ReturnI16:
+                case ReturnI32:
+                case ReturnI64:
+                case ReturnF32:
+                case ReturnF64: ret.m_instructions.push_back({op, 0}); break;
+                default:
+                    err = QObject::tr("Instruction %1 is not allowed in runtime bytecode")
+                              .arg(int(op), 2, 16, QChar('0'));
+                    return Bytecode::ErrorBreak;
+            }
+            return Bytecode::Continue;
+        });
+
+    if (result != Bytecode::Completed) {
+        return Err(err.isNull() ? QObject::tr("Bytecode is malformed") : err);
+    }
+
+    // Walk the instructions once to find out the deepest the stack can get
+    size_t depth = 0;
+    for (auto &insn : ret.m_instructions) {
+        switch (insn.op) {
+            case LoadI16:
+            case LoadU16:
+            case LoadI32:
+            case LoadU32:
+            case LoadI64:
+            case LoadU64: ++depth; break;
+            case Add:
+            case Mul:
+                // Two operands in, one out
+                if (depth < 2) {
+                    return Err(QObject::tr("Stack underflow in bytecode"));
+                }
+                --depth;
+                break;
+            default:
+                // Everything else works on the top of stack in place
+                if (depth < 1) {
+                    return Err(QObject::tr("Stack underflow in bytecode"));
+                }
+                break;
+        }
+        ret.m_maxStackDepth = std::max(ret.m_maxStackDepth, depth);
+    }
+    if (ret.m_maxStackDepth > RuntimeState::StackCapacity) {
+        return Err(QObject::tr("Expression needs a stack of %1 words, only %2 are available")
+                       .arg(ret.m_maxStackDepth)
+                       .arg(RuntimeState::StackCapacity));
+    }
+
+    return Ok(ret);
+}
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+void CompiledBytecode::reportInvalidPC(const RuntimeState &state) const {
+    qCritical() << "Compiled bytecode execution PC overflow: insn count" << m_instructions.size() << "PC=" << state.PC;
+}
+
+} // namespace ExpressionEvaluator
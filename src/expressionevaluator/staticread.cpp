@@ -0,0 +1,88 @@
+#include "expressionevaluator/staticread.h"
+#include "expressionevaluator/executionstate.h"
+
+namespace ExpressionEvaluator {
+
+std::optional<StaticRead> MatchStaticRead(Bytecode &bytecode) {
+    StaticRead ret{.address = 0, .width = 0, .shift = 0, .maskBits = 0, .signExtend = false, .returnOp = Nop};
+    ExecutionState es;
+
+    // Instructions must come in exactly this order. Each of them moves the stage forward, anything out of order or
+    // anything else makes the match fail.
+    enum { ExpectLoad, ExpectDeref, ExpectShift, ExpectMask, ExpectReturn, Matched } stage = ExpectLoad;
+
+    auto result =
+        bytecode.execute(es, [&](ExecutionState &es, Opcode op, Bytecode::ImmType imm) -> Bytecode::ExecutionResult {
+            if (op == Nop) {
+                return Bytecode::Continue;
+            }
+            if (stage == Matched) {
+                return Bytecode::ErrorBreak;
+            }
+            switch (op) {
+                case LoadI16:
+                case LoadU16:
+                case LoadI32:
+                case LoadU32:
+                case LoadI64:
+                case LoadU64:
+                    if (stage != ExpectLoad) {
+                        return Bytecode::ErrorBreak;
+                    }
+                    ret.address = std::get<uint64_t>(imm);
+                    stage = ExpectDeref;
+                    return Bytecode::Continue;
+                case Deref8:
+                case Deref16:
+                case Deref32:
+                case Deref64:
+                    if (stage != ExpectDeref) {
+                        return Bytecode::ErrorBreak;
+                    }
+                    ret.width = 1ull << (op - Deref8);
+                    stage = ExpectShift;
+                    return Bytecode::Continue;
+                case LogicalShiftRight:
+                    if (stage != ExpectShift || std::get<uint64_t>(imm) >= 64) {
+                        return Bytecode::ErrorBreak;
+                    }
+                    ret.shift = std::get<uint64_t>(imm);
+                    stage = ExpectMask;
+                    return Bytecode::Continue;
+                case MaskBitsZeroExtend:
+                case MaskBitsSignExtend:
+                    if ((stage != ExpectShift && stage != ExpectMask) || std::get<uint64_t>(imm) == 0 ||
+                        std::get<uint64_t>(imm) > 64) {
+                        return Bytecode::ErrorBreak;
+                    }
+                    ret.maskBits = std::get<uint64_t>(imm);
+                    ret.signExtend = op == MaskBitsSignExtend;
+                    stage = ExpectReturn;
+                    return Bytecode::Continue;
+                case ReturnU8:
+                case ReturnU16:
+                case ReturnU32:
+                case ReturnU64:
+                case ReturnI8:
+                case ReturnI16:
+                case ReturnI32:
+                case ReturnI64:
+                case ReturnF32:
+                case ReturnF64:
+                    if (stage != ExpectShift && stage != ExpectMask && stage != ExpectReturn) {
+                        return Bytecode::ErrorBreak;
+                    }
+                    ret.returnOp = op;
+                    stage = Matched;
+                    return Bytecode::Continue;
+                default: return Bytecode::ErrorBreak;
+            }
+        });
+
+    if (result != Bytecode::Completed || stage != Matched) {
+        return std::nullopt;
+    }
+    return ret;
+}
+
+} // namespace ExpressionEvaluator
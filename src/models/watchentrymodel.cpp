@@ -101,11 +101,31 @@ QVariant WatchEntryModel::data(const QModelIndex &index, int role) const {
                 }
                 case Qt::EditRole: return m_workspace->getWatchEntryGraphProperty(entry, FrequencyLimit).unwrap();
             }
+            break;
+        }
+        case OverflowPolicy: {
+            auto policy = m_workspace->getWatchEntryGraphProperty(entry, OverflowPolicy).unwrap();
+            switch (role) {
+                case Qt::DisplayRole: return overflowPolicyName(AcquisitionBuffer::OverflowPolicy(policy.toInt()));
+                case Qt::EditRole: return policy.toInt();
+            }
+            break;
+        }
+        case Overflows: {
+            switch (role) {
+                case Qt::DisplayRole: return m_workspace->getWatchEntryGraphProperty(entry, Overflows).unwrap();
+                case Qt::ToolTipRole:
+                    return tr("%1 samples lost, %2 samples spilled to disk")
+                        .arg(m_workspace->getWatchEntryGraphProperty(entry, Overflows).unwrap().toULongLong())
+                        .arg(m_workspace->getWatchEntryGraphProperty(entry, SpilledCount).unwrap().toULongLong());
+            }
+            break;
         }
 
         // These are never shown as a column
         case MaxColumns:
         case FrequencyFeedback:
+        case SpilledCount:
         case ExpressionOkay: return QVariant();
     }
     return QVariant();
@@ -123,6 +143,9 @@ Qt::ItemFlags WatchEntryModel::flags(const QModelIndex &index) const {
     }
 
     // Rows with data
+    if (index.column() == Columns::Overflows) {
+        return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+    }
     return Qt::ItemIsEditable | Qt::ItemIsSelectable | Qt::ItemIsEnabled;
 }
 
@@ -149,8 +172,11 @@ bool WatchEntryModel::setData(const QModelIndex &index, const QVariant &value, i
             case Thickness: return m_workspace->setWatchEntryGraphProperty(entry, Thickness, value);
             case LineStyle: return m_workspace->setWatchEntryGraphProperty(entry, LineStyle, value);
             case FrequencyLimit: return m_workspace->setWatchEntryGraphProperty(entry, FrequencyLimit, value);
+            case OverflowPolicy: return m_workspace->setWatchEntryGraphProperty(entry, OverflowPolicy, value);
+            case Overflows:
             case MaxColumns:
             case FrequencyFeedback:
+            case SpilledCount:
             case ExpressionOkay: Q_UNREACHABLE(); return m_workspace->setWatchEntryGraphProperty(-1, MaxColumns, 0);
         }
         return m_workspace->setWatchEntryGraphProperty(-1, MaxColumns, 0);
@@ -172,45 +198,57 @@ QVariant WatchEntryModel::headerData(int section, Qt::Orientation orientation, i
         return super();
     }
 
-    // We only deal with horizontal header
+    // We only deal with horizontal header. Every column returns, so roles handled by one never show on another.
     switch (Columns(section)) {
         case Color:
             switch (role) {
                 case Qt::DisplayRole: return QString();
-                default: break;
+                default: return super();
             }
         case DisplayName:
             switch (role) {
                 case Qt::DisplayRole: return tr("Display name");
-                default: break;
+                default: return super();
             }
         case Expression:
             switch (role) {
                 case Qt::DisplayRole: return tr("Expression");
-                default: break;
+                default: return super();
             }
         case PlotAreas:
             switch (role) {
                 case Qt::DisplayRole: return tr("Plot areas");
-                default: break;
+                default: return super();
             }
         case Thickness:
             switch (role) {
                 case Qt::DisplayRole: return tr("Thickness");
-                default: break;
+                default: return super();
             }
         case LineStyle:
             switch (role) {
                 case Qt::DisplayRole: return tr("Style");
-                default: break;
+                default: return super();
             }
         case FrequencyLimit:
             switch (role) {
                 case Qt::DisplayRole: return tr("Frequency");
-                default: break;
+                default: return super();
+            }
+        case OverflowPolicy:
+            switch (role) {
+                case Qt::DisplayRole: return tr("On overflow");
+                default: return super();
+            }
+        case Overflows:
+            switch (role) {
+                case Qt::DisplayRole: return tr("Lost");
+                case Qt::ToolTipRole: return tr("Samples lost because the acquisition buffer was full");
+                default: return super();
             }
         case MaxColumns:
         case FrequencyFeedback:
+        case SpilledCount:
         case ExpressionOkay: return super();
     }
     return super(); // All unhandled cases goes to super
@@ -263,6 +301,24 @@ void WatchEntryModel::notifyFrequencyFeedbackChanged() {
     emit dataChanged(index(0, FrequencyLimit), index(m_watchEntryIds.size(), FrequencyLimit), {Qt::DisplayRole});
 }
 
+void WatchEntryModel::notifyOverflowCountChanged(size_t entryId) {
+    invalidateEntryDataDisplay(entryId, Overflows);
+}
+
+void WatchEntryModel::notifyOverflowCountChanged() {
+    emit dataChanged(index(0, Overflows), index(m_watchEntryIds.size(), Overflows), {Qt::DisplayRole});
+}
+
+QString WatchEntryModel::overflowPolicyName(AcquisitionBuffer::OverflowPolicy policy) {
+    switch (policy) {
+        case AcquisitionBuffer::OverflowPolicy::DropNewest: return tr("Drop newest");
+        case AcquisitionBuffer::OverflowPolicy::DropOldest: return tr("Drop oldest");
+        case AcquisitionBuffer::OverflowPolicy::Decimate: return tr("Decimate");
+        case AcquisitionBuffer::OverflowPolicy::SpillToDisk: return tr("Spill to disk");
+    }
+    return QString();
+}
+
 void WatchEntryModel::removeEntry(size_t entryId) {
     // TODO: use a bimap implementation? There won't be a heck lot of entries, a linear search won't hurt
     auto idx = m_watchEntryIds.indexOf(entryId);
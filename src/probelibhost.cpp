@@ -146,6 +146,20 @@ probelib::ReadResult ProbeLibHost::readMemory64(uint64_t address, size_t count)
     return m_probeSession->get()->readMemory64(address, count);
 }
 
+Result<void, probelib::Error> ProbeLibHost::setReadScatterGatherList(const QVector<ScatterGatherEntry> &list) {
+    if (auto checkResult = checkSession(); checkResult.isErr()) {
+        return Err(checkResult.unwrapErr());
+    }
+    return m_probeSession->get()->setReadScatterGatherList(list);
+}
+
+probelib::ReadResult ProbeLibHost::readScatterGather() {
+    if (auto checkResult = checkSession(); checkResult.isErr()) {
+        return Err(checkResult.unwrapErr());
+    }
+    return m_probeSession->get()->readScatterGather();
+}
+
 /***************************************** INTERNAL UTILS *****************************************/
 
 Result<void, probelib::Error> ProbeLibHost::checkSession() {
@@ -53,6 +53,8 @@ public:
     probelib::ReadResult readMemory16(uint64_t address, size_t count);
     probelib::ReadResult readMemory32(uint64_t address, size_t count);
     probelib::ReadResult readMemory64(uint64_t address, size_t count);
+    Result<void, probelib::Error> setReadScatterGatherList(const QVector<probelib::ScatterGatherEntry> &list);
+    probelib::ReadResult readScatterGather();
     // TODO: Write APIs
 
 private:
@@ -0,0 +1,96 @@
+#include "readcoalescer.h"
+#include <algorithm>
+#include <cstring>
+
+void ReadCoalescer::setGapThreshold(size_t bytes) {
+    if (bytes != m_gapThreshold) {
+        m_gapThreshold = bytes;
+        // Force the layout to be rebuilt on next plan()
+        m_reads.clear();
+        m_blocks.clear();
+        m_totalBytes = 0;
+    }
+}
+
+void ReadCoalescer::setCoalescingEnabled(bool enabled) {
+    if (enabled != m_coalescingEnabled) {
+        m_coalescingEnabled = enabled;
+        m_reads.clear();
+        m_blocks.clear();
+        m_totalBytes = 0;
+    }
+}
+
+bool ReadCoalescer::plan(const std::vector<Read> &reads) {
+    if (reads == m_reads && !m_blocks.isEmpty()) {
+        return false;
+    }
+
+    auto oldBlocks = m_blocks;
+    m_reads = reads;
+    m_readOffsets.resize(reads.size());
+    m_blocks.clear();
+    m_totalBytes = 0;
+
+    if (!m_coalescingEnabled) {
+        for (size_t i = 0; i < reads.size(); i++) {
+            m_readOffsets[i] = m_totalBytes;
+            m_blocks.push_back({reads[i].address, reads[i].width});
+            m_totalBytes += reads[i].width;
+        }
+        return m_blocks != oldBlocks;
+    }
+
+    m_order.resize(reads.size());
+    for (size_t i = 0; i < reads.size(); i++) {
+        m_order[i] = i;
+    }
+    std::sort(m_order.begin(), m_order.end(),
+              [&](size_t a, size_t b) { return reads[a].address < reads[b].address; });
+
+    auto alignDown = [](uint64_t x) { return x & ~uint64_t(3); };
+    auto alignUp = [](uint64_t x) { return (x + 3) & ~uint64_t(3); };
+
+    // Sweep in address order. blockStart/blockEnd is the block being grown, blockBaseOffset is where it begins in the
+    // concatenated data.
+    uint64_t blockStart = 0, blockEnd = 0;
+    size_t blockBaseOffset = 0;
+    bool blockOpen = false;
+    auto closeBlock = [&]() {
+        m_blocks.push_back({blockStart, blockEnd - blockStart});
+        m_totalBytes += blockEnd - blockStart;
+    };
+    for (auto i : m_order) {
+        auto &read = reads[i];
+        auto readEnd = read.address + read.width;
+        if (!blockOpen) {
+            blockStart = alignDown(read.address);
+            blockEnd = alignUp(readEnd);
+            blockBaseOffset = 0;
+            blockOpen = true;
+        } else if (read.address <= blockEnd + m_gapThreshold) {
+            blockEnd = std::max(blockEnd, alignUp(readEnd));
+        } else {
+            closeBlock();
+            blockBaseOffset = m_totalBytes;
+            blockStart = alignDown(read.address);
+            blockEnd = alignUp(readEnd);
+        }
+        m_readOffsets[i] = blockBaseOffset + (read.address - blockStart);
+    }
+    if (blockOpen) {
+        closeBlock();
+    }
+
+    return m_blocks != oldBlocks;
+}
+
+uint64_t ReadCoalescer::fanOut(const QByteArray &data, size_t index) const {
+    uint64_t ret = 0;
+    auto offset = m_readOffsets[index];
+    auto width = m_reads[index].width;
+    if (offset + width <= size_t(data.size())) {
+        memcpy(&ret, data.constData() + offset, width);
+    }
+    return ret;
+}
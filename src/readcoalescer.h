@@ -0,0 +1,69 @@
+
+#pragma once
+
+#include "probelib/misc.h"
+#include <QVector>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief ReadCoalescer turns the reads planned on an acquisition tick into the fewest 32-bit aligned block reads.
+ * Reads that overlap or sit no further than the gap threshold apart are merged into one block, so neighbouring
+ * globals, struct members and bitfields in the same word cost one range instead of one each.
+ *
+ * Blocks are always word aligned and a multiple of 4 bytes long, so they can be read with readMemory32 or handed to
+ * the probe as a scatter-gather list as they are. Reading more bytes than needed is allowed: on SWD/JTAG the
+ * per-transaction overhead outweighs a few extra words by far.
+ *
+ * The extra bytes belong to no watch entry, and may be anything. That's harmless in RAM, but reading a memory mapped
+ * peripheral register can have side effects, like clearing a status flag or popping a FIFO. When that matters,
+ * coalescing can be turned off: every read then is a block of its own, covering exactly its bytes.
+ */
+class ReadCoalescer {
+public:
+    struct Read {
+        uint64_t address;
+        size_t width;
+
+        bool operator==(const Read &other) const = default;
+    };
+
+    /// @brief Set the largest distance in bytes between two reads that are still merged into one block.
+    void setGapThreshold(size_t bytes);
+    size_t gapThreshold() const { return m_gapThreshold; }
+
+    /// @brief Whether reads are widened and merged at all. On by default.
+    void setCoalescingEnabled(bool enabled);
+    bool isCoalescingEnabled() const { return m_coalescingEnabled; }
+
+    /**
+     * @brief Compute the block layout for the reads. The layout is kept as is when the reads are the same as last time.
+     * @return true if the block layout has changed.
+     */
+    bool plan(const std::vector<Read> &reads);
+
+    /// @brief The blocks to read. count is in bytes. Data of all blocks concatenated is what fanOut() expects.
+    /// Blocks are only word aligned while coalescing is enabled.
+    const QVector<probelib::ScatterGatherEntry> &blocks() const { return m_blocks; }
+
+    /// @brief Total bytes of all blocks.
+    size_t totalBytes() const { return m_totalBytes; }
+
+    /**
+     * @brief Get the value of the read at index from the concatenated block data.
+     * @param data Concatenated data of all blocks.
+     * @param index Index of the read in the list last passed into plan().
+     * @return The bytes read, zero extended to 64 bits.
+     */
+    uint64_t fanOut(const QByteArray &data, size_t index) const;
+
+private:
+    size_t m_gapThreshold = 16;
+    bool m_coalescingEnabled = true;
+
+    std::vector<Read> m_reads;                   ///< Reads the current layout was built for
+    std::vector<size_t> m_readOffsets;           ///< Offset of each read into the concatenated block data
+    std::vector<size_t> m_order;                 ///< Scratch: read indices sorted by address
+    QVector<probelib::ScatterGatherEntry> m_blocks;
+    size_t m_totalBytes = 0;
+};
@@ -0,0 +1,105 @@
+#include "sampleprocessor.h"
+#include "utils.h"
+#include <algorithm>
+
+SampleProcessor::SampleProcessor(std::shared_ptr<AcquisitionBuffer> buffer) : m_buffer(std::move(buffer)) {
+    m_processingThread = std::thread(processingThread, this);
+}
+
+SampleProcessor::~SampleProcessor() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_cond.notify_all();
+    m_processingThread.join();
+    delete m_published.exchange(nullptr);
+}
+
+void SampleProcessor::addChannel(size_t entryId, const AcquisitionBuffer::ChannelConfig &config) {
+    m_buffer->addChannel(entryId, config);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_channels.push_back(entryId);
+}
+
+void SampleProcessor::removeChannel(size_t entryId) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::erase(m_channels, entryId);
+    }
+    m_buffer->removeChannel(entryId);
+}
+
+void SampleProcessor::setActive(bool active) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active = active;
+        if (active) {
+            m_busy.store(true, std::memory_order_release);
+        } else {
+            m_finalPassPending = true;
+        }
+    }
+    m_cond.notify_all();
+}
+
+std::chrono::nanoseconds SampleProcessor::processingThreadCpuTime() {
+    return ProbeScopeUtil::threadCpuTime(m_processingThread.native_handle());
+}
+
+/***************************************** INTERNAL UTILS *****************************************/
+
+void SampleProcessor::processingThread(SampleProcessor *self) {
+    std::vector<size_t> channels;
+    std::unique_lock<std::mutex> lock(self->m_mutex);
+    while (!self->m_exit) {
+        if (self->m_active) {
+            self->m_cond.wait_for(lock, ProcessingInterval, [&]() { return self->m_exit || !self->m_active; });
+        } else {
+            self->m_cond.wait(lock, [&]() { return self->m_exit || self->m_active || self->m_finalPassPending; });
+        }
+
+        // Drain without the lock, so adding or removing a channel on the UI thread never waits for a pass. Chunks of a
+        // channel removed meanwhile are dropped by whoever takes the batch.
+        channels = self->m_channels;
+        auto finalPass = !self->m_active && self->m_finalPassPending;
+        self->m_finalPassPending = false;
+        lock.unlock();
+        self->processOnce(channels);
+        lock.lock();
+
+        if (finalPass && !self->m_active && !self->m_finalPassPending) {
+            // The last batch is published by now, so whoever sees m_busy cleared will find it with takeBatch()
+            self->m_busy.store(false, std::memory_order_release);
+        }
+    }
+}
+
+void SampleProcessor::processOnce(const std::vector<size_t> &channels) {
+    auto batch = std::make_unique<Batch>();
+    for (auto entryId : channels) {
+        // Only take what's in the channel right now, so each chunk is allocated exactly once
+        auto count = m_buffer->getChannelBufferedCount(entryId);
+        if (!count) {
+            continue;
+        }
+        auto &chunk = batch->chunks.emplace_back(Chunk{entryId, QVector<QCPGraphData>(count)});
+        auto drained = m_buffer->drainChannel(entryId, chunk.data.data(), count);
+        chunk.data.resize(drained);
+        batch->sampleCount += drained;
+    }
+
+    if (batch->sampleCount) {
+        publish(std::move(batch));
+    }
+}
+
+void SampleProcessor::publish(std::unique_ptr<Batch> batch) {
+    // If the UI hasn't taken the last batch, take it back and put the new chunks after the old ones
+    if (auto pending = takeBatch(); pending) {
+        std::move(batch->chunks.begin(), batch->chunks.end(), std::back_inserter(pending->chunks));
+        pending->sampleCount += batch->sampleCount;
+        batch = std::move(pending);
+    }
+    m_published.store(batch.release(), std::memory_order_release);
+}
@@ -0,0 +1,80 @@
+
+#pragma once
+
+#include "acquisitionbuffer.h"
+#include "qcustomplot.h"
+#include <QVector>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief SampleProcessor sits between AcquisitionBuffer and WorkspaceModel. On its own thread, it drains the buffer
+ * channels and converts the raw samples into ready-to-append QCPGraphData chunks. Chunks are collected into batches,
+ * which are handed to the UI thread through a single atomic pointer: the processing thread publishes a batch by
+ * storing the pointer, and the UI thread takes it by exchanging it with null. If the UI hasn't taken the last batch
+ * when a new one is ready, the processing thread takes it back and appends to it, so nothing is lost or reordered.
+ */
+class SampleProcessor {
+public:
+    struct Chunk {
+        size_t entryId;
+        QVector<QCPGraphData> data; ///< Sorted by key
+    };
+    struct Batch {
+        std::vector<Chunk> chunks;
+        size_t sampleCount = 0;
+    };
+
+    SampleProcessor(std::shared_ptr<AcquisitionBuffer> buffer);
+    ~SampleProcessor();
+
+    /// @brief Add a channel to the acquisition buffer and start processing it.
+    void addChannel(size_t entryId, const AcquisitionBuffer::ChannelConfig &config);
+    /// @brief Stop processing a channel and remove it from the acquisition buffer. Remove the entry from the acquisition
+    /// hub first; samples it still adds for a short while are dropped.
+    void removeChannel(size_t entryId);
+
+    /**
+     * @brief Start or stop periodic processing. When stopped, one last pass is done to pick up what the acquisition
+     * thread left in the buffer; so stop only after the acquisition thread has stopped.
+     */
+    void setActive(bool active);
+
+    /// @brief Whether there may be more batches coming. Stays true after setActive(false) until the last pass is done.
+    bool isBusy() const { return m_busy.load(std::memory_order_acquire); }
+
+    /// @brief CPU time the processing thread has consumed so far. Used for profiling.
+    std::chrono::nanoseconds processingThreadCpuTime();
+
+    /// @brief Take the published batch, if any. This is how the UI thread receives data.
+    std::unique_ptr<Batch> takeBatch() {
+        return std::unique_ptr<Batch>(m_published.exchange(nullptr, std::memory_order_acq_rel));
+    }
+
+private:
+    static void processingThread(SampleProcessor *self);
+    /// @brief Drain the channels once and publish what was found. Called without m_mutex held.
+    void processOnce(const std::vector<size_t> &channels);
+    void publish(std::unique_ptr<Batch> batch);
+
+private:
+    static constexpr auto ProcessingInterval = std::chrono::milliseconds(5);
+
+    std::shared_ptr<AcquisitionBuffer> m_buffer;
+
+    std::thread m_processingThread;
+    std::mutex m_mutex; ///< Protects everything below
+    std::condition_variable m_cond;
+    std::vector<size_t> m_channels;
+    bool m_active = false;
+    bool m_finalPassPending = false;
+    bool m_exit = false;
+
+    std::atomic<bool> m_busy = false;
+    std::atomic<Batch *> m_published = nullptr;
+};
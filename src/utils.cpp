@@ -1,6 +1,14 @@
 
 #include "utils.h"
 
+#if defined(Q_OS_WIN)
+#define _WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(Q_OS_UNIX) && !defined(Q_OS_MACOS)
+#include <pthread.h>
+#include <time.h>
+#endif
+
 QString ProbeScopeUtil::bytesToSize(size_t s, int prec) {
     if (s > (1 << 30))
         return QString::number(double(s) / (1 << 30), 'f', prec) + " GB";
@@ -10,3 +18,36 @@ QString ProbeScopeUtil::bytesToSize(size_t s, int prec) {
         return QString::number(double(s) / (1 << 10), 'f', prec) + " KB";
     return QString::number(s) + " B";
 }
+
+std::chrono::nanoseconds ProbeScopeUtil::threadCpuTime(std::thread::native_handle_type thread) {
+#if defined(Q_OS_WIN)
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(reinterpret_cast<HANDLE>(thread), &creation, &exit, &kernel, &user)) {
+        return {};
+    }
+    // FILETIME counts in 100ns units
+    auto toTicks = [](const FILETIME &ft) { return (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime; };
+    return std::chrono::nanoseconds((toTicks(kernel) + toTicks(user)) * 100);
+#elif defined(Q_OS_UNIX) && !defined(Q_OS_MACOS)
+    clockid_t clock;
+    timespec ts;
+    if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0) {
+        return {};
+    }
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#else
+    Q_UNUSED(thread);
+    return {};
+#endif
+}
+
+std::chrono::nanoseconds ProbeScopeUtil::currentThreadCpuTime() {
+#if defined(Q_OS_WIN)
+    // GetCurrentThread() is a pseudo handle that is only meaningful to the calling thread, which is what we want
+    return threadCpuTime(GetCurrentThread());
+#elif defined(Q_OS_UNIX) && !defined(Q_OS_MACOS)
+    return threadCpuTime(pthread_self());
+#else
+    return {};
+#endif
+}
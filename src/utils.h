@@ -1,7 +1,8 @@
-
 #pragma once
 
 #include <QString>
+#include <chrono>
+#include <thread>
 
 namespace ProbeScopeUtil {
     /**
@@ -12,4 +13,17 @@ namespace ProbeScopeUtil {
      * @return QString size string
      */
     QString bytesToSize(size_t s, int prec);
+
+    /**
+     * @brief Get the CPU time (user + kernel) a thread has consumed so far. The thread must still be alive.
+     *
+     * @param thread native handle of the thread, as returned by std::thread::native_handle()
+     * @return CPU time, or zero if the platform doesn't support querying it
+     */
+    std::chrono::nanoseconds threadCpuTime(std::thread::native_handle_type thread);
+
+    /**
+     * @brief Same as threadCpuTime(), for the calling thread.
+     */
+    std::chrono::nanoseconds currentThreadCpuTime();
 }
@@ -3,11 +3,15 @@
 #include "expressionevaluator/optimizer.h"
 #include "expressionevaluator/parser.h"
 #include "probelibhost.h"
+#include "serialization/workspace.h"
 #include <QApplication>
 #include <QDebug>
 #include <QDir>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QMessageBox>
 #include <QSettings>
 #include <QStandardPaths>
@@ -63,14 +67,22 @@ WorkspaceModel::WorkspaceModel(QObject *parent) : QObject(parent) {
     bool isOk = false;
     auto mappingBlockLimit = settings.value("CacheFile/BlockCountLimit").toULongLong(&isOk);
     if (!isOk) {
-        mappingBlockLimit = 32; // Failsafe option
+        mappingBlockLimit = 2048; // Failsafe option
     }
     m_backingStore.setBlockCountLimit(mappingBlockLimit);
 
-    // Reuse clear routine as initialization here
-    m_backingStore.clearStorage();
+    // Logged points are read back on the storage's reader thread, take them on this one
+    m_backingStore.setReadCallback(
+        [this]() { QMetaObject::invokeMethod(this, [this]() { takeLoggedPages(); }, Qt::QueuedConnection); });
+
+    // Keep what a crashed session left in the cache file until the user decides what to do with it. Otherwise, reuse
+    // clear routine as initialization here.
+    m_interruptedCapture = m_backingStore.recoverCapture();
+    if (m_interruptedCapture.empty()) {
+        m_backingStore.clearStorage();
+    }
 
-    if (!m_backingStore.storageMapping()) {
+    if (!m_backingStore.isMapped()) {
         QMessageBox::critical(nullptr, tr("Cannot map cache file"),
                               tr("Cache file cannot be mapped to system memory. ProbeScope will now quit."));
         exit(1);
@@ -90,9 +102,16 @@ WorkspaceModel::WorkspaceModel(QObject *parent) : QObject(parent) {
     connect(m_acquisitionBuffer.get(), &AcquisitionBuffer::frequencyFeedbackArrived, this,
             &WorkspaceModel::sltAcquisitionFrequencyFeedbackArrived, Qt::QueuedConnection);
 
+    // Create sample processor, which converts buffered samples to graph data on its own thread
+    m_sampleProcessor = std::make_unique<SampleProcessor>(m_acquisitionBuffer);
+
     // Create acquisition hub
     m_acquisitionHub = std::make_unique<AcquisitionHub>(m_probeLibHost.get(), this);
     m_acquisitionHub->setAcquisitionBufferChannel(getAcquisitionBufferChannel());
+    // Everything acquired is in the buffer once the hub has stopped, let the sample processor do its last pass
+    connect(
+        m_acquisitionHub.get(), &AcquisitionHub::acquisitionStopped, this,
+        [this]() { m_sampleProcessor->setActive(false); }, Qt::QueuedConnection);
     connect(m_acquisitionHub.get(), &AcquisitionHub::acquisitionStopped, this,
             &WorkspaceModel::feedbackAcquisitionStopped, Qt::QueuedConnection);
 
@@ -110,7 +129,11 @@ WorkspaceModel::WorkspaceModel(QObject *parent) : QObject(parent) {
     m_defaultPlotColors.emplace_back("#b33dc6");
 }
 
-WorkspaceModel::~WorkspaceModel() {}
+WorkspaceModel::~WorkspaceModel() {
+    // Spill rings live in the cache file mapping, so stop everyone who touches them before it's unmapped
+    m_acquisitionHub.reset();
+    m_sampleProcessor.reset();
+}
 
 Result<void, SymbolBackend::Error> WorkspaceModel::loadSymbolFile(QString path) {
     auto result = m_symbolBackend->switchSymbolFile(path);
@@ -182,12 +205,15 @@ Result<size_t, WorkspaceModel::Error> WorkspaceModel::addWatchEntry(QString expr
         .expression = expression,
         .displayName = tr("Graph %1").arg(entryId),
         .acquisitionFrequencyLimit = 0, // TODO: UNUSED
+        .overflowPolicy = AcquisitionBuffer::OverflowPolicy::SpillToDisk,
+        .spillBlock = std::nullopt,
         .coefficient = 1,
         .associatedPlotAreas = {destAreaId, destAreaId + 1},
         .plotColor = getPlotColorBasedOnEntryId(entryId),
         .plotThickness = 1,
         .plotStyle = Qt::SolidLine,
         .data = QSharedPointer<QCPGraphDataContainer>(new QCPGraphDataContainer),
+        .log = {},
         .exprBytecode = (parseResult.isOk() ? std::optional(parseResult.unwrap())
                                             : std::optional<ExpressionEvaluator::Bytecode>{{}}
           ),
@@ -203,7 +229,7 @@ Result<size_t, WorkspaceModel::Error> WorkspaceModel::addWatchEntry(QString expr
     m_watchEntryModel->addRowForEntry(entryId);
 
     // Add to acquisition buffer channels
-    m_acquisitionBuffer->addChannel(entryId);
+    m_sampleProcessor->addChannel(entryId, makeChannelConfig(entry, getAcquisitionBufferHeadroom()));
 
     // Add to acquisition hub. If an entry doesn't have a valid runtime bytecode, it's disabled at first.
     m_acquisitionHub->addWatchEntry(entryId, entry.runtimeBytecode.has_value(),
@@ -211,7 +237,7 @@ Result<size_t, WorkspaceModel::Error> WorkspaceModel::addWatchEntry(QString expr
                                                                       : ExpressionEvaluator::Bytecode(),
                                     entry.acquisitionFrequencyLimit);
 
-    return Err(Error::NoError);
+    return Ok(entryId);
 }
 
 Result<void, WorkspaceModel::Error> WorkspaceModel::removeWatchEntry(uint64_t entryId, bool fromUi) {
@@ -232,8 +258,13 @@ Result<void, WorkspaceModel::Error> WorkspaceModel::removeWatchEntry(uint64_t en
         m_watchEntryModel->removeEntry(entryId);
     }
 
-    // Remove from acquisition hub
+    // Remove from acquisition hub, then the buffer channel it writes to
     m_acquisitionHub->removeWatchEntry(entryId);
+    m_sampleProcessor->removeChannel(entryId);
+    if (entry.spillBlock) {
+        m_releasedSpillBlocks.push_back(entry.spillBlock.value());
+    }
+    m_backingStore.freeChain(entry.log);
 
     return Ok();
 }
@@ -248,6 +279,66 @@ Result<QSharedPointer<QCPGraphDataContainer>, WorkspaceModel::Error>
     return Ok(m_watchEntries[entryId].data);
 }
 
+Result<const SummaryPyramid *, WorkspaceModel::Error> WorkspaceModel::getWatchEntrySummary(size_t entryId) {
+    if (!m_watchEntries.contains(entryId)) {
+        qCritical() << "Watch entry ID" << entryId << "does not exists and cannot get summary";
+        return Err(Error::InvalidWatchEntryIndex);
+    }
+
+    auto &entry = m_watchEntries[entryId];
+    if (entry.capture) {
+        return Ok(&entry.capture->channels()[entry.captureChannel].summary);
+    }
+    return Ok(&std::as_const(entry.log.summary));
+}
+
+Result<std::optional<QCPRange>, WorkspaceModel::Error> WorkspaceModel::getWatchEntryLoggedRange(size_t entryId) {
+    if (!m_watchEntries.contains(entryId)) {
+        qCritical() << "Watch entry ID" << entryId << "does not exists and cannot get logged range";
+        return Err(Error::InvalidWatchEntryIndex);
+    }
+
+    auto &entry = m_watchEntries[entryId];
+    if (entry.capture) {
+        auto &summary = entry.capture->channels()[entry.captureChannel].summary;
+        return Ok(summary.isEmpty() ? std::nullopt : std::optional(QCPRange(summary.firstKey(), summary.lastKey())));
+    }
+    // The summary may begin in a recycled block, the chain's time index doesn't
+    if (entry.log.firstKeys.empty()) {
+        return Ok(std::optional<QCPRange>());
+    }
+    return Ok(std::optional(QCPRange(entry.log.firstKeys.front(), entry.log.summary.lastKey())));
+}
+
+Result<QSharedPointer<QCPGraphDataContainer>, WorkspaceModel::Error>
+    WorkspaceModel::getWatchEntryLoggedPoints(size_t entryId, double lower, double upper) {
+    if (!m_watchEntries.contains(entryId)) {
+        qCritical() << "Watch entry ID" << entryId << "does not exists and cannot get logged points";
+        return Err(Error::InvalidWatchEntryIndex);
+    }
+
+    auto &entry = m_watchEntries[entryId];
+    if (entry.capture) {
+        return Ok(getCaptureFilePoints(entry, lower, upper));
+    }
+
+    // Points ever logged, so it doesn't go back down when blocks are recycled
+    auto loggedCount = entry.log.pointCount + entry.log.droppedPointCount;
+    if (entry.pageData && entry.page.covers(lower, upper, loggedCount)) {
+        return Ok(entry.pageData);
+    }
+
+    if (!entry.pendingPageTag || !entry.pendingPage.covers(lower, upper, loggedCount)) {
+        // Read half a view more on both sides, so scrolling a little doesn't need another read
+        auto margin = (upper - lower) / 2;
+        entry.pendingPage = {lower - margin, upper + margin, loggedCount,
+                             entry.log.summary.isEmpty() ? 0 : entry.log.summary.lastKey()};
+        entry.pendingPageTag = ++m_lastPageReadTag;
+        m_backingStore.requestRead(entry.log, entry.pendingPageTag, entry.pendingPage.lower, entry.pendingPage.upper);
+    }
+    return Ok(QSharedPointer<QCPGraphDataContainer>());
+}
+
 Result<QVariant, WorkspaceModel::Error> WorkspaceModel::getWatchEntryGraphProperty(size_t entryId,
                                                                                    WatchEntryModel::Columns prop) {
     if (!m_watchEntries.contains(entryId)) {
@@ -264,8 +355,13 @@ Result<QVariant, WorkspaceModel::Error> WorkspaceModel::getWatchEntryGraphProper
         case WatchEntryModel::Thickness: return Ok(QVariant(entry.plotThickness));
         case WatchEntryModel::LineStyle: return Ok(QVariant::fromValue(entry.plotStyle));
         case WatchEntryModel::FrequencyLimit: return Ok(QVariant(entry.acquisitionFrequencyLimit));
+        case WatchEntryModel::OverflowPolicy: return Ok(QVariant(int(entry.overflowPolicy)));
+        case WatchEntryModel::Overflows:
+            return Ok(QVariant(qulonglong(m_acquisitionBuffer->getChannelOverflowCount(entryId))));
         case WatchEntryModel::FrequencyFeedback:
             return Ok(QVariant(m_acquisitionBuffer->getChannelFrequencyFeedback(entryId)));
+        case WatchEntryModel::SpilledCount:
+            return Ok(QVariant(qulonglong(m_acquisitionBuffer->getChannelSpilledCount(entryId))));
         case WatchEntryModel::ExpressionOkay:
             return Ok(QVariant(entry.exprBytecode.has_value() && entry.runtimeBytecode.has_value()));
         default: return Ok(QVariant());
@@ -340,9 +436,23 @@ Result<void, WorkspaceModel::Error>
                     return Err(Error::InvalidWatchEntryPropertyValue);
                 }
                 entry.acquisitionFrequencyLimit = data.toInt();
+                m_acquisitionHub->changeWatchEntryFrequencyLimit(entryId, entry.acquisitionFrequencyLimit);
                 return Ok(true);
+            case WatchEntryModel::OverflowPolicy: {
+                // A spill ring is only set up when acquisition starts, until then SpillToDisk drops the newest
+                using Policy = AcquisitionBuffer::OverflowPolicy;
+                auto policy = Policy(data.toInt());
+                if (!data.canConvert<int>() || policy < Policy::DropNewest || policy > Policy::SpillToDisk) {
+                    return Err(Error::InvalidWatchEntryPropertyValue);
+                }
+                entry.overflowPolicy = policy;
+                m_acquisitionBuffer->setChannelOverflowPolicy(entryId, policy);
+                return Ok(false);
+            }
+            case WatchEntryModel::Overflows:
             case WatchEntryModel::MaxColumns:
             case WatchEntryModel::FrequencyFeedback:
+            case WatchEntryModel::SpilledCount:
             case WatchEntryModel::ExpressionOkay: return Err(Error::InvalidWatchEntryProperty);
         }
         return Err(Error::InvalidWatchEntryProperty);
@@ -358,24 +468,71 @@ Result<void, WorkspaceModel::Error>
 }
 
 bool WorkspaceModel::pullBufferedAcquisitionData() {
-    size_t count = 0;
-    for (auto it = m_watchEntries.cbegin(); it != m_watchEntries.cend(); ++it) {
-        m_acquisitionBuffer->drainChannel(it.key(), [&](AcquisitionBuffer::Timepoint t, AcquisitionBuffer::Value v) {
-            ++count;
-            it->data->add({AcquisitionBuffer::timepointToMillisecond(m_acquisitionStartTime, t),
-                           AcquisitionBuffer::valueToDouble(v)});
-        });
+    // Check before taking the batch: once the processor is no longer busy, its last batch has been published
+    bool busy = m_sampleProcessor->isBusy();
+    auto batch = m_sampleProcessor->takeBatch();
+    if (!batch) {
+        if (!busy && m_checkpointPending) {
+            checkpointCapture(); // The last batch is in, make all of it recoverable
+        }
+        return busy;
     }
-    // qDebug() << "Processed" << count << "sample points";
-    return count != 0;
+
+    // Chunks are sorted and come after what's already in the containers, so this is mostly memcpy
+    for (auto &chunk : batch->chunks) {
+        auto entry = m_watchEntries.find(chunk.entryId);
+        if (entry == m_watchEntries.end()) {
+            continue; // Removed after the chunk was made
+        }
+
+        if (!m_cacheStorageFull) {
+            if (auto result = logAcquiredData(*entry, chunk.entryId, chunk.data); result.isErr()) {
+                qCritical() << "Cannot log acquired data to cache file, error" << int(result.unwrapErr())
+                            << "stopping acquisition";
+                m_cacheStorageFull = true;
+                notifyAcquisitionStopped();
+            }
+        }
+
+        entry->data->add(chunk.data.constData(), chunk.data.constData() + chunk.data.size(), true);
+
+        // Older points are in the cache file, keep only the newest ones in memory. Once logging has failed, the
+        // containers hold the only copy of what's still coming, so keep that.
+        if (m_inMemoryPointLimit && !m_cacheStorageFull && size_t(entry->data->size()) > m_inMemoryPointLimit) {
+            entry->data->removeBefore((entry->data->constEnd() - m_inMemoryPointLimit)->key);
+        }
+    }
+    // qDebug() << "Processed" << batch->sampleCount << "sample points";
+
+    m_checkpointPending = true;
+    if (AcquisitionBuffer::Clock::now() - m_lastCheckpoint >= m_checkpointInterval) {
+        checkpointCapture();
+    }
+    return true;
 }
 
 void WorkspaceModel::notifyAcquisitionStarted() {
     // FIXME: When workspace still has data, notify the user whether to discard or save them
+    m_sampleProcessor->takeBatch(); // Drop anything left over from last acquisition
     foreach (auto &i, m_watchEntries) {
         i.data->clear();
+        m_backingStore.freeChain(i.log);
+        i.pageData.reset();
+        i.pendingPageTag = 0;
+        i.capture.reset();
     }
+    m_cacheStorageFull = false;
+    m_inMemoryPointLimit = getInMemoryPointLimit();
+    m_retentionMode = getRetentionMode();
+    m_checkpointInterval = getCheckpointInterval();
+    m_backingStore.beginCapture();
+    m_lastCheckpoint = AcquisitionBuffer::Clock::now();
+    m_checkpointPending = false;
+    configureAcquisitionChannels();
+    m_watchEntryModel->notifyOverflowCountChanged();
     m_acquisitionStartTime = AcquisitionBuffer::Clock::now();
+    m_acquisitionBuffer->setEpoch(m_acquisitionStartTime);
+    m_sampleProcessor->setActive(true);
     m_acquisitionHub->startAcquisition();
 }
 
@@ -397,40 +554,156 @@ void WorkspaceModel::notifyAcquisitionStopped() {
 #endif
 }
 
-Result<void, WorkspaceModel::Error> WorkspaceModel::saveAcquisitionData(QString fileName) {
-    size_t maxIndex = std::max_element(m_watchEntries.cbegin(), m_watchEntries.cend(), [](auto lhs, auto rhs) {
-                          return lhs.data->size() < rhs.data->size();
-                      })->data->size();
+Result<void, WorkspaceModel::Error>
+    WorkspaceModel::exportCapture(QString fileName, CaptureExporter::Format format, double lower, double upper) {
+    if (m_captureExporter) {
+        return Err(Error::CaptureExportInProgress);
+    }
+    for (auto &entry : m_watchEntries) {
+        // Writing the file would pull it out from under its own mapping
+        if (entry.capture && QFileInfo(entry.capture->fileName()) == QFileInfo(fileName)) {
+            return Err(Error::CaptureExportOverwritesSource);
+        }
+    }
+
+    // Plot settings go along, so the file can be opened again as it was
+    std::vector<CaptureExporter::Channel> channels;
+    QJsonArray settings;
+    for (auto &entry : m_watchEntries) {
+        if (entry.capture) {
+            // Opened from a capture file, nothing of it is in the cache file
+            channels.push_back({entry.displayName, {}, entry.capture->pointsInRange(entry.captureChannel, lower, upper),
+                                entry.capture});
+        } else {
+            channels.push_back({entry.displayName, m_backingStore.snapshotChain(entry.log, lower, upper), {}, {}});
+        }
+
+        Serialization::WatchEntry entrySettings{entry.expression, entry.plotColor.name(), entry.plotThickness,
+                                                Serialization::WatchEntry::LineStyle(entry.plotStyle), {}};
+        for (auto areaId : entry.associatedPlotAreas) {
+            entrySettings.plot_areas.append(int(areaId));
+        }
+        settings.append(qAsClassToJson(entrySettings));
+    }
+    auto workspace = QJsonDocument(QJsonObject{{"watch_entries", settings}}).toJson(QJsonDocument::Compact);
+
+    m_captureExporter = std::make_unique<CaptureExporter>(
+        m_backingStore, fileName, format, std::move(channels), workspace,
+        [this]() { QMetaObject::invokeMethod(this, [this]() { updateCaptureExport(); }, Qt::QueuedConnection); });
+    return Ok();
+}
 
-    QFile f(fileName);
-    if (!f.open(QFile::WriteOnly)) {
-        return Err(Error::SaveFileCannotOpen);
+void WorkspaceModel::cancelCaptureExport() {
+    if (m_captureExporter) {
+        m_captureExporter->cancel();
     }
+}
 
-    QTextStream ts(&f);
+Result<void, CaptureFile::Error> WorkspaceModel::openCaptureFile(QString fileName) {
+    auto capture = std::make_shared<CaptureFile>();
+    if (auto result = capture->open(fileName); result.isErr()) {
+        return result;
+    }
 
-    for (auto var : m_watchEntries) {
-        ts << "time_" + var.displayName << ",val_" + var.displayName + ',';
+    // Channels are in the order of their settings. Plot areas are made for the ones in the file.
+    auto settings = QJsonDocument::fromJson(capture->workspace()).object().value("watch_entries").toArray();
+    QMap<int, size_t> areaIds;
+    if (m_plotAreaIds.isEmpty()) {
+        addPlotArea();
     }
-    ts << '\n';
+    for (size_t i = 0; i < capture->channels().size(); i++) {
+        bool isOk = false;
+        auto entrySettings = qAsJsonToClass<Serialization::WatchEntry>(settings.at(qsizetype(i)), &isOk);
+        PlotAreas areas;
+        for (auto areaId : isOk ? entrySettings.plot_areas : QList<int>()) {
+            if (!areaIds.contains(areaId)) {
+                areaIds[areaId] = addPlotArea().unwrap();
+            }
+            areas.insert(areaIds[areaId]);
+        }
 
-    for (size_t i = 0; i < maxIndex; ++i) {
-        for (auto var : m_watchEntries) {
-            if (i >= var.data->size()) {
-                ts << ",,";
-            } else {
-                auto &sample = *var.data->at(i);
-                ts << sample.key << ',' << sample.value << ',';
+        auto result = addWatchEntry(isOk ? entrySettings.expr : QString(),
+                                    areas.isEmpty() ? std::nullopt : std::optional(*areas.begin()));
+        if (result.isErr()) {
+            continue;
+        }
+        auto entryId = result.unwrap();
+        setWatchEntryGraphProperty(entryId, WatchEntryModel::DisplayName, capture->channels()[i].name);
+        if (!areas.isEmpty()) {
+            setWatchEntryGraphProperty(entryId, WatchEntryModel::PlotAreas, QVariant::fromValue(areas));
+        }
+        if (isOk) {
+            if (QColor color(entrySettings.color); color.isValid()) {
+                setWatchEntryGraphProperty(entryId, WatchEntryModel::Color, QVariant::fromValue(color));
             }
+            setWatchEntryGraphProperty(entryId, WatchEntryModel::Thickness, entrySettings.thickness);
+            setWatchEntryGraphProperty(entryId, WatchEntryModel::LineStyle,
+                                       QVariant::fromValue(Qt::PenStyle(entrySettings.line_style)));
         }
-        ts << '\n';
-    }
 
-    ts.flush();
-    f.close();
+        auto &entry = m_watchEntries[entryId];
+        entry.capture = capture;
+        entry.captureChannel = i;
+    }
     return Ok();
 }
 
+QStringList WorkspaceModel::getInterruptedCaptureNames() const {
+    QStringList names;
+    for (auto &recovered : m_interruptedCapture) {
+        names.append(recovered.channel.displayName);
+    }
+    return names;
+}
+
+void WorkspaceModel::recoverInterruptedCapture() {
+    if (m_plotAreaIds.isEmpty()) {
+        addPlotArea();
+    }
+
+    auto inMemoryPointLimit = getInMemoryPointLimit();
+    for (auto &recovered : m_interruptedCapture) {
+        auto result = addWatchEntry(recovered.channel.expression, {});
+        if (result.isErr()) {
+            m_backingStore.freeChain(recovered.chain);
+            continue;
+        }
+        auto entryId = result.unwrap();
+        setWatchEntryGraphProperty(entryId, WatchEntryModel::DisplayName, recovered.channel.displayName);
+
+        auto &entry = m_watchEntries[entryId];
+        entry.log = std::move(recovered.chain);
+
+        // Load the newest points into memory, as they were when the capture was interrupted, and summarize all of them
+        auto pointCount = entry.log.pointCount;
+        auto skip = (inMemoryPointLimit && pointCount > inMemoryPointLimit) ? pointCount - inMemoryPointLimit : 0;
+        QVector<QCPGraphData> points;
+        points.reserve(pointCount - skip);
+        std::vector<DiskBackedStorage::LoggedPoint> chunk;
+        chunk.reserve(SummaryPyramid::BaseBucketSize);
+        DiskBackedStorage::ChainReader reader(m_backingStore, entry.log);
+        DiskBackedStorage::LoggedPoint point;
+        for (uint64_t i = 0; reader.next(point); i++) {
+            if (i >= skip) {
+                points.append(QCPGraphData(point.key, point.value));
+            }
+            chunk.push_back(point);
+            if (chunk.size() == chunk.capacity()) {
+                entry.log.summary.append(chunk.data(), chunk.size());
+                chunk.clear();
+            }
+        }
+        entry.log.summary.append(chunk.data(), chunk.size());
+        entry.data->set(points, true);
+    }
+    m_interruptedCapture.clear();
+}
+
+void WorkspaceModel::discardInterruptedCapture() {
+    m_interruptedCapture.clear();
+    m_backingStore.clearStorage();
+}
+
 /***************************************** INTERNAL UTILS *****************************************/
 
 void WorkspaceModel::refreshExpressionBytecodes(bool updateAcquisition) {
@@ -477,6 +750,185 @@ failAndTemporarilyDisable:
     return false;
 }
 
+std::chrono::milliseconds WorkspaceModel::getAcquisitionBufferHeadroom() const {
+    QSettings settings;
+    bool isOk = false;
+    auto value = settings.value("Acquisition/BufferHeadroom", 500).toInt(&isOk);
+    if (!isOk || value <= 0) {
+        value = 500;
+    }
+    return std::chrono::milliseconds(value);
+}
+
+size_t WorkspaceModel::getInMemoryPointLimit() const {
+    QSettings settings;
+    bool isOk = false;
+    auto value = settings.value("Acquisition/InMemoryPointLimit", 1 << 21).toULongLong(&isOk);
+    return isOk ? size_t(value) : size_t(1 << 21);
+}
+
+DiskBackedStorage::RetentionMode WorkspaceModel::getRetentionMode() const {
+    QSettings settings;
+    auto value = settings.value("CacheFile/RetentionMode", "StopWhenFull").toString();
+    return value == "KeepLatest" ? DiskBackedStorage::RetentionMode::KeepLatest
+                                 : DiskBackedStorage::RetentionMode::StopWhenFull;
+}
+
+Result<void, DiskBackedStorage::Error> WorkspaceModel::logAcquiredData(WatchEntry &entry, size_t entryId,
+                                                                       const QVector<QCPGraphData> &data) {
+    auto points = data.constData();
+    auto remaining = size_t(data.size());
+    while (true) {
+        auto loggedBefore = entry.log.pointCount;
+        auto result = m_backingStore.appendToChain(entry.log, entryId, points, remaining);
+        if (result.isOk() || result.unwrapErr() != DiskBackedStorage::Error::DataStorageFull ||
+            m_retentionMode != DiskBackedStorage::RetentionMode::KeepLatest) {
+            return result;
+        }
+
+        // Whatever fit has been logged, make room for the rest
+        auto logged = entry.log.pointCount - loggedBefore;
+        points += logged;
+        remaining -= logged;
+
+        std::vector<DiskBackedStorage::BlockChain *> chains;
+        for (auto &i : m_watchEntries) {
+            chains.push_back(&i.log);
+        }
+        if (!m_backingStore.recycleOldestBlock(chains)) {
+            return result;
+        }
+    }
+}
+
+void WorkspaceModel::takeLoggedPages() {
+    for (auto &result : m_backingStore.takeReadResults()) {
+        auto entry = std::find_if(m_watchEntries.begin(), m_watchEntries.end(),
+                                  [&](const WatchEntry &i) { return i.pendingPageTag == result.tag; });
+        if (entry == m_watchEntries.end()) {
+            continue; // Superseded by a newer read, or the entry is gone
+        }
+        entry->pendingPageTag = 0;
+        if (!result.isComplete) {
+            continue; // Blocks were recycled under it, the next request reads what's left
+        }
+
+        QVector<QCPGraphData> points;
+        points.reserve(result.points.size());
+        for (auto &point : result.points) {
+            points.append(QCPGraphData(point.key, point.value));
+        }
+        if (!entry->pageData) {
+            entry->pageData.reset(new QCPGraphDataContainer);
+        }
+        entry->pageData->set(points, true);
+        entry->page = entry->pendingPage;
+        emit watchEntryLoggedPointsRead(entry.key());
+    }
+}
+
+void WorkspaceModel::updateCaptureExport() {
+    if (!m_captureExporter) {
+        return; // Already cleaned up after, this is a notification that came in late
+    }
+    emit captureExportProgress(m_captureExporter->writtenPointCount(), m_captureExporter->totalPointCount());
+    if (!m_captureExporter->isFinished()) {
+        return;
+    }
+
+    auto result = m_captureExporter->result();
+    m_captureExporter.reset();
+    if (result.isOk()) {
+        emit captureExportFinished(true, {});
+    } else {
+        emit captureExportFinished(false, CaptureExporter::errorString(result.unwrapErr()));
+    }
+}
+
+QSharedPointer<QCPGraphDataContainer>
+    WorkspaceModel::getCaptureFilePoints(WatchEntry &entry, double lower, double upper) {
+    auto &channel = entry.capture->channels()[entry.captureChannel];
+    if (entry.pageData && entry.page.covers(lower, upper, channel.pointCount)) {
+        return entry.pageData;
+    }
+
+    // Read half a view more on both sides, as for the cache file. The points are only paged in from the file.
+    auto margin = (upper - lower) / 2;
+    entry.page = {lower - margin, upper + margin, channel.pointCount,
+                  channel.summary.isEmpty() ? 0 : channel.summary.lastKey()};
+    QVector<QCPGraphData> points;
+    for (auto &columns : entry.capture->pointsInRange(entry.captureChannel, entry.page.lower, entry.page.upper)) {
+        for (size_t i = 0; i < columns.keys.size(); i++) {
+            points.append(QCPGraphData(columns.keys[i], columns.values[i]));
+        }
+    }
+    if (!entry.pageData) {
+        entry.pageData.reset(new QCPGraphDataContainer);
+    }
+    entry.pageData->set(points, true);
+    return entry.pageData;
+}
+
+std::chrono::milliseconds WorkspaceModel::getCheckpointInterval() const {
+    QSettings settings;
+    bool isOk = false;
+    auto value = settings.value("CacheFile/CheckpointInterval", 5000).toInt(&isOk);
+    if (!isOk || value <= 0) {
+        value = 5000;
+    }
+    return std::chrono::milliseconds(value);
+}
+
+void WorkspaceModel::checkpointCapture() {
+    std::vector<DiskBackedStorage::CaptureChannel> channels;
+    for (auto [id, entry] : m_watchEntries.asKeyValueRange()) {
+        channels.push_back({id, entry.expression, entry.displayName, &entry.log});
+    }
+    m_backingStore.checkpoint(channels);
+    m_lastCheckpoint = AcquisitionBuffer::Clock::now();
+    m_checkpointPending = false;
+}
+
+AcquisitionBuffer::ChannelConfig WorkspaceModel::makeChannelConfig(const WatchEntry &entry,
+                                                                   std::chrono::milliseconds headroom) {
+    AcquisitionBuffer::ChannelConfig config;
+    config.capacity = AcquisitionBuffer::capacityForRate(entry.acquisitionFrequencyLimit, headroom);
+    config.overflowPolicy = entry.overflowPolicy;
+    if (entry.spillBlock) {
+        config.spillStorage = m_backingStore.blockFromSequenceNumber(entry.spillBlock.value());
+        config.spillStorageSize = m_backingStore.getStorageBlockSize();
+    }
+    return config;
+}
+
+void WorkspaceModel::configureAcquisitionChannels() {
+    // Acquisition isn't running, so no one is writing to the spill blocks of removed entries anymore
+    for (auto block : m_releasedSpillBlocks) {
+        m_backingStore.freeBlock(block);
+    }
+    m_releasedSpillBlocks.clear();
+
+    auto headroom = getAcquisitionBufferHeadroom();
+    for (auto [id, entry] : m_watchEntries.asKeyValueRange()) {
+        bool wantsSpill = entry.overflowPolicy == AcquisitionBuffer::OverflowPolicy::SpillToDisk;
+        if (wantsSpill && !entry.spillBlock) {
+            auto result = m_backingStore.allocateBlock();
+            if (result.isOk()) {
+                entry.spillBlock = result.unwrap();
+            } else {
+                qWarning() << "Cannot allocate spill block for watch entry" << id << "error" << int(result.unwrapErr())
+                           << "it will drop samples on overflow";
+            }
+        } else if (!wantsSpill && entry.spillBlock) {
+            m_backingStore.freeBlock(entry.spillBlock.value());
+            entry.spillBlock.reset();
+        }
+        m_acquisitionBuffer->reconfigureChannel(id, makeChannelConfig(entry, headroom));
+    }
+}
+
 void WorkspaceModel::sltAcquisitionFrequencyFeedbackArrived(size_t entryId) {
     m_watchEntryModel->notifyFrequencyFeedbackChanged(entryId);
+    // Feedback comes periodically during acquisition, which is also a good pace to refresh overflow counters
+    m_watchEntryModel->notifyOverflowCountChanged(entryId);
 }
@@ -5,17 +5,22 @@
 #include "acquisitionbufferchannel.h"
 #include "acquisitionhub.h"
 #include "atomic_queue/atomic_queue.h"
+#include "captureexporter.h"
+#include "capturefile.h"
 #include "diskbackedstorage.h"
 #include "expressionevaluator/bytecode.h"
 #include "models/watchentrymodel.h"
 #include "qcustomplot.h"
 #include "result.h"
+#include "sampleprocessor.h"
 #include "symbolbackend.h"
 #include <QColor>
 #include <QMap>
 #include <QObject>
 #include <QSet>
+#include <QStringList>
 #include <QTreeWidgetItem>
+#include <optional>
 
 class ProbeLibHost;
 
@@ -41,15 +46,32 @@ public:
         InvalidPlotAreaId,
         InvalidWatchEntryProperty,
         InvalidWatchEntryPropertyValue,
+        CaptureExportInProgress,
+        CaptureExportOverwritesSource, ///< The destination is a capture file that's open
     };
     Q_ENUM(Error);
 
     using PlotAreas = QSet<size_t>;
+    /// @brief Range of logged points read back from the cache file, see getWatchEntryLoggedPoints().
+    struct LoggedPage {
+        double lower = 0;
+        double upper = 0;
+        uint64_t loggedCount = 0;  ///< Points logged when the read was requested
+        double lastLoggedKey = 0; ///< Key of the last of them, points logged later may be missing
+
+        bool covers(double lower, double upper, uint64_t loggedCount) const {
+            return this->lower <= lower && upper <= this->upper &&
+                   (upper < lastLoggedKey || loggedCount == this->loggedCount);
+        }
+    };
+
     struct WatchEntry {
         // Acquisition properties
         QString expression;
         QString displayName;
         int acquisitionFrequencyLimit;
+        AcquisitionBuffer::OverflowPolicy overflowPolicy;
+        std::optional<uint64_t> spillBlock; ///< Cache file block the spill ring lives in, if policy is SpillToDisk
 
         // Data processing properties
         double coefficient;
@@ -61,8 +83,19 @@ public:
         Qt::PenStyle plotStyle;
         // TODO: support scatter graph?
 
-        // Plot data (can be shared between multiple plots)
+        // Plot data (can be shared between multiple plots). Only the newest points are kept in memory, everything
+        // acquired is logged in the cache file.
         QSharedPointer<QCPGraphDataContainer> data;
+        DiskBackedStorage::BlockChain log;
+        std::shared_ptr<const CaptureFile> capture; ///< Holds the logged points instead of log, if opened from a file
+        size_t captureChannel = 0;                  ///< Channel of the entry in capture
+
+        // Logged points read back for a view beyond what's in memory. Only one range is kept, so memory use doesn't
+        // grow with how much is logged.
+        QSharedPointer<QCPGraphDataContainer> pageData; ///< Points in page, null until a read has finished
+        LoggedPage page;
+        LoggedPage pendingPage;
+        uint64_t pendingPageTag = 0; ///< Tag of the read of pendingPage in progress, 0 for none
 
         // Expression evaluation misc
         std::optional<ExpressionEvaluator::Bytecode> exprBytecode;            ///< Raw bytecode from parser
@@ -108,6 +141,17 @@ public:
      */
     IAcquisitionBufferChannel::p const getAcquisitionBufferChannel() { return m_acquisitionBuffer; }
 
+    /**
+     * @brief Get the acquisition buffer itself, for those who need channel statistics (overflow counts etc.)
+     * @return AcquisitionBuffer*
+     */
+    AcquisitionBuffer *getAcquisitionBuffer() const { return m_acquisitionBuffer.get(); }
+
+    /**
+     * @brief Get the timepoint the current (or last) acquisition started at. Graph data keys are relative to this.
+     */
+    AcquisitionBuffer::Timepoint getAcquisitionStartTime() const { return m_acquisitionStartTime; }
+
     /**
      * @brief Get the Watch entry Qt model wrapper, when the UI part appropriately needs it
      * @return WatchEntryModel*
@@ -173,6 +217,34 @@ public:
      */
     Result<QSharedPointer<QCPGraphDataContainer>, Error> getWatchEntryDataContainer(size_t entryId);
 
+    /**
+     * @brief Get the min/max summary of what a watch entry has logged, including what's no longer in its data
+     * container. Recycled blocks are left out, though the first bucket of each level may still begin in one. Only
+     * valid until the next call into WorkspaceModel.
+     * @param entryId Watch entry ID.
+     * @return On success: summary. On fail: error code.
+     */
+    Result<const SummaryPyramid *, Error> getWatchEntrySummary(size_t entryId);
+
+    /**
+     * @brief Get the keys of the first and last points a watch entry has logged and still keeps.
+     * @param entryId Watch entry ID.
+     * @return On success: key range, or nothing if the entry hasn't logged anything. On fail: error code.
+     */
+    Result<std::optional<QCPRange>, Error> getWatchEntryLoggedRange(size_t entryId);
+
+    /**
+     * @brief Get the points a watch entry has logged with keys in [lower, upper], including what's no longer in its
+     * data container. They're read from the cache file in the background: until then, nothing is returned, and
+     * watchEntryLoggedPointsRead() is emitted once they're in. Some points around the range are read too. Points of an
+     * entry opened from a capture file are returned right away.
+     * @param entryId Watch entry ID.
+     * @return On success: container with at least the points in range, or null while they're being read. On fail:
+     * error code.
+     */
+    Result<QSharedPointer<QCPGraphDataContainer>, Error> getWatchEntryLoggedPoints(size_t entryId, double lower,
+                                                                                   double upper);
+
     /**
      * @brief Get a specific property of a watch entry's graph. WatchEntryModel and UI side both uses this.
      * @param entryId Watch entry ID.
@@ -192,9 +264,10 @@ public:
 
     /**
      * @brief This function is called periodically by UI when acquisition is active, used to notify the backend to pull
-     * buffered data from the buffer channels and append them to each watch entry's graph data container.
-     * @return Whether any data has been successfully fetched. This is used for the UI to determine when to stop the
-     * refresh timer after acquisition has been requested to stop.
+     * the graph data chunks prepared by the sample processor and append them to each watch entry's graph data
+     * container.
+     * @return Whether any data has been fetched, or more is still being processed. This is used for the UI to
+     * determine when to stop the refresh timer after acquisition has been requested to stop.
      */
     Q_SLOT bool pullBufferedAcquisitionData();
 
@@ -216,12 +289,56 @@ public:
     bool isAcquisitionActive() { return m_acquisitionHub->isAcquisitionActive(); }
 
     /**
-     * @brief Save acquisition data to CSV file into the file name provided.
+     * @brief CPU time consumed by the acquisition thread so far. Used for profiling.
+     */
+    std::chrono::nanoseconds getAcquisitionThreadCpuTime() { return m_acquisitionHub->acquisitionThreadCpuTime(); }
+
+    /**
+     * @brief CPU time consumed by the sample processing thread so far. Used for profiling.
+     */
+    std::chrono::nanoseconds getSampleProcessingThreadCpuTime() { return m_sampleProcessor->processingThreadCpuTime(); }
+
+    /**
+     * @brief Export acquisition data to a file in the background. Data is read from the cache file logs, so everything
+     * logged so far is exported, not only what's held in memory; acquisition may go on meanwhile. Progress is reported
+     * with captureExportProgress(), and captureExportFinished() is emitted at the end. Only one export runs at a time.
+     * Entries opened from a capture file are exported from that file, which therefore can't be the destination.
      *
-     * @param fileName destination CSV file name.
+     * @param fileName destination file name.
+     * @param format see CaptureExporter.
+     * @param lower, upper Only points with keys in this range are exported.
      * @return On success: nothing. On error: an error code.
      */
-    Result<void, Error> saveAcquisitionData(QString fileName);
+    Result<void, Error> exportCapture(QString fileName, CaptureExporter::Format format,
+                                      double lower = -std::numeric_limits<double>::infinity(),
+                                      double upper = std::numeric_limits<double>::infinity());
+    /// @brief Stop the running export, if any. The partly written file is removed.
+    void cancelCaptureExport();
+    bool isExportingCapture() const { return m_captureExporter != nullptr; }
+
+    /**
+     * @brief Open a capture exported to a .psrec file, adding a watch entry for each of its channels, with its plot
+     * settings and its points. Points stay in the file and are only read as they're plotted, so it's quick however
+     * large the file. They're replaced when acquisition starts. Not to be called during acquisition.
+     * @param fileName .psrec file name.
+     * @return On success: nothing. On fail: error code of CaptureFile.
+     */
+    Result<void, CaptureFile::Error> openCaptureFile(QString fileName);
+
+    /**
+     * @brief Whether the cache file holds a capture left by a session that didn't exit properly. It's found at
+     * startup, and kept until it's recovered or discarded.
+     */
+    bool hasInterruptedCapture() const { return !m_interruptedCapture.empty(); }
+    /// @brief Display names of the watch entries in the interrupted capture.
+    QStringList getInterruptedCaptureNames() const;
+    /**
+     * @brief Add a watch entry for each channel of the interrupted capture, with its logged data. The newest points
+     * are loaded into memory, the rest stay in the cache file and can be saved as usual.
+     */
+    void recoverInterruptedCapture();
+    /// @brief Throw away the interrupted capture and start with an empty cache file.
+    void discardInterruptedCapture();
 
 private:
     size_t getNextPlotAreaId() { return m_maxPlotAreaId++; }
@@ -233,6 +350,35 @@ private:
     void refreshExpressionBytecodes(bool updateAcquisition = false);
     bool refreshExpressionBytecodes(size_t entryId, bool updateAcquisition = false);
 
+    /// @brief How long the acquisition buffer should be able to hold samples for when nobody drains it.
+    std::chrono::milliseconds getAcquisitionBufferHeadroom() const;
+    /// @brief How many of the newest points each graph data container keeps in memory during acquisition.
+    size_t getInMemoryPointLimit() const;
+    /// @brief What to do when the cache file is full, "StopWhenFull" or "KeepLatest".
+    DiskBackedStorage::RetentionMode getRetentionMode() const;
+    /// @brief How often what's logged is made recoverable in case of a crash.
+    std::chrono::milliseconds getCheckpointInterval() const;
+    /// @brief Record the watch entries and their logs in the cache file, see DiskBackedStorage::checkpoint().
+    void checkpointCapture();
+    /**
+     * @brief Append a chunk to an entry's log. In KeepLatest retention mode, the oldest blocks of all entries are
+     * recycled as needed when the cache file is full.
+     */
+    Result<void, DiskBackedStorage::Error> logAcquiredData(WatchEntry &entry, size_t entryId,
+                                                          const QVector<QCPGraphData> &data);
+    AcquisitionBuffer::ChannelConfig makeChannelConfig(const WatchEntry &entry, std::chrono::milliseconds headroom);
+    /**
+     * @brief Size every acquisition buffer channel for its entry's frequency limit, and (re)assign spill blocks. This
+     * resets the channels, so it's only done right before acquisition starts.
+     */
+    void configureAcquisitionChannels();
+    /// @brief Take the results of reads requested by getWatchEntryLoggedPoints().
+    void takeLoggedPages();
+    /// @brief Points of an entry opened from a capture file, see getWatchEntryLoggedPoints().
+    QSharedPointer<QCPGraphDataContainer> getCaptureFilePoints(WatchEntry &entry, double lower, double upper);
+    /// @brief Report progress of the running export, and clean up after it once it's finished.
+    void updateCaptureExport();
+
 private slots:
     void sltAcquisitionFrequencyFeedbackArrived(size_t entryId);
 
@@ -254,7 +400,18 @@ private:
     std::vector<QColor> m_defaultPlotColors;             ///< Default plot colors assigned based on watch entry ID
 
     std::shared_ptr<AcquisitionBuffer> m_acquisitionBuffer; ///< In-memory data buffer between acquisition thread and UI
+    std::unique_ptr<SampleProcessor> m_sampleProcessor;     ///< Converts buffered samples into graph data chunks
     DiskBackedStorage m_backingStore;                       ///< Disk backed storage for data logging.
+    std::vector<uint64_t> m_releasedSpillBlocks; ///< Spill blocks the acquisition thread may still write to until stop
+    size_t m_inMemoryPointLimit = 0; ///< Points each graph data container keeps in memory, 0 for no limit
+    DiskBackedStorage::RetentionMode m_retentionMode = DiskBackedStorage::RetentionMode::StopWhenFull;
+    std::vector<DiskBackedStorage::RecoveredChannel> m_interruptedCapture; ///< Found in the cache file at startup
+    std::chrono::milliseconds m_checkpointInterval{5000};
+    AcquisitionBuffer::Timepoint m_lastCheckpoint; ///< When checkpointCapture() was last called
+    bool m_checkpointPending = false;              ///< Whether anything has been logged since then
+    bool m_cacheStorageFull = false;  ///< Set when logging failed for lack of space, until the next acquisition
+    uint64_t m_lastPageReadTag = 0;   ///< Tags of reads of logged points, to match results with requests
+    std::unique_ptr<CaptureExporter> m_captureExporter; ///< Running export, reads m_backingStore
 
 signals:
     void requestAddPlotArea(size_t areaId);
@@ -265,6 +422,14 @@ signals:
     ///@brief This signal is emitted when plotting related properties are changed so that UI can update the plot.
     void plotPropertyChanged(size_t entryId, WatchEntryModel::Columns prop, QVariant data);
 
+    ///@brief Logged points asked for with getWatchEntryLoggedPoints() have been read.
+    void watchEntryLoggedPointsRead(size_t entryId);
+
+    ///@brief An export started with exportCapture() has made progress. Total is an estimate.
+    void captureExportProgress(uint64_t writtenPointCount, uint64_t totalPointCount);
+    ///@brief An export started with exportCapture() has finished, errorMessage tells why if it didn't succeed.
+    void captureExportFinished(bool succeeded, QString errorMessage);
+
     void feedbackAcquisitionStopped();
 };
 
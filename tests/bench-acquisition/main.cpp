@@ -0,0 +1,255 @@
+
+//
+// End-to-end acquisition benchmark. Drives AcquisitionHub -> AcquisitionBuffer -> WorkspaceModel headlessly against
+// the simulated probe, and reports throughput, latency, overflows and CPU usage. No window is ever shown, but
+// WorkspaceModel still needs a QApplication to exist; without a display, run with QT_QPA_PLATFORM=offscreen.
+//
+// Example:
+//   bench-acquisition -c target.json -s firmware.elf -n 32 -d 10 counter "sensor.raw"
+//
+
+#include "acquisitionbuffer.h"
+#include "probelib/iprobelib.h"
+#include "probelibhost.h"
+#include "utils.h"
+#include "workspacemodel.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QMetaEnum>
+#include <QTextStream>
+#include <QTimer>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static QTextStream &out() {
+    static QTextStream s(stdout);
+    return s;
+}
+
+static QTextStream &err() {
+    static QTextStream s(stderr);
+    return s;
+}
+
+/// @brief Nearest rank percentile. The samples must be sorted.
+static double Percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return NAN;
+    }
+    auto rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+static bool ConnectSimulatedProbe(ProbeLibHost *plh) {
+    for (auto probeLib : plh->probeLibs()) {
+        if (!probeLib) {
+            continue;
+        }
+        for (auto &probe : probeLib->availableProbes()) {
+            if (probe->serialNumber() != "SIM0") {
+                continue;
+            }
+            if (auto result = plh->selectProbe(probeLib, probe); result.isErr()) {
+                err() << result.unwrapErr() << Qt::endl;
+                return false;
+            }
+            plh->selectDevice(1);
+            if (auto result = plh->connect(); result.isErr()) {
+                err() << result.unwrapErr() << Qt::endl;
+                return false;
+            }
+            return true;
+        }
+    }
+    err() << "Simulated probe not found, is probelib-simprobe built into the probelibs directory?" << Qt::endl;
+    return false;
+}
+
+int main(int argc, char **argv) {
+    QApplication app(argc, argv);
+
+    // Same settings as the application, so cache file and acquisition settings apply here as well
+    app.setOrganizationName("RigoLigoRLC");
+    app.setOrganizationDomain("rigoligo.cc");
+    app.setApplicationName("ProbeScope");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("End-to-end acquisition benchmark against the simulated probe.");
+    parser.addHelpOption();
+    QCommandLineOption symbolFileOption({"s", "symbol-file"}, "ELF file with DWARF info to resolve expressions.",
+                                        "elf");
+    QCommandLineOption simConfigOption({"c", "sim-config"}, "Simulated target config (overrides environment).",
+                                       "json");
+    QCommandLineOption entriesOption({"n", "entries"}, "Number of watch entries, expressions are reused in turn.",
+                                     "count");
+    QCommandLineOption durationOption({"d", "duration"}, "Acquisition duration in seconds (default 10).", "seconds",
+                                      "10");
+    QCommandLineOption frequencyOption({"f", "frequency-limit"}, "Frequency limit of every entry, 0 is unlimited.",
+                                       "hz", "0");
+    QCommandLineOption pullIntervalOption({"p", "pull-interval"}, "Interval of pulling buffered data (default 16).",
+                                          "ms", "16");
+    QCommandLineOption overflowPolicyOption({"o", "overflow-policy"},
+                                            "Overflow policy of every entry: DropNewest, DropOldest, Decimate or "
+                                            "SpillToDisk (default).",
+                                            "policy", "SpillToDisk");
+    parser.addOptions({symbolFileOption, simConfigOption, entriesOption, durationOption, frequencyOption,
+                       pullIntervalOption, overflowPolicyOption});
+    parser.addPositionalArgument("expressions", "Watch expressions.", "expr...");
+    parser.process(app);
+
+    auto expressions = parser.positionalArguments();
+    if (!parser.isSet(symbolFileOption) || expressions.isEmpty()) {
+        parser.showHelp(1);
+    }
+    if (parser.isSet(simConfigOption)) {
+        qputenv("PROBESCOPE_SIMPROBE_CONFIG", parser.value(simConfigOption).toLocal8Bit());
+    }
+    auto entryCount = parser.isSet(entriesOption) ? parser.value(entriesOption).toInt() : int(expressions.size());
+    auto duration = std::chrono::duration<double>(parser.value(durationOption).toDouble());
+    auto frequencyLimit = parser.value(frequencyOption).toInt();
+    auto pullInterval = parser.value(pullIntervalOption).toInt();
+    bool policyOk = false;
+    auto overflowPolicy = QMetaEnum::fromType<AcquisitionBuffer::OverflowPolicy>().keyToValue(
+        parser.value(overflowPolicyOption).toLatin1(), &policyOk);
+    if (!policyOk) {
+        parser.showHelp(1);
+    }
+
+    WorkspaceModel workspace;
+    auto buffer = workspace.getAcquisitionBuffer();
+
+    if (!ConnectSimulatedProbe(workspace.getProbeLibHost())) {
+        return 1;
+    }
+
+    if (auto result = workspace.loadSymbolFile(parser.value(symbolFileOption)); result.isErr()) {
+        err() << "Cannot load symbol file, error" << int(result.unwrapErr()) << Qt::endl;
+        return 1;
+    }
+
+    // Add entries. Keep track of how far each graph data container has been inspected for latency measurement. That's
+    // by key, as pulling trims the oldest points off the containers once they hold more than the in-memory limit.
+    struct BenchEntry {
+        size_t entryId;
+        QSharedPointer<QCPGraphDataContainer> data;
+        double inspectedKey; ///< Key of the last point inspected
+    };
+    std::vector<BenchEntry> entries;
+    for (int i = 0; i < entryCount; i++) {
+        const auto &expression = expressions.at(i % expressions.size());
+        auto result = workspace.addWatchEntry(expression, {});
+        if (result.isErr()) {
+            err() << "Cannot add watch entry" << expression << Qt::endl;
+            return 1;
+        }
+        auto entryId = result.unwrap();
+        if (!workspace.getWatchEntryGraphProperty(entryId, WatchEntryModel::ExpressionOkay).unwrap().toBool()) {
+            err() << "Expression" << expression << "cannot be evaluated, check the symbol file" << Qt::endl;
+            return 1;
+        }
+        if (frequencyLimit) {
+            workspace.setWatchEntryGraphProperty(entryId, WatchEntryModel::FrequencyLimit, frequencyLimit);
+        }
+        workspace.setWatchEntryGraphProperty(entryId, WatchEntryModel::OverflowPolicy, overflowPolicy);
+        entries.push_back({entryId, workspace.getWatchEntryDataContainer(entryId).unwrap(), -INFINITY});
+    }
+
+    // Per-sample latency: time from the sample being taken until it's appended to its graph data container
+    std::vector<double> latenciesUs;
+    std::vector<double> pullDurationsUs;
+    size_t sampleCount = 0;
+    auto inspectNewSamples = [&](Clock::time_point pulledAt) {
+        auto pulledAtMs = AcquisitionBuffer::timepointToMillisecond(workspace.getAcquisitionStartTime(), pulledAt);
+        for (auto &entry : entries) {
+            auto it = std::upper_bound(entry.data->constBegin(), entry.data->constEnd(), entry.inspectedKey,
+                                       [](double key, const QCPGraphData &point) { return key < point.key; });
+            for (; it != entry.data->constEnd(); ++it) {
+                latenciesUs.push_back((pulledAtMs - it->key) * 1000.0);
+                sampleCount++;
+                entry.inspectedKey = it->key;
+            }
+        }
+    };
+
+    // Pull on a timer like the main window does. Once the hub has stopped and a pull comes back empty, everything
+    // acquired has been collected.
+    Clock::time_point startTime, stopTime;
+    bool stopRequested = false;
+    bool acquisitionStopped = false;
+    QTimer pullTimer;
+    pullTimer.setInterval(pullInterval);
+    QObject::connect(&pullTimer, &QTimer::timeout, [&]() {
+        auto pullStart = Clock::now();
+        auto pulled = workspace.pullBufferedAcquisitionData();
+        auto pullEnd = Clock::now();
+        pullDurationsUs.push_back(std::chrono::duration<double, std::micro>(pullEnd - pullStart).count());
+        inspectNewSamples(pullEnd);
+        if (!pulled && acquisitionStopped) {
+            app.quit();
+        }
+    });
+    QObject::connect(&workspace, &WorkspaceModel::feedbackAcquisitionStopped, [&]() {
+        if (!stopRequested) {
+            err() << "Acquisition stopped unexpectedly" << Qt::endl;
+            stopTime = Clock::now();
+        }
+        acquisitionStopped = true;
+    });
+    QTimer::singleShot(std::chrono::duration_cast<std::chrono::milliseconds>(duration), [&]() {
+        stopRequested = true;
+        stopTime = Clock::now();
+        workspace.notifyAcquisitionStopped();
+    });
+
+    auto mainCpuStart = ProbeScopeUtil::currentThreadCpuTime();
+    auto acquisitionCpuStart = workspace.getAcquisitionThreadCpuTime();
+    auto processingCpuStart = workspace.getSampleProcessingThreadCpuTime();
+    startTime = Clock::now();
+    workspace.notifyAcquisitionStarted();
+    pullTimer.start();
+
+    app.exec();
+
+    auto mainCpu = ProbeScopeUtil::currentThreadCpuTime() - mainCpuStart;
+    auto acquisitionCpu = workspace.getAcquisitionThreadCpuTime() - acquisitionCpuStart;
+    auto processingCpu = workspace.getSampleProcessingThreadCpuTime() - processingCpuStart;
+    auto elapsed = std::chrono::duration<double>(stopTime - startTime).count();
+
+    size_t overflows = 0, spilled = 0;
+    for (auto &entry : entries) {
+        overflows += buffer->getChannelOverflowCount(entry.entryId);
+        spilled += buffer->getChannelSpilledCount(entry.entryId);
+    }
+
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+    std::sort(pullDurationsUs.begin(), pullDurationsUs.end());
+    auto cpuPercent = [&](std::chrono::nanoseconds cpu) {
+        return std::chrono::duration<double>(cpu).count() / elapsed * 100.0;
+    };
+
+    out() << QString("entries:            %1\n").arg(entries.size());
+    out() << QString("elapsed:            %1 s\n").arg(elapsed, 0, 'f', 3);
+    out() << QString("samples:            %1 (%2 samples/s)\n").arg(sampleCount).arg(sampleCount / elapsed, 0, 'f', 0);
+    out() << QString("overflows:          %1 (%2 spilled)\n").arg(overflows).arg(spilled);
+    out() << QString("latency p50/p90/p99/max: %1 / %2 / %3 / %4 us\n")
+                 .arg(Percentile(latenciesUs, 50), 0, 'f', 0)
+                 .arg(Percentile(latenciesUs, 90), 0, 'f', 0)
+                 .arg(Percentile(latenciesUs, 99), 0, 'f', 0)
+                 .arg(latenciesUs.empty() ? NAN : latenciesUs.back(), 0, 'f', 0);
+    out() << QString("pull p50/p99/max:   %1 / %2 / %3 us (%4 pulls)\n")
+                 .arg(Percentile(pullDurationsUs, 50), 0, 'f', 0)
+                 .arg(Percentile(pullDurationsUs, 99), 0, 'f', 0)
+                 .arg(pullDurationsUs.empty() ? NAN : pullDurationsUs.back(), 0, 'f', 0)
+                 .arg(pullDurationsUs.size());
+    out() << QString("cpu acquisition:    %1 %\n").arg(cpuPercent(acquisitionCpu), 0, 'f', 1);
+    out() << QString("cpu processing:     %1 %\n").arg(cpuPercent(processingCpu), 0, 'f', 1);
+    out() << QString("cpu main:           %1 %\n").arg(cpuPercent(mainCpu), 0, 'f', 1);
+    out().flush();
+
+    workspace.getProbeLibHost()->disconnect();
+    return stopRequested ? 0 : 1;
+}
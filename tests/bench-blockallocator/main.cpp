@@ -0,0 +1,64 @@
+
+//
+// Allocate/free patterns of DiskBackedStorage blocks. The argument is the number of blocks in the storage; each run
+// keeps it about half full.
+//
+
+#include "blockallocator.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <deque>
+#include <random>
+#include <vector>
+
+static void Prefill(BlockAllocator &allocator, std::mt19937_64 &rng, std::vector<uint64_t> &allocated) {
+    for (uint64_t i = 0; i < allocator.blockCount(); i++) {
+        allocated.push_back(allocator.allocate());
+    }
+    // Free a random half, so free blocks are scattered all over
+    std::shuffle(allocated.begin(), allocated.end(), rng);
+    for (auto i = allocated.size() / 2; i < allocated.size(); i++) {
+        allocator.free(allocated[i]);
+    }
+    allocated.resize(allocated.size() / 2);
+}
+
+// Free a random block, then allocate one
+static void BM_RandomFreeAllocate(benchmark::State &state) {
+    BlockAllocator allocator(state.range(0));
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> allocated;
+    Prefill(allocator, rng, allocated);
+
+    for (auto _ : state) {
+        auto &slot = allocated[rng() % allocated.size()];
+        allocator.free(slot);
+        slot = allocator.allocate();
+        benchmark::DoNotOptimize(slot);
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_RandomFreeAllocate)->Arg(1024)->Arg(16384)->Arg(262144);
+
+// Retention: many channels each free their oldest block and allocate a new one, round robin
+static void BM_RetentionRoundRobin(benchmark::State &state) {
+    constexpr size_t ChannelCount = 64;
+    BlockAllocator allocator(state.range(0));
+    std::vector<std::deque<uint64_t>> channels(ChannelCount);
+    for (uint64_t i = 0; i < allocator.blockCount() / 2; i++) {
+        channels[i % ChannelCount].push_back(allocator.allocate());
+    }
+
+    size_t channel = 0;
+    for (auto _ : state) {
+        auto &blocks = channels[channel];
+        allocator.free(blocks.front());
+        blocks.pop_front();
+        blocks.push_back(allocator.allocate());
+        channel = (channel + 1) % ChannelCount;
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_RetentionRoundRobin)->Arg(1024)->Arg(16384)->Arg(262144);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,78 @@
+#include "expressionevaluator/compiledbytecode.h"
+#include "expressionevaluator/executionstate.h"
+#include "expressionevaluator/opcodes.h"
+#include <benchmark/benchmark.h>
+#include <expressionevaluator/bytecode.h>
+#include <functional>
+
+using namespace ExpressionEvaluator;
+
+// A typical runtime bytecode after static optimization: a bitfield member behind a pointer. The memory access
+// instructions are answered with a fixed word so only the VM itself is measured.
+static Bytecode MakeBitfieldBehindPointer() {
+    Bytecode bc;
+    bc.pushInstruction(MetaLoadInt, {0x20000010});
+    bc.pushInstruction(Deref32, {});
+    bc.pushInstruction(MetaAddInt, {0x24});
+    bc.pushInstruction(Deref32, {});
+    bc.pushInstruction(LogicalShiftRight, {3});
+    bc.pushInstruction(MaskBitsSignExtend, {5});
+    bc.pushInstruction(ReturnI32, {});
+    return bc;
+}
+
+static constexpr size_t InstructionCount = 7;
+static constexpr uint64_t MemoryWord = 0x20000100;
+
+static Bytecode::ExecutionResult Runner(ExecutionState &es, Opcode op, Bytecode::ImmType imm) {
+    if (Bytecode::genericComputationExecutor(es, op, imm) == Bytecode::Continue) {
+        return Bytecode::Continue;
+    }
+    if (op >= Deref8 && op <= Deref64) {
+        es.stack.last() = MemoryWord;
+    }
+    return Bytecode::Continue;
+}
+
+// How the acquisition hub used to run bytecodes: the runner is type erased behind std::function
+static void BM_InterpretedStdFunction(benchmark::State &state) {
+    auto bc = MakeBitfieldBehindPointer();
+    ExecutionState es;
+    std::function<Bytecode::ExecutionResult(ExecutionState &, Opcode, Bytecode::ImmType)> runner = Runner;
+    for (auto _ : state) {
+        bc.execute(es, runner);
+        benchmark::DoNotOptimize(es.stack.data());
+    }
+    state.SetItemsProcessed(state.iterations() * InstructionCount);
+}
+BENCHMARK(BM_InterpretedStdFunction);
+
+static void BM_InterpretedTemplate(benchmark::State &state) {
+    auto bc = MakeBitfieldBehindPointer();
+    ExecutionState es;
+    for (auto _ : state) {
+        bc.execute(es, [](ExecutionState &es, Opcode op, Bytecode::ImmType imm) { return Runner(es, op, imm); });
+        benchmark::DoNotOptimize(es.stack.data());
+    }
+    state.SetItemsProcessed(state.iterations() * InstructionCount);
+}
+BENCHMARK(BM_InterpretedTemplate);
+
+static void BM_Compiled(benchmark::State &state) {
+    auto bc = MakeBitfieldBehindPointer();
+    auto cbc = CompiledBytecode::compile(bc).unwrap();
+    RuntimeState es;
+    for (auto _ : state) {
+        cbc.execute(es, [](RuntimeState &es, const CompiledInstruction &insn) {
+            if (insn.op >= Deref8 && insn.op <= Deref64) {
+                es.stack.last() = MemoryWord;
+            }
+            return Bytecode::Continue;
+        });
+        benchmark::DoNotOptimize(es.stack.data());
+    }
+    state.SetItemsProcessed(state.iterations() * InstructionCount);
+}
+BENCHMARK(BM_Compiled);
+
+BENCHMARK_MAIN();
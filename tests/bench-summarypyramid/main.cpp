@@ -0,0 +1,55 @@
+
+//
+// Building and querying the summary of a channel. Queries are what a plot does on each redraw: one column per pixel,
+// here 2000 of them, over the whole capture.
+//
+
+#include "summarypyramid.h"
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+struct Point {
+    double key;
+    double value;
+};
+
+// Append points in chunks the size of what's pulled from acquisition every frame
+static void BM_Append(benchmark::State &state) {
+    constexpr size_t ChunkSize = 4096;
+    std::vector<Point> chunk(ChunkSize);
+    std::mt19937_64 rng(1);
+    SummaryPyramid pyramid;
+    double key = 0;
+
+    for (auto _ : state) {
+        for (auto &point : chunk) {
+            point = {key++, double(rng() % 1000)};
+        }
+        pyramid.append(chunk.data(), chunk.size());
+    }
+    state.SetItemsProcessed(state.iterations() * ChunkSize);
+}
+BENCHMARK(BM_Append);
+
+// The argument is the number of points summarized. Only the summary is built, points are generated on the fly.
+static void BM_FullRangeColumns(benchmark::State &state) {
+    constexpr size_t ChunkSize = 1 << 16;
+    std::vector<Point> chunk(ChunkSize);
+    std::mt19937_64 rng(1);
+    SummaryPyramid pyramid;
+    for (int64_t i = 0; i < state.range(0); i += ChunkSize) {
+        for (size_t j = 0; j < ChunkSize; j++) {
+            chunk[j] = {double(i + j), double(rng() % 1000)};
+        }
+        pyramid.append(chunk.data(), chunk.size());
+    }
+
+    for (auto _ : state) {
+        auto columns = pyramid.columns(pyramid.firstKey(), pyramid.lastKey(), 2000);
+        benchmark::DoNotOptimize(columns.data());
+    }
+}
+BENCHMARK(BM_FullRangeColumns)->Arg(1 << 20)->Arg(1 << 26)->Arg(1 << 30)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,125 @@
+
+#include "blockallocator.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+std::vector<std::pair<uint64_t, uint64_t>> FreeRanges(const BlockAllocator &allocator) {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    allocator.forEachFreeRange([&](uint64_t first, uint64_t count) { ranges.push_back({first, count}); });
+    return ranges;
+}
+
+TEST(TestBlockAllocator, TestEmpty) {
+    BlockAllocator allocator;
+    EXPECT_EQ(allocator.allocate(), BlockAllocator::NoBlock);
+    EXPECT_FALSE(allocator.free(0));
+
+    allocator.reset(0);
+    EXPECT_EQ(allocator.lowestFree(), BlockAllocator::NoBlock);
+    EXPECT_EQ(allocator.allocate(), BlockAllocator::NoBlock);
+}
+
+TEST(TestBlockAllocator, TestAllocatesLowestFirst) {
+    // Sizes around word and level boundaries
+    for (uint64_t count : {1, 63, 64, 65, 4095, 4096, 4097, 300000}) {
+        BlockAllocator allocator(count);
+        for (uint64_t i = 0; i < count; i++) {
+            ASSERT_EQ(allocator.allocate(), i) << "of " << count;
+        }
+        EXPECT_EQ(allocator.allocate(), BlockAllocator::NoBlock);
+        EXPECT_EQ(allocator.allocatedCount(), count);
+        EXPECT_EQ(allocator.freeCount(), 0);
+        EXPECT_FALSE(allocator.free(count));
+
+        // A freed block is the first one handed out again
+        auto block = count / 2;
+        EXPECT_TRUE(allocator.free(block));
+        EXPECT_EQ(allocator.lowestFree(), block);
+        EXPECT_EQ(allocator.allocate(), block);
+    }
+}
+
+TEST(TestBlockAllocator, TestDoubleFree) {
+    BlockAllocator allocator(100);
+    auto block = allocator.allocate();
+    EXPECT_TRUE(allocator.isAllocated(block));
+    EXPECT_TRUE(allocator.free(block));
+    EXPECT_FALSE(allocator.isAllocated(block));
+    EXPECT_FALSE(allocator.free(block));
+    EXPECT_EQ(allocator.allocatedCount(), 0);
+}
+
+TEST(TestBlockAllocator, TestClaim) {
+    BlockAllocator allocator(200);
+    EXPECT_TRUE(allocator.claim(0));
+    EXPECT_TRUE(allocator.claim(130));
+    EXPECT_FALSE(allocator.claim(130));
+    EXPECT_FALSE(allocator.claim(200));
+    EXPECT_EQ(allocator.allocatedCount(), 2);
+
+    // Allocation goes around claimed blocks
+    for (uint64_t i = 1; i < 200; i++) {
+        if (i != 130) {
+            ASSERT_EQ(allocator.allocate(), i);
+        }
+    }
+    EXPECT_EQ(allocator.allocate(), BlockAllocator::NoBlock);
+}
+
+TEST(TestBlockAllocator, TestFreeRanges) {
+    BlockAllocator allocator(10);
+    EXPECT_EQ(FreeRanges(allocator), (std::vector<std::pair<uint64_t, uint64_t>>{{0, 10}}));
+
+    for (int i = 0; i < 10; i++) {
+        allocator.allocate();
+    }
+    allocator.free(7);
+    allocator.free(2);
+    allocator.free(3);
+    allocator.free(9);
+    EXPECT_EQ(FreeRanges(allocator), (std::vector<std::pair<uint64_t, uint64_t>>{{2, 2}, {7, 1}, {9, 1}}));
+
+    // Freeing the block in between joins both neighbours
+    allocator.free(8);
+    EXPECT_EQ(FreeRanges(allocator), (std::vector<std::pair<uint64_t, uint64_t>>{{2, 2}, {7, 3}}));
+}
+
+TEST(TestBlockAllocator, TestRandomAgainstSet) {
+    constexpr uint64_t count = 5000;
+    BlockAllocator allocator(count);
+    std::set<uint64_t> allocated;
+    std::mt19937_64 rng(1);
+
+    for (int i = 0; i < 100000; i++) {
+        // Lean towards allocating until nearly full, then towards freeing, to cover both ends
+        bool doAllocate = rng() % 100 < (allocated.size() < count * 9 / 10 ? 60 : 40);
+        if (doAllocate) {
+            auto block = allocator.allocate();
+            if (allocated.size() == count) {
+                ASSERT_EQ(block, BlockAllocator::NoBlock);
+                continue;
+            }
+            // Must be the lowest block not allocated
+            uint64_t expected = 0;
+            for (auto b : allocated) {
+                if (b != expected) {
+                    break;
+                }
+                expected++;
+            }
+            ASSERT_EQ(block, expected);
+            allocated.insert(block);
+        } else if (!allocated.empty()) {
+            auto it = allocated.lower_bound(rng() % count);
+            if (it == allocated.end()) {
+                it = allocated.begin();
+            }
+            ASSERT_TRUE(allocator.free(*it));
+            allocated.erase(it);
+        }
+        ASSERT_EQ(allocator.allocatedCount(), allocated.size());
+    }
+}
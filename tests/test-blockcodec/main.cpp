@@ -0,0 +1,149 @@
+
+#include "blockcodec.h"
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <vector>
+
+struct Point {
+    double key;
+    double value;
+};
+
+struct Encoded {
+    std::vector<uint64_t> payload;
+    uint64_t count;
+};
+
+/// Encode as many points as fit in a payload of the given size.
+Encoded Encode(const std::vector<Point> &points, size_t bytes = 1 << 20) {
+    Encoded encoded{std::vector<uint64_t>(bytes / 8), 0};
+    BlockEncoder encoder;
+    encoder.begin(reinterpret_cast<uint8_t *>(encoded.payload.data()), bytes);
+    for (auto &point : points) {
+        if (!encoder.append(point.key, point.value)) {
+            break;
+        }
+    }
+    encoded.count = encoder.count();
+    encoded.payload.resize(encoder.usedBytes() / 8);
+    return encoded;
+}
+
+std::vector<Point> Decode(const Encoded &encoded) {
+    std::vector<Point> points(encoded.count);
+    BlockDecoder decoder(reinterpret_cast<const uint8_t *>(encoded.payload.data()), encoded.count);
+    EXPECT_EQ(decoder.decode(points.data(), points.size()), encoded.count);
+    EXPECT_EQ(decoder.remaining(), 0);
+    return points;
+}
+
+/// Compare bits, so NaN and negative zero count.
+void ExpectSameBits(const std::vector<Point> &expected, const std::vector<Point> &actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(std::bit_cast<uint64_t>(expected[i].key), std::bit_cast<uint64_t>(actual[i].key)) << "at " << i;
+        ASSERT_EQ(std::bit_cast<uint64_t>(expected[i].value), std::bit_cast<uint64_t>(actual[i].value)) << "at " << i;
+    }
+}
+
+/// Keys the way the sample processor makes them: whole microseconds, in milliseconds.
+double KeyFromUs(int64_t us) {
+    return double(us) / 1000.0;
+}
+
+TEST(TestBlockCodec, TestSlowIntegers) {
+    std::vector<Point> points;
+    std::mt19937_64 rng(1);
+    int64_t value = 1000;
+    for (int64_t i = 0; i < 100000; i++) {
+        value += int64_t(rng() % 7) - 3;
+        points.push_back({KeyFromUs(i * 100 + int64_t(rng() % 5)), double(value)});
+    }
+    auto encoded = Encode(points);
+    ExpectSameBits(points, Decode(encoded));
+    // Raw is 16 bytes per point
+    EXPECT_LT(encoded.payload.size() * 8, points.size() * 16 / 5);
+}
+
+TEST(TestBlockCodec, TestSlowFloats) {
+    std::vector<Point> points;
+    for (int64_t i = 0; i < 100000; i++) {
+        points.push_back({KeyFromUs(i * 250), float(std::sin(i * 0.001) * 3.3)});
+    }
+    auto encoded = Encode(points);
+    ExpectSameBits(points, Decode(encoded));
+    EXPECT_LT(encoded.payload.size() * 8, points.size() * 16 / 2);
+}
+
+TEST(TestBlockCodec, TestSpecialValues) {
+    constexpr auto inf = std::numeric_limits<double>::infinity();
+    constexpr auto nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> values = {0.0,  -0.0, 1.0,      -1.0,        nan, inf, -inf, 0x1p53, -0x1p53, 0x1p53 + 2,
+                                  1e300, 5e-324, 4294967296.0, -4294967296.0, 3.0, 3.0, 0.5, 7.0, -0.0, 0.0};
+    std::vector<Point> points;
+    for (size_t i = 0; i < values.size(); i++) {
+        points.push_back({KeyFromUs(int64_t(i)), values[i]});
+    }
+    ExpectSameBits(points, Decode(Encode(points)));
+}
+
+TEST(TestBlockCodec, TestIrregularKeys) {
+    // Jumps, going back in time, keys that aren't whole microseconds, and keys too large for microseconds
+    std::vector<double> keys = {0.0,    0.001, 0.002,  1000.0, 0.5,     1e-7, 0.0005, -3.0,
+                                1e15,   1e18,  -1e18,  1e300,  0.25,    0.25, 0.25,   123456789.123};
+    std::vector<Point> points;
+    for (size_t i = 0; i < keys.size(); i++) {
+        points.push_back({keys[i], double(i)});
+    }
+    ExpectSameBits(points, Decode(Encode(points)));
+}
+
+TEST(TestBlockCodec, TestRandomBits) {
+    std::vector<Point> points;
+    std::mt19937_64 rng(2);
+    for (int i = 0; i < 20000; i++) {
+        points.push_back({std::bit_cast<double>(rng()), std::bit_cast<double>(rng())});
+    }
+    ExpectSameBits(points, Decode(Encode(points)));
+}
+
+TEST(TestBlockCodec, TestFullBlock) {
+    // Worst case points must never write past the payload
+    constexpr size_t bytes = 4096;
+    std::vector<Point> points;
+    std::mt19937_64 rng(3);
+    for (int i = 0; i < 1000; i++) {
+        points.push_back({std::bit_cast<double>(rng()), std::bit_cast<double>(rng())});
+    }
+    auto encoded = Encode(points, bytes);
+    EXPECT_GT(encoded.count, 0);
+    EXPECT_LT(encoded.count, points.size());
+    EXPECT_LE(encoded.payload.size() * 8, bytes);
+    points.resize(encoded.count);
+    ExpectSameBits(points, Decode(encoded));
+}
+
+TEST(TestBlockCodec, TestEncoderRestart) {
+    std::vector<uint64_t> payload(512);
+    BlockEncoder encoder;
+    encoder.begin(reinterpret_cast<uint8_t *>(payload.data()), payload.size() * 8);
+    EXPECT_TRUE(encoder.append(1.0, 1.0));
+    EXPECT_TRUE(encoder.append(2.0, 2.0));
+
+    // Beginning again starts from a fresh state, regardless of what's left in the payload
+    encoder.begin(reinterpret_cast<uint8_t *>(payload.data()), payload.size() * 8);
+    EXPECT_TRUE(encoder.append(5.0, 9.0));
+    EXPECT_TRUE(encoder.append(6.0, 8.0));
+    EXPECT_EQ(encoder.count(), 2);
+
+    BlockDecoder decoder(reinterpret_cast<const uint8_t *>(payload.data()), encoder.count());
+    double key, value;
+    ASSERT_TRUE(decoder.next(key, value));
+    EXPECT_EQ(key, 5.0);
+    EXPECT_EQ(value, 9.0);
+    ASSERT_TRUE(decoder.next(key, value));
+    EXPECT_EQ(key, 6.0);
+    EXPECT_EQ(value, 8.0);
+    EXPECT_FALSE(decoder.next(key, value));
+}
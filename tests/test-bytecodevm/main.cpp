@@ -1,6 +1,9 @@
 
+#include "expressionevaluator/compiledbytecode.h"
 #include "expressionevaluator/executionstate.h"
 #include "expressionevaluator/opcodes.h"
+#include "expressionevaluator/staticread.h"
+#include <algorithm>
 #include <gtest/gtest.h>
 #include <expressionevaluator/bytecode.h>
 
@@ -12,6 +15,59 @@ uint64_t ExecuteForU64(Bytecode &bc) {
     return es.stack.back();
 }
 
+uint64_t ExecuteCompiledForU64(CompiledBytecode &cbc) {
+    RuntimeState es;
+    // Compiled bytecode breaks on the Return, the value is on top of stack
+    EXPECT_EQ(cbc.execute(es), Bytecode::MemAccess);
+    return es.stack.back();
+}
+
+/// @brief What a compiled bytecode did when run the way AcquisitionHub runs it.
+struct CompiledRun {
+    size_t derefCount = 0;
+    uint64_t address = 0; ///< Of the last Deref
+    size_t width = 0;
+    Opcode returnOp = Nop;
+    uint64_t result = 0;
+};
+
+/// @brief Run a compiled bytecode against memory where every read returns the low bytes of word.
+CompiledRun RunCompiledAgainst(const CompiledBytecode &cbc, uint64_t word) {
+    CompiledRun run;
+    RuntimeState rs;
+    cbc.execute(rs, [&](RuntimeState &rs, const CompiledInstruction &insn) {
+        if (insn.op >= Deref8 && insn.op <= Deref64) {
+            run.derefCount++;
+            run.address = rs.stack.last();
+            run.width = size_t(1) << (insn.op - Deref8);
+            rs.stack.last() = run.width == 8 ? word : word & ((1ull << (run.width * 8)) - 1);
+            return Bytecode::Continue;
+        }
+        run.returnOp = insn.op;
+        run.result = rs.stack.last();
+        return Bytecode::MemAccess;
+    });
+    return run;
+}
+
+/// @brief The static read must do what the compiled executor does, for words with all kinds of bit patterns.
+void ExpectStaticReadMatchesCompiled(Bytecode &bc, const StaticRead &staticRead) {
+    auto compiled = CompiledBytecode::compile(bc);
+    ASSERT_TRUE(compiled.isOk());
+    auto cbc = compiled.unwrap();
+    for (uint64_t word : {0x0ull, ~0x0ull, 0x8000000000000000ull, 0x5555555555555555ull, 0xaaaaaaaaaaaaaaaaull,
+                          0x0123456789abcdefull, 0xfedcba9876543210ull, 0x80ull, 0x8000ull, 0x80000000ull}) {
+        auto run = RunCompiledAgainst(cbc, word);
+        ASSERT_EQ(run.derefCount, 1);
+        EXPECT_EQ(run.address, staticRead.address);
+        EXPECT_EQ(run.width, staticRead.width);
+        EXPECT_EQ(run.returnOp, staticRead.returnOp);
+        // AcquisitionHub hands over the read zero extended to 64 bits
+        auto read = staticRead.width == 8 ? word : word & ((1ull << (staticRead.width * 8)) - 1);
+        EXPECT_EQ(staticRead.extract(read), run.result) << std::hex << "word " << word;
+    }
+}
+
 TEST(TestBytecodeVM, TestSignExtend) {
     Bytecode bc;
     bc.pushInstruction(MetaLoadInt, {0x4001});
@@ -20,6 +76,189 @@ TEST(TestBytecodeVM, TestSignExtend) {
     EXPECT_EQ(ExecuteForU64(bc), 0xffffffffffffc001);
 }
 
+TEST(TestBytecodeVM, TestCompiledMatchesInterpreted) {
+    Bytecode bc;
+    bc.pushInstruction(MetaLoadInt, {0x12345678});
+    bc.pushInstruction(MetaAddInt, {-0x78});
+    bc.pushInstruction(MetaMulInt, {3});
+    bc.pushInstruction(LogicalShiftRight, {4});
+    bc.pushInstruction(MaskBitsSignExtend, {12});
+    bc.pushInstruction(ReturnU64, {});
+
+    auto compiled = CompiledBytecode::compile(bc);
+    ASSERT_TRUE(compiled.isOk());
+    auto cbc = compiled.unwrap();
+    EXPECT_EQ(ExecuteCompiledForU64(cbc), ExecuteForU64(bc));
+}
+
+TEST(TestBytecodeVM, TestCompileRejectsSymbolicInstructions) {
+    Bytecode bc;
+    bc.pushInstruction(LoadBase, {QString("foo")});
+    bc.pushInstruction(ReturnAsBase, {});
+
+    EXPECT_TRUE(CompiledBytecode::compile(bc).isErr());
+}
+
+TEST(TestBytecodeVM, TestInterpreterStackGrows) {
+    // Right-nested constants, as in 1 + (2 + (3 + ...)), go deeper than a runtime stack can. The static passes run
+    // bytecode like this straight from the parser.
+    Bytecode bc;
+    const uint64_t count = RuntimeState::StackCapacity * 4;
+    for (uint64_t i = 1; i <= count; i++) {
+        bc.pushInstruction(MetaLoadInt, {qulonglong(i)});
+    }
+    for (uint64_t i = 1; i < count; i++) {
+        bc.pushInstruction(Add, {});
+    }
+    bc.pushInstruction(ReturnU64, {});
+
+    // Fold the constants like ConstantFolding does
+    ExecutionState es;
+    size_t maxDepth = 0;
+    bc.execute(es, [&](ExecutionState &es, Opcode op, Bytecode::ImmType imm) {
+        if (op == Add) {
+            auto a = es.stack.takeLast();
+            es.stack.back() += a;
+        } else if (op != ReturnU64) {
+            Bytecode::genericComputationExecutor(es, op, imm);
+        }
+        maxDepth = std::max<size_t>(maxDepth, es.stack.size());
+        return op == ReturnU64 ? Bytecode::MemAccess : Bytecode::Continue;
+    });
+    EXPECT_EQ(maxDepth, count);
+    EXPECT_EQ(es.stack.back(), count * (count + 1) / 2);
+
+    // It's still too deep to run at runtime
+    EXPECT_TRUE(CompiledBytecode::compile(bc).isErr());
+}
+
+TEST(TestBytecodeVM, TestCompileChecksStackDepth) {
+    Bytecode bc;
+    for (size_t i = 0; i <= RuntimeState::StackCapacity; i++) {
+        bc.pushInstruction(MetaLoadInt, {qulonglong(i)});
+    }
+    bc.pushInstruction(ReturnU64, {});
+    EXPECT_TRUE(CompiledBytecode::compile(bc).isErr());
+
+    Bytecode underflow;
+    underflow.pushInstruction(MetaLoadInt, {1});
+    underflow.pushInstruction(Add, {});
+    underflow.pushInstruction(ReturnU64, {});
+    EXPECT_TRUE(CompiledBytecode::compile(underflow).isErr());
+}
+
+TEST(TestBytecodeVM, TestStaticReadPlain) {
+    for (auto [deref, width, returnOp] : {std::tuple{Deref8, 1, ReturnU8}, std::tuple{Deref16, 2, ReturnI16},
+                                          std::tuple{Deref32, 4, ReturnF32}, std::tuple{Deref64, 8, ReturnU64}}) {
+        Bytecode bc;
+        bc.pushInstruction(MetaLoadInt, {qulonglong(0x20000010)});
+        bc.pushInstruction(deref, {});
+        bc.pushInstruction(returnOp, {});
+
+        auto staticRead = MatchStaticRead(bc);
+        ASSERT_TRUE(staticRead.has_value());
+        EXPECT_EQ(staticRead->address, 0x20000010);
+        EXPECT_EQ(staticRead->width, width);
+        EXPECT_EQ(staticRead->shift, 0);
+        EXPECT_EQ(staticRead->maskBits, 0);
+        EXPECT_EQ(staticRead->returnOp, returnOp);
+        ExpectStaticReadMatchesCompiled(bc, *staticRead);
+    }
+
+    // Addresses that need a 64-bit load
+    Bytecode bc;
+    bc.pushInstruction(MetaLoadInt, {qulonglong(0x1234567890)});
+    bc.pushInstruction(Deref32, {});
+    bc.pushInstruction(ReturnU32, {});
+    auto staticRead = MatchStaticRead(bc);
+    ASSERT_TRUE(staticRead.has_value());
+    EXPECT_EQ(staticRead->address, 0x1234567890);
+    ExpectStaticReadMatchesCompiled(bc, *staticRead);
+}
+
+TEST(TestBytecodeVM, TestStaticReadBitfield) {
+    // What StaticOptimize emits for bitfields: shift, then mask
+    for (auto [shift, bits, mask, returnOp] :
+         {std::tuple{3, 5, MaskBitsSignExtend, ReturnI8}, std::tuple{0, 1, MaskBitsZeroExtend, ReturnU8},
+          std::tuple{13, 19, MaskBitsZeroExtend, ReturnU32}, std::tuple{31, 1, MaskBitsSignExtend, ReturnI32}}) {
+        Bytecode bc;
+        bc.pushInstruction(MetaLoadInt, {qulonglong(0x40001000)});
+        bc.pushInstruction(Deref32, {});
+        bc.pushInstruction(LogicalShiftRight, {shift});
+        bc.pushInstruction(mask, {bits});
+        bc.pushInstruction(returnOp, {});
+
+        auto staticRead = MatchStaticRead(bc);
+        ASSERT_TRUE(staticRead.has_value());
+        EXPECT_EQ(staticRead->shift, shift);
+        EXPECT_EQ(staticRead->maskBits, bits);
+        EXPECT_EQ(staticRead->signExtend, mask == MaskBitsSignExtend);
+        ExpectStaticReadMatchesCompiled(bc, *staticRead);
+    }
+
+    // Either of shift and mask may be left out
+    Bytecode shiftOnly;
+    shiftOnly.pushInstruction(MetaLoadInt, {qulonglong(0x40001000)});
+    shiftOnly.pushInstruction(Deref16, {});
+    shiftOnly.pushInstruction(LogicalShiftRight, {4});
+    shiftOnly.pushInstruction(ReturnU16, {});
+    auto staticRead = MatchStaticRead(shiftOnly);
+    ASSERT_TRUE(staticRead.has_value());
+    ExpectStaticReadMatchesCompiled(shiftOnly, *staticRead);
+
+    Bytecode maskOnly;
+    maskOnly.pushInstruction(MetaLoadInt, {qulonglong(0x40001000)});
+    maskOnly.pushInstruction(Deref64, {});
+    maskOnly.pushInstruction(MaskBitsSignExtend, {40});
+    maskOnly.pushInstruction(ReturnI64, {});
+    staticRead = MatchStaticRead(maskOnly);
+    ASSERT_TRUE(staticRead.has_value());
+    ExpectStaticReadMatchesCompiled(maskOnly, *staticRead);
+}
+
+TEST(TestBytecodeVM, TestStaticReadRejects) {
+    auto build = [](std::initializer_list<std::pair<Opcode, std::optional<QVariant>>> instructions) {
+        Bytecode bc;
+        for (auto &[op, imm] : instructions) {
+            bc.pushInstruction(op, imm);
+        }
+        return bc;
+    };
+    auto none = std::nullopt;
+    QVariant address = qulonglong(0x20000010);
+
+    // Pointer chasing: *p, and p->member
+    auto deref = build({{MetaLoadInt, address}, {Deref32, none}, {Deref32, none}, {ReturnU32, none}});
+    auto member = build(
+        {{MetaLoadInt, address}, {Deref32, none}, {MetaAddInt, QVariant(8)}, {Deref16, none}, {ReturnU16, none}});
+    // Arithmetic after the read
+    auto add = build({{MetaLoadInt, address}, {Deref32, none}, {MetaAddInt, QVariant(1)}, {ReturnU32, none}});
+    auto mul = build({{MetaLoadInt, address}, {Deref32, none}, {MetaMulInt, QVariant(3)}, {ReturnU32, none}});
+    // Out of order bitfield extraction
+    auto maskThenShift = build({{MetaLoadInt, address},
+                                {Deref32, none},
+                                {MaskBitsZeroExtend, QVariant(4)},
+                                {LogicalShiftRight, QVariant(2)},
+                                {ReturnU32, none}});
+    // No read at all, no return, or something after the return
+    auto constant = build({{MetaLoadInt, address}, {ReturnU32, none}});
+    auto noReturn = build({{MetaLoadInt, address}, {Deref32, none}});
+    auto trailing = build({{MetaLoadInt, address}, {Deref32, none}, {ReturnU32, none}, {ReturnU32, none}});
+    // Symbolic instructions are left for StaticOptimize
+    auto symbolic = build({{LoadBase, QVariant(QString("foo"))}, {BaseEval, none}, {ReturnAsBase, none}});
+
+    for (auto *bc : {&deref, &member, &add, &mul, &maskThenShift, &constant, &noReturn, &trailing, &symbolic}) {
+        EXPECT_FALSE(MatchStaticRead(*bc).has_value()) << bc->disassemble().toStdString();
+    }
+
+    // The pointer chasing ones still run through the VM, and read twice
+    for (auto *bc : {&deref, &member}) {
+        auto compiled = CompiledBytecode::compile(*bc);
+        ASSERT_TRUE(compiled.isOk());
+        EXPECT_EQ(RunCompiledAgainst(compiled.unwrap(), 0x20000100).derefCount, 2);
+    }
+}
+
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,247 @@
+#include "diskbackedstorage.h"
+#include <QFile>
+#include <bit>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+using LoggedPoint = DiskBackedStorage::LoggedPoint;
+
+static const QString CaptureFileName = "test-diskbackedstorage.cache";
+static const QString SavedCaptureFileName = "test-diskbackedstorage-saved.cache";
+static const QString RecoveryFileName = "test-diskbackedstorage-recovery.cache";
+static constexpr uint64_t BlockCountLimit = 64;
+
+// Where things are in block 0, see DiskBackedStorage::Superblock. Each half holds a copy, the channel table right
+// after the 56 bytes of the superblock itself.
+static constexpr qint64 SuperblockSequenceOffset = 16;
+static constexpr qint64 SuperblockTableOffset = 56;
+
+/// @brief A capture left behind by a session that didn't exit properly, with the chains as they were.
+struct Capture {
+    std::vector<LoggedPoint> points[2];
+    uint64_t durableCounts[2];     ///< Points of each chain at the last checkpoint
+    uint64_t durableTailCounts[2]; ///< Of them, those in the last block
+    uint64_t tailBlocks[2];
+    size_t blockCounts[2];
+};
+
+const Capture &GetCapture() {
+    static Capture capture = []() {
+        Capture capture;
+        std::mt19937_64 rng(42);
+        for (size_t i = 0; i < 300200; i++) {
+            capture.points[0].push_back({i * 0.1, double(i % 1000)});
+            capture.points[1].push_back({i * 0.25, std::bit_cast<double>(rng())});
+        }
+
+        DiskBackedStorage storage;
+        storage.setFileName(CaptureFileName);
+        storage.open(QIODevice::ReadWrite);
+        storage.setBlockCountLimit(BlockCountLimit);
+        storage.clearStorage();
+        storage.beginCapture();
+
+        DiskBackedStorage::BlockChain chains[2];
+        std::vector<DiskBackedStorage::CaptureChannel> channels{{7, "counter", "Old name", &chains[0]},
+                                                                {9, "noise[2]", "Noise", &chains[1]}};
+        auto append = [&](size_t first, size_t count) {
+            for (int c = 0; c < 2; c++) {
+                EXPECT_TRUE(
+                    storage.appendToChain(chains[c], channels[c].watchEntryId, &capture.points[c][first], count).isOk());
+            }
+        };
+        for (size_t i = 0; i < 300000; i += 1000) {
+            append(i, 1000);
+            if (i == 150000) {
+                storage.checkpoint(channels);
+            }
+        }
+
+        // Only the newer copy of the superblock has the new name
+        channels[0].displayName = "New name";
+        storage.checkpoint(channels);
+        for (int c = 0; c < 2; c++) {
+            capture.durableCounts[c] = chains[c].pointCount;
+            capture.durableTailCounts[c] = chains[c].encoder.count();
+            capture.tailBlocks[c] = chains[c].blocks.back();
+            capture.blockCounts[c] = chains[c].blocks.size();
+        }
+        append(300000, 200);
+        for (int c = 0; c < 2; c++) {
+            EXPECT_EQ(chains[c].blocks.size(), capture.blockCounts[c]) << "The tail must not fill up after the checkpoint";
+        }
+
+        // What's logged after the last checkpoint is lost. The file is copied before the storage deletes it.
+        QFile::remove(SavedCaptureFileName);
+        EXPECT_TRUE(QFile::copy(CaptureFileName, SavedCaptureFileName));
+        return capture;
+    }();
+    return capture;
+}
+
+/// @brief Put a fresh copy of the capture file in place for recovery.
+void CopyCapture() {
+    GetCapture();
+    QFile::remove(RecoveryFileName);
+    ASSERT_TRUE(QFile::copy(SavedCaptureFileName, RecoveryFileName));
+}
+
+void FlipByte(qint64 offset) {
+    QFile file(RecoveryFileName);
+    ASSERT_TRUE(file.open(QIODevice::ReadWrite));
+    char byte;
+    ASSERT_TRUE(file.seek(offset));
+    ASSERT_EQ(file.read(&byte, 1), 1);
+    byte ^= 0x5a;
+    ASSERT_TRUE(file.seek(offset));
+    ASSERT_EQ(file.write(&byte, 1), 1);
+}
+
+/// @brief Offset of the copy of the superblock that was written last.
+qint64 NewerSuperblockCopy(uint64_t blockSize) {
+    QFile file(RecoveryFileName);
+    EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+    uint64_t sequences[2];
+    for (int i = 0; i < 2; i++) {
+        file.seek(i * blockSize / 2 + SuperblockSequenceOffset);
+        file.read(reinterpret_cast<char *>(&sequences[i]), sizeof(uint64_t));
+    }
+    return sequences[1] > sequences[0] ? blockSize / 2 : 0;
+}
+
+void OpenRecoveryFile(DiskBackedStorage &storage) {
+    storage.setFileName(RecoveryFileName);
+    storage.open(QIODevice::ReadWrite);
+    storage.setBlockCountLimit(BlockCountLimit);
+}
+
+const DiskBackedStorage::RecoveredChannel *FindChannel(const std::vector<DiskBackedStorage::RecoveredChannel> &channels,
+                                                       uint64_t watchEntryId) {
+    for (auto &channel : channels) {
+        if (channel.channel.watchEntryId == watchEntryId) {
+            return &channel;
+        }
+    }
+    return nullptr;
+}
+
+/// @brief The chain holds the first count points, bit for bit.
+void ExpectPoints(DiskBackedStorage &storage, const DiskBackedStorage::BlockChain &chain,
+                  const std::vector<LoggedPoint> &points, uint64_t count) {
+    EXPECT_EQ(chain.pointCount, count);
+    DiskBackedStorage::ChainReader reader(storage, chain);
+    LoggedPoint point;
+    uint64_t i = 0;
+    while (reader.next(point)) {
+        ASSERT_LT(i, count);
+        ASSERT_EQ(point.key, points[i].key) << "at " << i;
+        ASSERT_EQ(std::bit_cast<uint64_t>(point.value), std::bit_cast<uint64_t>(points[i].value)) << "at " << i;
+        i++;
+    }
+    EXPECT_EQ(i, count);
+}
+
+TEST(TestDiskBackedStorage, TestRecoverCapture) {
+    CopyCapture();
+    auto &capture = GetCapture();
+    DiskBackedStorage storage;
+    OpenRecoveryFile(storage);
+    auto recovered = storage.recoverCapture();
+    ASSERT_EQ(recovered.size(), 2);
+
+    auto counter = FindChannel(recovered, 7), noise = FindChannel(recovered, 9);
+    ASSERT_TRUE(counter && noise);
+    EXPECT_EQ(counter->channel.expression, QString("counter"));
+    EXPECT_EQ(counter->channel.displayName, QString("New name"));
+    EXPECT_EQ(noise->channel.expression, QString("noise[2]"));
+    EXPECT_EQ(noise->chain.blocks.size(), capture.blockCounts[1]);
+    ExpectPoints(storage, counter->chain, capture.points[0], capture.durableCounts[0]);
+    ExpectPoints(storage, noise->chain, capture.points[1], capture.durableCounts[1]);
+
+    // Recovered blocks stay allocated
+    DiskBackedStorage::BlockChain chain;
+    ASSERT_TRUE(storage.appendToChain(chain, 1, capture.points[0].data(), 1000).isOk());
+    for (auto &channel : recovered) {
+        for (auto block : channel.chain.blocks) {
+            EXPECT_NE(block, chain.blocks.front());
+        }
+    }
+}
+
+TEST(TestDiskBackedStorage, TestDamagedNewerSuperblock) {
+    // As if writing the newer copy was cut short: the older one is used, and the blocks are recovered all the same
+    CopyCapture();
+    auto &capture = GetCapture();
+    DiskBackedStorage storage;
+    FlipByte(NewerSuperblockCopy(storage.getStorageBlockSize()) + SuperblockTableOffset + 8);
+    OpenRecoveryFile(storage);
+    auto recovered = storage.recoverCapture();
+    ASSERT_EQ(recovered.size(), 2);
+
+    auto counter = FindChannel(recovered, 7);
+    ASSERT_TRUE(counter);
+    EXPECT_EQ(counter->channel.displayName, QString("Old name"));
+    ExpectPoints(storage, counter->chain, capture.points[0], capture.durableCounts[0]);
+}
+
+TEST(TestDiskBackedStorage, TestDamagedBothSuperblocks) {
+    CopyCapture();
+    DiskBackedStorage storage;
+    auto blockSize = storage.getStorageBlockSize();
+    FlipByte(0);
+    FlipByte(blockSize / 2 + SuperblockSequenceOffset);
+    OpenRecoveryFile(storage);
+    EXPECT_TRUE(storage.recoverCapture().empty());
+}
+
+TEST(TestDiskBackedStorage, TestDamagedTail) {
+    // The last block of a chain is dropped when its payload doesn't check out, the rest of the chain is kept
+    CopyCapture();
+    auto &capture = GetCapture();
+    DiskBackedStorage storage;
+    auto blockSize = storage.getStorageBlockSize();
+    ASSERT_GT(capture.durableTailCounts[1], 1000);
+    FlipByte(capture.tailBlocks[1] * blockSize + 4096);
+    OpenRecoveryFile(storage);
+    auto recovered = storage.recoverCapture();
+    ASSERT_EQ(recovered.size(), 2);
+
+    auto counter = FindChannel(recovered, 7), noise = FindChannel(recovered, 9);
+    ASSERT_TRUE(counter && noise);
+    ExpectPoints(storage, counter->chain, capture.points[0], capture.durableCounts[0]);
+    EXPECT_EQ(noise->chain.blocks.size(), capture.blockCounts[1] - 1);
+    ExpectPoints(storage, noise->chain, capture.points[1], capture.durableCounts[1] - capture.durableTailCounts[1]);
+}
+
+TEST(TestDiskBackedStorage, TestNothingToRecover) {
+    auto &capture = GetCapture();
+
+    // A capture without a checkpoint has no channels recorded, and blocks without checksums
+    DiskBackedStorage storage;
+    storage.setFileName(CaptureFileName);
+    storage.open(QIODevice::ReadWrite);
+    storage.setBlockCountLimit(BlockCountLimit);
+    storage.clearStorage();
+    storage.beginCapture();
+    DiskBackedStorage::BlockChain chain;
+    ASSERT_TRUE(storage.appendToChain(chain, 7, capture.points[0].data(), 100000).isOk());
+    {
+        DiskBackedStorage recovery;
+        QFile::remove(RecoveryFileName);
+        ASSERT_TRUE(QFile::copy(CaptureFileName, RecoveryFileName));
+        OpenRecoveryFile(recovery);
+        EXPECT_TRUE(recovery.recoverCapture().empty());
+    }
+
+    // Nor does a cleared file
+    CopyCapture();
+    {
+        DiskBackedStorage cleared;
+        OpenRecoveryFile(cleared);
+        cleared.clearStorage();
+        DiskBackedStorage recovery;
+        OpenRecoveryFile(recovery);
+        EXPECT_TRUE(recovery.recoverCapture().empty());
+    }
+}
@@ -0,0 +1,172 @@
+#include "readcoalescer.h"
+#include <cstring>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+using Block = probelib::ScatterGatherEntry;
+using Read = ReadCoalescer::Read;
+
+/// @brief What the probe would return for the blocks when every byte of memory holds the low byte of its address.
+QByteArray ReadBlocks(const ReadCoalescer &coalescer) {
+    QByteArray data;
+    for (auto &block : coalescer.blocks()) {
+        for (size_t i = 0; i < block.count; i++) {
+            data.append(char(block.address + i));
+        }
+    }
+    EXPECT_EQ(size_t(data.size()), coalescer.totalBytes());
+    return data;
+}
+
+uint64_t Expected(const Read &read) {
+    uint64_t ret = 0;
+    for (size_t i = 0; i < read.width; i++) {
+        ret |= uint64_t(uint8_t(read.address + i)) << (i * 8);
+    }
+    return ret;
+}
+
+TEST(TestReadCoalescer, TestEmpty) {
+    ReadCoalescer coalescer;
+    EXPECT_FALSE(coalescer.plan({}));
+    EXPECT_TRUE(coalescer.blocks().isEmpty());
+    EXPECT_EQ(coalescer.totalBytes(), 0);
+}
+
+TEST(TestReadCoalescer, TestWidensToWords) {
+    ReadCoalescer coalescer;
+    EXPECT_TRUE(coalescer.plan({{0x20000001, 1}}));
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 4}}));
+
+    // Crossing a word boundary takes both words
+    coalescer.plan({{0x20000003, 2}});
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 8}}));
+
+    coalescer.plan({{0x20000006, 8}});
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000004, 12}}));
+}
+
+TEST(TestReadCoalescer, TestMergesWithinGap) {
+    ReadCoalescer coalescer;
+    coalescer.setGapThreshold(8);
+
+    // Out of order on purpose, blocks come out sorted
+    coalescer.plan({{0x20000010, 4}, {0x20000000, 4}, {0x2000000c, 2}});
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 0x14}}));
+
+    // The gap is measured from the aligned end of the block: 0x20000004 + 8 still merges, one more byte doesn't
+    coalescer.plan({{0x20000000, 4}, {0x2000000c, 4}});
+    EXPECT_EQ(coalescer.blocks().size(), 1);
+    coalescer.plan({{0x20000000, 4}, {0x2000000d, 1}});
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 4}, {0x2000000c, 4}}));
+
+    // Overlapping and duplicate reads share the block
+    coalescer.plan({{0x20000000, 4}, {0x20000002, 2}, {0x20000000, 4}});
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 4}}));
+}
+
+TEST(TestReadCoalescer, TestGapThreshold) {
+    ReadCoalescer coalescer;
+    std::vector<Read> reads{{0x20000000, 4}, {0x20000100, 4}};
+    coalescer.plan(reads);
+    EXPECT_EQ(coalescer.blocks().size(), 2);
+
+    // Changing the threshold rebuilds the layout on the next plan, even for the same reads
+    coalescer.setGapThreshold(0x100);
+    EXPECT_EQ(coalescer.gapThreshold(), 0x100);
+    EXPECT_TRUE(coalescer.plan(reads));
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 0x104}}));
+
+    // With no gap allowed, only touching words merge
+    coalescer.setGapThreshold(0);
+    coalescer.plan({{0x20000000, 4}, {0x20000004, 4}, {0x2000000c, 4}});
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 8}, {0x2000000c, 4}}));
+}
+
+TEST(TestReadCoalescer, TestLayoutKept) {
+    ReadCoalescer coalescer;
+    std::vector<Read> reads{{0x20000000, 4}, {0x20000004, 4}};
+    EXPECT_TRUE(coalescer.plan(reads));
+    EXPECT_FALSE(coalescer.plan(reads));
+
+    // Different reads that happen to need the same blocks don't change the layout either
+    EXPECT_FALSE(coalescer.plan({{0x20000001, 1}, {0x20000006, 2}}));
+    EXPECT_TRUE(coalescer.plan({{0x20000100, 4}}));
+}
+
+TEST(TestReadCoalescer, TestFanOut) {
+    ReadCoalescer coalescer;
+    coalescer.setGapThreshold(4);
+    // Sub-word, unaligned, word-crossing and 64-bit reads, spread over several blocks
+    std::vector<Read> reads{{0x20000001, 1}, {0x20000002, 2}, {0x20000003, 4}, {0x20000100, 8}, {0x20000105, 2},
+                            {0x20000007, 1}, {0x20000200, 4}, {0x20000103, 8}};
+    coalescer.plan(reads);
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x20000000, 8}, {0x20000100, 12}, {0x20000200, 4}}));
+
+    auto data = ReadBlocks(coalescer);
+    for (size_t i = 0; i < reads.size(); i++) {
+        EXPECT_EQ(coalescer.fanOut(data, i), Expected(reads[i])) << "read " << i;
+    }
+
+    // Short data (a probe returning less than asked) reads as zero instead of running off the end
+    data.truncate(8);
+    EXPECT_EQ(coalescer.fanOut(data, 0), Expected(reads[0]));
+    EXPECT_EQ(coalescer.fanOut(data, 3), 0);
+}
+
+TEST(TestReadCoalescer, TestFanOutRandom) {
+    std::mt19937_64 rng(3);
+    ReadCoalescer coalescer;
+    for (int round = 0; round < 200; round++) {
+        coalescer.setGapThreshold(rng() % 64);
+        std::vector<Read> reads(1 + rng() % 40);
+        for (auto &read : reads) {
+            read = {0x20000000 + rng() % 1024, size_t(1) << (rng() % 4)};
+        }
+        coalescer.plan(reads);
+
+        // Blocks are word aligned, sorted and don't overlap. The read that starts a block is further than the gap
+        // from the previous block, and may be up to 3 bytes past the start of its own.
+        auto &blocks = coalescer.blocks();
+        for (qsizetype i = 0; i < blocks.size(); i++) {
+            EXPECT_EQ(blocks[i].address % 4, 0);
+            EXPECT_EQ(blocks[i].count % 4, 0);
+            if (i) {
+                auto previousEnd = blocks[i - 1].address + blocks[i - 1].count;
+                EXPECT_GE(blocks[i].address, previousEnd);
+                EXPECT_GT(blocks[i].address + 3, previousEnd + coalescer.gapThreshold());
+            }
+        }
+
+        auto data = ReadBlocks(coalescer);
+        for (size_t i = 0; i < reads.size(); i++) {
+            ASSERT_EQ(coalescer.fanOut(data, i), Expected(reads[i])) << "round " << round << " read " << i;
+        }
+    }
+}
+
+TEST(TestReadCoalescer, TestCoalescingDisabled) {
+    ReadCoalescer coalescer;
+    coalescer.setGapThreshold(64);
+    std::vector<Read> reads{{0x40011004, 4}, {0x40011001, 1}, {0x40011002, 2}, {0x40011004, 4}};
+    coalescer.plan(reads);
+    EXPECT_EQ(coalescer.blocks().size(), 1);
+
+    // Every read is read as it is, in order, nothing more
+    coalescer.setCoalescingEnabled(false);
+    EXPECT_FALSE(coalescer.isCoalescingEnabled());
+    EXPECT_TRUE(coalescer.plan(reads));
+    EXPECT_EQ(coalescer.blocks(),
+              QVector<Block>({{0x40011004, 4}, {0x40011001, 1}, {0x40011002, 2}, {0x40011004, 4}}));
+    EXPECT_EQ(coalescer.totalBytes(), 11);
+
+    auto data = ReadBlocks(coalescer);
+    for (size_t i = 0; i < reads.size(); i++) {
+        EXPECT_EQ(coalescer.fanOut(data, i), Expected(reads[i])) << "read " << i;
+    }
+
+    coalescer.setCoalescingEnabled(true);
+    EXPECT_TRUE(coalescer.plan(reads));
+    EXPECT_EQ(coalescer.blocks(), QVector<Block>({{0x40011000, 8}}));
+}
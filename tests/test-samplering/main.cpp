@@ -0,0 +1,287 @@
+#include "samplering.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using ValueKind = SampleRing::ValueKind;
+
+struct Sample {
+    uint64_t timeUs;
+    double value;
+};
+
+/// @brief Drain everything into samples, throwing away what the ring asks to discard.
+size_t DrainAll(SampleRing &ring, std::vector<Sample> &samples, size_t maxCount = SIZE_MAX,
+                std::vector<SampleRing::Span> *spans = nullptr) {
+    return ring.drain(
+        [&](const SampleRing::Span &span) {
+            if (spans) {
+                spans->push_back(span);
+            }
+            SampleRing::convertValues(span.kind, span.values, [&](size_t i, double v) {
+                samples.push_back({span.timeBaseUs + span.timestamps[i], v});
+            });
+        },
+        [&](size_t count) { samples.resize(samples.size() - count); }, maxCount);
+}
+
+bool Push(SampleRing &ring, uint64_t timeUs, IAcquisitionBufferChannel::Value value) {
+    ValueKind kind;
+    auto slot = SampleRing::encode(value, kind);
+    return ring.push(timeUs, kind, slot);
+}
+
+TEST(TestSampleRing, TestEncodeRoundTrip) {
+    IAcquisitionBufferChannel::Value values[] = {
+        uint8_t(200),         uint16_t(60000),          uint32_t(4000000000u), uint64_t(1) << 52,
+        int8_t(-100),         int16_t(-30000),          int32_t(-2000000000),  -(int64_t(1) << 52),
+        -1.5f,                -1e300,
+    };
+    for (auto &value : values) {
+        ValueKind kind;
+        auto slot = SampleRing::encode(value, kind);
+        EXPECT_EQ(size_t(kind), value.index());
+        double converted;
+        SampleRing::toDouble(kind, {&slot, 1}, &converted);
+        EXPECT_EQ(converted, std::visit([](auto v) { return double(v); }, value)) << "kind " << int(kind);
+    }
+}
+
+TEST(TestSampleRing, TestFullAndWrapAround) {
+    // On storage of our own, so spans can be checked against the ends of the arrays
+    const size_t capacity = 1024;
+    std::vector<uint64_t> storage(SampleRing::storageSize(capacity) / sizeof(uint64_t));
+    SampleRing ring(capacity, storage.data());
+    auto timestampsEnd = reinterpret_cast<const uint32_t *>(storage.data() + capacity) + capacity;
+
+    std::vector<Sample> samples;
+    uint64_t next = 0, expected = 0;
+    for (int round = 0; round < 5; round++) {
+        while (Push(ring, next, uint32_t(next))) {
+            next++;
+        }
+        EXPECT_EQ(ring.size(), capacity);
+        EXPECT_EQ(ring.producerSize(), capacity);
+
+        // Drain part of it, so the next round starts somewhere in the middle of the arrays
+        std::vector<SampleRing::Span> spans;
+        samples.clear();
+        EXPECT_EQ(DrainAll(ring, samples, 700, &spans), 700);
+        for (auto &span : spans) {
+            EXPECT_LE(span.timestamps.data() + span.size(), timestampsEnd);
+            EXPECT_LE(span.values.data() + span.size(), storage.data() + capacity);
+        }
+        for (auto &sample : samples) {
+            EXPECT_EQ(sample.timeUs, expected);
+            EXPECT_EQ(sample.value, double(expected));
+            expected++;
+        }
+    }
+
+    samples.clear();
+    EXPECT_EQ(DrainAll(ring, samples), next - expected);
+    EXPECT_EQ(samples.back().timeUs, next - 1);
+    EXPECT_EQ(ring.size(), 0);
+    EXPECT_EQ(DrainAll(ring, samples), 0);
+}
+
+TEST(TestSampleRing, TestSegments) {
+    // The type changes, and the time base changes at 2^32 us, in the middle of a run of the same type
+    SampleRing ring(256);
+    const uint64_t start = (uint64_t(1) << 32) - 10;
+    for (uint64_t i = 0; i < 60; i++) {
+        if (i < 20) {
+            ASSERT_TRUE(Push(ring, start + i, int16_t(-int(i))));
+        } else if (i < 40) {
+            ASSERT_TRUE(Push(ring, start + i, float(i) / 4));
+        } else {
+            ASSERT_TRUE(Push(ring, start + i, uint8_t(i)));
+        }
+    }
+
+    std::vector<Sample> samples;
+    std::vector<SampleRing::Span> spans;
+    ASSERT_EQ(DrainAll(ring, samples, SIZE_MAX, &spans), 60);
+    ASSERT_EQ(spans.size(), 4);
+    EXPECT_EQ(spans[0].kind, ValueKind::I16);
+    EXPECT_EQ(spans[0].size(), 10);
+    EXPECT_EQ(spans[0].timeBaseUs, 0);
+    EXPECT_EQ(spans[1].kind, ValueKind::I16);
+    EXPECT_EQ(spans[1].size(), 10);
+    EXPECT_EQ(spans[1].timeBaseUs, uint64_t(1) << 32);
+    EXPECT_EQ(spans[2].kind, ValueKind::F32);
+    EXPECT_EQ(spans[3].kind, ValueKind::U8);
+    for (uint64_t i = 0; i < 60; i++) {
+        EXPECT_EQ(samples[i].timeUs, start + i);
+        EXPECT_EQ(samples[i].value, i < 20 ? -double(i) : i < 40 ? double(i) / 4 : double(i));
+    }
+}
+
+TEST(TestSampleRing, TestEvictOldest) {
+    SampleRing ring(64);
+    for (uint64_t i = 0; i < 64; i++) {
+        ASSERT_TRUE(Push(ring, i, i < 10 ? IAcquisitionBufferChannel::Value(int8_t(-1))
+                                         : IAcquisitionBufferChannel::Value(double(i))));
+    }
+    EXPECT_FALSE(Push(ring, 64, 64.0));
+
+    // The marker of the evicted int8 samples still has to be applied before the doubles are drained
+    EXPECT_EQ(ring.evictOldest(16), 16);
+    EXPECT_EQ(ring.producerSize(), 48);
+    for (uint64_t i = 64; i < 80; i++) {
+        ASSERT_TRUE(Push(ring, i, double(i)));
+    }
+
+    std::vector<Sample> samples;
+    std::vector<SampleRing::Span> spans;
+    EXPECT_EQ(DrainAll(ring, samples, SIZE_MAX, &spans), 64);
+    for (auto &span : spans) {
+        EXPECT_EQ(span.kind, ValueKind::F64);
+    }
+    for (uint64_t i = 0; i < 64; i++) {
+        EXPECT_EQ(samples[i].timeUs, i + 16);
+        EXPECT_EQ(samples[i].value, double(i + 16));
+    }
+
+    // Nothing more to evict than what's there
+    EXPECT_EQ(ring.evictOldest(16), 0);
+    ASSERT_TRUE(Push(ring, 80, 80.0));
+    EXPECT_EQ(ring.evictOldest(16), 1);
+    EXPECT_EQ(ring.size(), 0);
+}
+
+TEST(TestSampleRing, TestDiscardEvictedSpan) {
+    SampleRing ring(64);
+    for (uint64_t i = 0; i < 64; i++) {
+        ASSERT_TRUE(Push(ring, i, uint16_t(i)));
+    }
+
+    // The producer evicts what the consumer is reading, then fills the room with samples of another type
+    std::vector<Sample> samples;
+    size_t discarded = 0;
+    bool evicted = false;
+    auto drained = ring.drain(
+        [&](const SampleRing::Span &span) {
+            SampleRing::convertValues(span.kind, span.values, [&](size_t i, double v) {
+                samples.push_back({span.timeBaseUs + span.timestamps[i], v});
+            });
+            if (!evicted) {
+                evicted = true;
+                EXPECT_EQ(ring.evictOldest(40), 40);
+                for (uint64_t i = 64; i < 104; i++) {
+                    ASSERT_TRUE(Push(ring, i, int32_t(-int(i))));
+                }
+            }
+        },
+        [&](size_t count) {
+            discarded += count;
+            samples.resize(samples.size() - count);
+        },
+        20);
+
+    // The first span was thrown away, and the drain went on from the oldest sample left
+    EXPECT_EQ(discarded, 20);
+    EXPECT_EQ(drained, 20);
+    ASSERT_EQ(samples.size(), 20);
+    for (uint64_t i = 0; i < 20; i++) {
+        EXPECT_EQ(samples[i].timeUs, 40 + i);
+        EXPECT_EQ(samples[i].value, double(40 + i));
+    }
+
+    samples.clear();
+    EXPECT_EQ(DrainAll(ring, samples), 44);
+    for (uint64_t i = 0; i < 44; i++) {
+        auto time = 60 + i;
+        EXPECT_EQ(samples[i].timeUs, time);
+        EXPECT_EQ(samples[i].value, time < 64 ? double(time) : -double(time));
+    }
+}
+
+TEST(TestSampleRing, TestExternalStorage) {
+    const size_t bytes = 4096;
+    auto capacity = SampleRing::capacityForStorage(bytes);
+    ASSERT_EQ(capacity, 256);
+    EXPECT_LE(SampleRing::storageSize(capacity), bytes);
+
+    std::vector<uint64_t> storage(bytes / sizeof(uint64_t));
+    SampleRing ring(capacity, storage.data());
+    for (uint64_t i = 0; i < capacity; i++) {
+        ASSERT_TRUE(Push(ring, i, int64_t(i) - 100));
+    }
+    EXPECT_FALSE(Push(ring, capacity, int64_t(0)));
+
+    std::vector<Sample> samples;
+    EXPECT_EQ(DrainAll(ring, samples), capacity);
+    for (uint64_t i = 0; i < capacity; i++) {
+        EXPECT_EQ(samples[i].value, double(int64_t(i) - 100));
+    }
+}
+
+TEST(TestSampleRing, TestDropOldestStress) {
+    // The producer evicts like AcquisitionBuffer does with DropOldest, while the consumer drains as fast as it can.
+    // Samples must come out in order and with their own type and time base, whatever was evicted or discarded. Reading
+    // a span the producer is overwriting is a data race by design: the ring has the consumer discard it afterwards.
+    const uint64_t count = 4000000;
+    const uint64_t start = (uint64_t(1) << 32) - count / 2;
+    auto valueOf = [](uint64_t i) -> IAcquisitionBufferChannel::Value {
+        switch (i / 1000 % 4) {
+            case 0: return uint32_t(i);
+            case 1: return int16_t(-int(i % 30000));
+            case 2: return float(i % 100000) / 4;
+            default: return double(i) / 8;
+        }
+    };
+
+    SampleRing ring(1024);
+    uint64_t evicted = 0;
+    std::atomic<bool> finished = false;
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < count; i++) {
+            while (!Push(ring, start + i, valueOf(i))) {
+                if (ring.producerSize() == ring.capacity()) {
+                    evicted += ring.evictOldest(ring.capacity() / 16);
+                } else {
+                    std::this_thread::yield(); // The marker queue is full
+                }
+            }
+        }
+        finished.store(true, std::memory_order_release);
+    });
+
+    std::vector<Sample> samples;
+    uint64_t received = 0, discarded = 0;
+    uint64_t lastTime = 0;
+    auto drainSome = [&](size_t maxCount) {
+        samples.clear();
+        ring.drain(
+            [&](const SampleRing::Span &span) {
+                SampleRing::convertValues(span.kind, span.values, [&](size_t i, double v) {
+                    samples.push_back({span.timeBaseUs + span.timestamps[i], v});
+                });
+            },
+            [&](size_t n) {
+                discarded += n;
+                samples.resize(samples.size() - n);
+            },
+            maxCount);
+        for (auto &sample : samples) {
+            ASSERT_TRUE(received == 0 || sample.timeUs > lastTime) << "at " << sample.timeUs - start;
+            auto i = sample.timeUs - start;
+            ASSERT_LT(i, count);
+            ASSERT_EQ(sample.value, std::visit([](auto v) { return double(v); }, valueOf(i))) << "at " << i;
+            lastTime = sample.timeUs;
+            received++;
+        }
+    };
+    // Small drains, so the producer often evicts what's being read
+    while (!finished.load(std::memory_order_acquire) && !HasFatalFailure()) {
+        drainSome(256);
+    }
+    producer.join();
+    drainSome(SIZE_MAX);
+
+    EXPECT_EQ(received + evicted, count);
+    EXPECT_EQ(ring.size(), 0);
+    RecordProperty("evicted", std::to_string(evicted));
+    RecordProperty("discarded", std::to_string(discarded));
+}
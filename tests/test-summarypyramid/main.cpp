@@ -0,0 +1,252 @@
+
+#include "summarypyramid.h"
+#include <algorithm>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+struct Point {
+    double key;
+    double value;
+};
+
+std::vector<Point> RandomWalk(size_t count, uint64_t seed) {
+    std::vector<Point> points(count);
+    std::mt19937_64 rng(seed);
+    std::normal_distribution<double> step;
+    double value = 0;
+    for (size_t i = 0; i < count; i++) {
+        value += step(rng);
+        points[i] = {i * 0.5, value};
+    }
+    return points;
+}
+
+void ExpectSameBuckets(const SummaryBucket &a, const SummaryBucket &b) {
+    EXPECT_EQ(a.firstKey, b.firstKey);
+    EXPECT_EQ(a.lastKey, b.lastKey);
+    EXPECT_EQ(a.first, b.first);
+    EXPECT_EQ(a.last, b.last);
+    EXPECT_EQ(a.min, b.min);
+    EXPECT_EQ(a.max, b.max);
+    EXPECT_EQ(a.count, b.count);
+}
+
+TEST(TestSummaryPyramid, TestEmpty) {
+    SummaryPyramid pyramid;
+    EXPECT_TRUE(pyramid.isEmpty());
+    EXPECT_EQ(pyramid.pointCount(), 0);
+    EXPECT_TRUE(pyramid.columns(0, 100, 10).empty());
+
+    pyramid.append<Point>(nullptr, 0);
+    EXPECT_TRUE(pyramid.isEmpty());
+}
+
+TEST(TestSummaryPyramid, TestLevels) {
+    constexpr size_t count = SummaryPyramid::BaseBucketSize * 37 + 5;
+    auto points = RandomWalk(count, 1);
+    SummaryPyramid pyramid;
+    pyramid.append(points.data(), points.size());
+
+    EXPECT_EQ(pyramid.pointCount(), count);
+    EXPECT_EQ(pyramid.firstKey(), points.front().key);
+    EXPECT_EQ(pyramid.lastKey(), points.back().key);
+
+    // 38 -> 10 -> 3 -> 1 buckets
+    ASSERT_EQ(pyramid.levelCount(), 4);
+    EXPECT_EQ(pyramid.level(0).size(), 38);
+    EXPECT_EQ(pyramid.level(1).size(), 10);
+    EXPECT_EQ(pyramid.level(2).size(), 3);
+    ASSERT_EQ(pyramid.level(3).size(), 1);
+
+    // Every bucket matches the points it covers
+    for (size_t level = 0; level < pyramid.levelCount(); level++) {
+        uint64_t begin = 0;
+        for (auto &bucket : pyramid.level(level)) {
+            auto end = begin + bucket.count;
+            auto [min, max] = std::minmax_element(points.begin() + begin, points.begin() + end,
+                                                  [](const Point &a, const Point &b) { return a.value < b.value; });
+            EXPECT_EQ(bucket.firstKey, points[begin].key);
+            EXPECT_EQ(bucket.lastKey, points[end - 1].key);
+            EXPECT_EQ(bucket.first, points[begin].value);
+            EXPECT_EQ(bucket.last, points[end - 1].value);
+            EXPECT_EQ(bucket.min, min->value);
+            EXPECT_EQ(bucket.max, max->value);
+            begin = end;
+        }
+        EXPECT_EQ(begin, count) << "on level " << level;
+    }
+}
+
+TEST(TestSummaryPyramid, TestChunkedAppendMatchesWhole) {
+    constexpr size_t count = SummaryPyramid::BaseBucketSize * 300 + 123;
+    auto points = RandomWalk(count, 2);
+    SummaryPyramid whole, chunked;
+    whole.append(points.data(), points.size());
+
+    std::mt19937_64 rng(3);
+    for (size_t offset = 0; offset < count;) {
+        auto chunk = std::min<size_t>(rng() % 3000, count - offset);
+        chunked.append(points.data() + offset, chunk);
+        offset += chunk;
+    }
+
+    ASSERT_EQ(chunked.levelCount(), whole.levelCount());
+    for (size_t level = 0; level < whole.levelCount(); level++) {
+        ASSERT_EQ(chunked.level(level).size(), whole.level(level).size());
+        for (size_t i = 0; i < whole.level(level).size(); i++) {
+            ExpectSameBuckets(chunked.level(level)[i], whole.level(level)[i]);
+        }
+    }
+}
+
+/// @brief Every level covers the points from first on, and every bucket matches the points it covers.
+void ExpectCovers(const SummaryPyramid &pyramid, const std::vector<Point> &points, size_t first, size_t end) {
+    EXPECT_EQ(pyramid.pointCount(), end - first);
+    for (size_t level = 0; level < pyramid.levelCount(); level++) {
+        // Only the top level has a single bucket
+        EXPECT_EQ(pyramid.level(level).size() == 1, level == pyramid.levelCount() - 1) << "on level " << level;
+        auto begin = first;
+        for (auto &bucket : pyramid.level(level)) {
+            auto bucketEnd = begin + bucket.count;
+            ASSERT_LE(bucketEnd, end);
+            auto [min, max] = std::minmax_element(points.begin() + begin, points.begin() + bucketEnd,
+                                                  [](const Point &a, const Point &b) { return a.value < b.value; });
+            EXPECT_EQ(bucket.firstKey, points[begin].key);
+            EXPECT_EQ(bucket.lastKey, points[bucketEnd - 1].key);
+            EXPECT_EQ(bucket.first, points[begin].value);
+            EXPECT_EQ(bucket.last, points[bucketEnd - 1].value);
+            EXPECT_EQ(bucket.min, min->value);
+            EXPECT_EQ(bucket.max, max->value);
+            begin = bucketEnd;
+        }
+        EXPECT_EQ(begin, end) << "on level " << level;
+    }
+}
+
+TEST(TestSummaryPyramid, TestDropBefore) {
+    // Points are appended and dropped in turn, like blocks being logged and recycled
+    constexpr size_t count = SummaryPyramid::BaseBucketSize * 3000 + 11;
+    auto points = RandomWalk(count, 6);
+    SummaryPyramid pyramid;
+    std::mt19937_64 rng(7);
+    size_t end = 0, first = 0;
+    while (end < count) {
+        auto chunk = std::min<size_t>(rng() % 200000, count - end);
+        pyramid.append(points.data() + end, chunk);
+        end += chunk;
+
+        auto drop = first + rng() % (end - first);
+        pyramid.dropBefore(points[drop].key);
+        // Whole level 0 buckets go, the first one left reaches the key
+        first = pyramid.isEmpty() ? first : end - pyramid.pointCount();
+        EXPECT_LE(first, drop);
+        EXPECT_GT(first + SummaryPyramid::BaseBucketSize, drop);
+        ExpectCovers(pyramid, points, first, end);
+    }
+
+    // Nothing but the last bucket is left when everything ends before the key
+    pyramid.dropBefore(points.back().key + 1);
+    ASSERT_EQ(pyramid.levelCount(), 1);
+    EXPECT_EQ(pyramid.lastKey(), points.back().key);
+    ExpectCovers(pyramid, points, count - pyramid.pointCount(), count);
+
+    // Appending goes on as before
+    auto more = RandomWalk(SummaryPyramid::BaseBucketSize * 100, 8);
+    auto lastKey = points.back().key;
+    for (auto &point : more) {
+        point.key += lastKey + 1;
+    }
+    auto kept = pyramid.pointCount();
+    pyramid.append(more.data(), more.size());
+    points.insert(points.end(), more.begin(), more.end());
+    ExpectCovers(pyramid, points, count - kept, points.size());
+}
+
+TEST(TestSummaryPyramid, TestNaNLeftOutOfMinMax) {
+    std::vector<Point> points{{0, NAN}, {1, 3}, {2, NAN}, {3, -1}};
+    SummaryPyramid pyramid;
+    pyramid.append(points.data(), points.size());
+
+    auto &bucket = pyramid.level(0)[0];
+    EXPECT_TRUE(std::isnan(bucket.first));
+    EXPECT_EQ(bucket.min, -1);
+    EXPECT_EQ(bucket.max, 3);
+    EXPECT_EQ(bucket.count, 4);
+
+    // A bucket of only NaN has an empty value range
+    std::vector<Point> nans{{4, NAN}};
+    SummaryPyramid nanPyramid;
+    nanPyramid.append(nans.data(), nans.size());
+    EXPECT_GT(nanPyramid.level(0)[0].min, nanPyramid.level(0)[0].max);
+}
+
+TEST(TestSummaryPyramid, TestColumns) {
+    constexpr size_t count = SummaryPyramid::BaseBucketSize * 2000;
+    auto points = RandomWalk(count, 4);
+    SummaryPyramid pyramid;
+    pyramid.append(points.data(), points.size());
+
+    for (auto [lower, upper, columnCount] : {std::tuple{0.0, points.back().key, 100},
+                                             std::tuple{100000.0, 300000.0, 50},
+                                             std::tuple{-1000.0, 50000.0, 10}}) {
+        auto columns = pyramid.columns(lower, upper, columnCount);
+        ASSERT_FALSE(columns.empty());
+        EXPECT_LE(columns.size(), size_t(columnCount));
+
+        // Columns are contiguous and in order, and agree with the points they cover
+        auto begin = std::lower_bound(points.begin(), points.end(), columns.front().firstKey,
+                                      [](const Point &p, double key) { return p.key < key; });
+        for (auto &column : columns) {
+            ASSERT_EQ(begin->key, column.firstKey);
+            auto end = begin + column.count;
+            auto [min, max] = std::minmax_element(begin, end,
+                                                  [](const Point &a, const Point &b) { return a.value < b.value; });
+            EXPECT_EQ(column.lastKey, (end - 1)->key);
+            EXPECT_EQ(column.min, min->value);
+            EXPECT_EQ(column.max, max->value);
+            begin = end;
+        }
+
+        // And cover the whole range
+        EXPECT_LE(columns.front().firstKey, std::max(lower, points.front().key));
+        EXPECT_GE(columns.back().lastKey, std::min(upper, points.back().key));
+    }
+
+    EXPECT_TRUE(pyramid.columns(points.back().key + 1, points.back().key + 100, 10).empty());
+    EXPECT_TRUE(pyramid.columns(10, 5, 10).empty());
+}
+
+TEST(TestSummaryPyramid, TestView) {
+    constexpr size_t count = SummaryPyramid::BaseBucketSize * 500 + 77;
+    auto points = RandomWalk(count, 5);
+    SummaryPyramid pyramid;
+    pyramid.append(points.data(), points.size());
+
+    // Levels kept elsewhere, as they would be in a file
+    std::vector<std::vector<SummaryBucket>> stored;
+    std::vector<SummaryPyramid::Level> levels;
+    for (size_t level = 0; level < pyramid.levelCount(); level++) {
+        stored.emplace_back(pyramid.level(level).begin(), pyramid.level(level).end());
+    }
+    for (auto &level : stored) {
+        levels.push_back(level);
+    }
+    auto view = SummaryPyramid::view(levels);
+
+    EXPECT_EQ(view.pointCount(), count);
+    EXPECT_EQ(view.firstKey(), pyramid.firstKey());
+    EXPECT_EQ(view.lastKey(), pyramid.lastKey());
+    ASSERT_EQ(view.levelCount(), pyramid.levelCount());
+    EXPECT_EQ(view.level(0).data(), stored[0].data());
+
+    auto expected = pyramid.columns(1000, 200000, 300);
+    auto columns = view.columns(1000, 200000, 300);
+    ASSERT_EQ(columns.size(), expected.size());
+    for (size_t i = 0; i < columns.size(); i++) {
+        ExpectSameBuckets(columns[i], expected[i]);
+    }
+
+    EXPECT_TRUE(SummaryPyramid::view({}).isEmpty());
+}
@@ -0,0 +1,29 @@
+#include "overflowpolicycolumndelegate.h"
+#include "models/watchentrymodel.h"
+#include <QComboBox>
+
+QWidget *OverflowPolicyColumnDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem &option,
+                                                    const QModelIndex &index) const {
+    auto combo = new QComboBox(parent);
+    for (auto policy : {AcquisitionBuffer::OverflowPolicy::DropNewest, AcquisitionBuffer::OverflowPolicy::DropOldest,
+                        AcquisitionBuffer::OverflowPolicy::Decimate, AcquisitionBuffer::OverflowPolicy::SpillToDisk}) {
+        combo->addItem(WatchEntryModel::overflowPolicyName(policy), int(policy));
+    }
+    // Commit as soon as a policy is picked, there's nothing else to edit
+    connect(combo, &QComboBox::activated, this, [this, combo]() {
+        emit const_cast<OverflowPolicyColumnDelegate *>(this)->commitData(combo);
+        emit const_cast<OverflowPolicyColumnDelegate *>(this)->closeEditor(combo);
+    });
+    return combo;
+}
+
+void OverflowPolicyColumnDelegate::setEditorData(QWidget *editor, const QModelIndex &index) const {
+    auto combo = static_cast<QComboBox *>(editor);
+    combo->setCurrentIndex(combo->findData(index.data(Qt::EditRole).toInt()));
+}
+
+void OverflowPolicyColumnDelegate::setModelData(QWidget *editor, QAbstractItemModel *model,
+                                                const QModelIndex &index) const {
+    auto combo = static_cast<QComboBox *>(editor);
+    model->setData(index, combo->currentData());
+}
@@ -0,0 +1,18 @@
+
+#pragma once
+
+#include <QStyledItemDelegate>
+
+/**
+ * @brief Edits the overflow policy column of the watch entry table with a combobox of policy names.
+ */
+class OverflowPolicyColumnDelegate : public QStyledItemDelegate {
+public:
+    OverflowPolicyColumnDelegate(QObject *parent = nullptr) : QStyledItemDelegate(parent) {}
+
+protected:
+    virtual QWidget *createEditor(QWidget *parent, const QStyleOptionViewItem &option,
+                                  const QModelIndex &index) const override;
+    void setEditorData(QWidget *editor, const QModelIndex &index) const override;
+    void setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const override;
+};
@@ -25,6 +25,8 @@ PlotAreaPanel::PlotAreaPanel(size_t areaId, WorkspaceModel *workspace, QWidget *
 
     // ＦＵＣＫ　ＯＶＥＲＬＯＡＤＥＤ　ＳＩＧＮＡＬＳ　ＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡＡ
     connect(ui->plot->xAxis, SIGNAL(rangeChanged(QCPRange)), this, SLOT(sltPlotHorizRageChanged(QCPRange)));
+    connect(m_workspaceModel, &WorkspaceModel::watchEntryLoggedPointsRead, this,
+            &PlotAreaPanel::sltWatchEntryLoggedPointsRead);
 
     sltHorizontalZoomChanged();
     sltVerticalZoomChanged();
@@ -76,51 +78,148 @@ void PlotAreaPanel::removePlot(size_t entryId) {
 
     auto graph = m_watchEntryToGraphMapping.take(entryId);
     ui->plot->removeGraph(graph);
+    m_overviews.remove(entryId);
 
     return;
 }
 void PlotAreaPanel::replot() {
-    if (m_horizAutoFit && m_vertAutoFit) {
-        ui->plot->rescaleAxes();
+    // Axes are fitted with the data in memory, graphs are switched over to summaries afterwards where the view needs it
+    showLiveData();
+    if (m_horizAutoFit) {
+        ui->plot->xAxis->rescale();
+
+        // Logged data goes further back than what's kept in memory, and is all there is of a capture opened from file
+        auto range = ui->plot->xAxis->range();
+        for (auto entryId : m_watchEntryToGraphMapping.keys()) {
+            auto rangeResult = m_workspaceModel->getWatchEntryLoggedRange(entryId);
+            if (rangeResult.isOk() && rangeResult.unwrap()) {
+                range.lower = std::min(range.lower, rangeResult.unwrap()->lower);
+                range.upper = std::max(range.upper, rangeResult.unwrap()->upper);
+            }
+        }
+        ui->plot->xAxis->setRange(range);
     } else {
-        if (m_horizAutoFit) {
-            ui->plot->xAxis->rescale();
-        } else {
-            // Horizontal scrollbar maximum should be determined on our own :C
-            auto range = ui->plot->xAxis->range();
-            double max = 0.0;
-            for (auto &graph : ui->plot->xAxis->plottables()) {
-                bool foundRange;
-                max = std::max(max, graph->getKeyRange(foundRange).upper);
+        // Horizontal scrollbar maximum should be determined on our own :C
+        auto range = ui->plot->xAxis->range();
+        double max = 0.0;
+        for (auto &graph : ui->plot->xAxis->plottables()) {
+            bool foundRange;
+            max = std::max(max, graph->getKeyRange(foundRange).upper);
+        }
+        for (auto entryId : m_watchEntryToGraphMapping.keys()) {
+            auto summaryResult = m_workspaceModel->getWatchEntrySummary(entryId);
+            if (summaryResult.isOk() && !summaryResult.unwrap()->isEmpty()) {
+                max = std::max(max, summaryResult.unwrap()->lastKey());
             }
-            m_currentObservedXMax = max;
+        }
+        m_currentObservedXMax = max;
 
+        if (range.size() > max) {
+            ui->scrollHorizontal->setMaximum(ui->scrollHorizontal->minimum());
+        } else {
+            ui->scrollHorizontal->setMaximum(qRound((max - range.size() / 2) / PlotToScrollBarCoeff));
+        }
+
+        if (m_horizAutoScroll) {
+            // qDebug() << "Observed Max X:" << m_currentObservedXMax << "RangeSize" << range.size();
+
+            // If current data can't fill the selected X range, let the graph snap to the left bound of the view
             if (range.size() > max) {
-                ui->scrollHorizontal->setMaximum(ui->scrollHorizontal->minimum());
+                ui->plot->xAxis->setRange(0, range.size());
             } else {
-                ui->scrollHorizontal->setMaximum(qRound((max - range.size() / 2) / PlotToScrollBarCoeff));
+                ui->plot->xAxis->setRange(max - range.size(), max);
             }
+        }
+    }
+
+    refreshOverviews();
+    if (m_vertAutoFit) {
+        ui->plot->yAxis->rescale();
+    }
+
+
+    // ui->plot->replot(QCustomPlot::rpQueuedReplot);
+    ui->plot->replot();
+}
+
+void PlotAreaPanel::showLiveData() {
+    for (auto [entryId, graph] : m_watchEntryToGraphMapping.asKeyValueRange()) {
+        auto dataContainerResult = m_workspaceModel->getWatchEntryDataContainer(entryId);
+        if (dataContainerResult.isOk()) {
+            graph->setData(dataContainerResult.unwrap());
+        }
+    }
+}
+
+void PlotAreaPanel::refreshOverviews() {
+    auto range = ui->plot->xAxis->range();
+    auto columnCount = size_t(std::max(ui->plot->axisRect()->width(), 1));
+    for (auto [entryId, graph] : m_watchEntryToGraphMapping.asKeyValueRange()) {
+        auto dataContainerResult = m_workspaceModel->getWatchEntryDataContainer(entryId);
+        auto summaryResult = m_workspaceModel->getWatchEntrySummary(entryId);
+        if (dataContainerResult.isErr() || summaryResult.isErr()) {
+            continue;
+        }
+        auto data = dataContainerResult.unwrap();
+        auto summary = summaryResult.unwrap();
+
+        // Draw the summary when the view reaches back beyond what's in memory, or when it has so many points that
+        // even the finest summary level has a bucket for each pixel column
+        if (summary->isEmpty()) {
+            graph->setData(data);
+            continue;
+        }
+        auto firstKeyInMemory = data->isEmpty() ? std::numeric_limits<double>::infinity() : data->constBegin()->key;
+        auto pointsInView = size_t(data->findEnd(range.upper) - data->findBegin(range.lower));
+        bool beyondMemory = range.lower < firstKeyInMemory && summary->firstKey() < firstKeyInMemory;
+        if (!beyondMemory && pointsInView < columnCount * SummaryPyramid::BaseBucketSize) {
+            graph->setData(data);
+            continue;
+        }
 
-            if (m_horizAutoScroll) {
-                // qDebug() << "Observed Max X:" << m_currentObservedXMax << "RangeSize" << range.size();
+        auto columns = summary->columns(range.lower, range.upper, columnCount);
+        uint64_t loggedInView = 0;
+        for (auto &column : columns) {
+            loggedInView += column.count;
+        }
 
-                // If current data can't fill the selected X range, let the graph snap to the left bound of the view
-                if (range.size() > max) {
-                    ui->plot->xAxis->setRange(0, range.size());
-                } else {
-                    ui->plot->xAxis->setRange(max - range.size(), max);
-                }
+        // Zoomed in beyond what the summary can tell, the logged points themselves are few enough to read. They're
+        // read in the background, the summary is drawn until they're in.
+        if (beyondMemory && loggedInView <= columnCount * LoggedPointsPerColumnLimit) {
+            auto result = m_workspaceModel->getWatchEntryLoggedPoints(entryId, range.lower, range.upper);
+            if (result.isOk() && result.unwrap()) {
+                graph->setData(result.unwrap());
+                continue;
             }
         }
 
-        if (m_vertAutoFit) {
-            ui->plot->yAxis->rescale();
+        // Each column is drawn as a vertical line from its minimum to its maximum, joined by its first and last point
+        QVector<QCPGraphData> points;
+        points.reserve(columns.size() * 4);
+        for (auto &column : columns) {
+            auto middle = (column.firstKey + column.lastKey) / 2;
+            points.append(QCPGraphData(column.firstKey, column.first));
+            if (column.min <= column.max) {
+                points.append(QCPGraphData(middle, column.min));
+                points.append(QCPGraphData(middle, column.max));
+            }
+            points.append(QCPGraphData(column.lastKey, column.last));
         }
-    }
 
+        auto &overview = m_overviews[entryId];
+        if (!overview) {
+            overview.reset(new QCPGraphDataContainer);
+        }
+        overview->set(points, true);
+        graph->setData(overview);
+    }
+}
 
-    // ui->plot->replot(QCustomPlot::rpQueuedReplot);
-    ui->plot->replot();
+void PlotAreaPanel::sltWatchEntryLoggedPointsRead(size_t entryId) {
+    if (m_watchEntryToGraphMapping.contains(entryId)) {
+        refreshOverviews();
+        ui->plot->replot();
+    }
 }
 
 void PlotAreaPanel::sltPlotHorizRageChanged(const QCPRange range) {
@@ -165,8 +264,11 @@ void PlotAreaPanel::plotPropertyChanged(size_t entryId, WatchEntryModel::Columns
         case WatchEntryModel::Expression:
         case WatchEntryModel::FrequencyLimit:
         case WatchEntryModel::PlotAreas:
+        case WatchEntryModel::OverflowPolicy:
+        case WatchEntryModel::Overflows:
         case WatchEntryModel::MaxColumns:
         case WatchEntryModel::FrequencyFeedback:
+        case WatchEntryModel::SpilledCount:
         case WatchEntryModel::ExpressionOkay: break;
     }
 }
@@ -189,6 +291,7 @@ void PlotAreaPanel::on_scrollHorizontal_valueChanged(int value) {
     // if user is dragging plot, we don't want to replot twice
     if (qAbs(ui->plot->xAxis->range().center() - value * PlotToScrollBarCoeff) > 0.01) {
         ui->plot->xAxis->setRange(value * PlotToScrollBarCoeff, ui->plot->xAxis->range().size(), Qt::AlignCenter);
+        refreshOverviews();
         ui->plot->replot();
     }
 }
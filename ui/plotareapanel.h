@@ -24,8 +24,10 @@ public:
     void replot();
 
     static constexpr double PlotToScrollBarCoeff = 10.0, SecToPlotCoeff = 1000.0;
+    static constexpr size_t LoggedPointsPerColumnLimit = 16; ///< Logged points are read up to this density
 private slots:
     void sltPlotHorizRageChanged(const QCPRange range);
+    void sltWatchEntryLoggedPointsRead(size_t entryId);
 
     void plotPropertyChanged(size_t entryId, WatchEntryModel::Columns prop, QVariant data);
     void on_btnAdjust_clicked();
@@ -37,6 +39,9 @@ private slots:
     void sltAdjustWindowLostFocus();
 
 private:
+    void showLiveData();
+    void refreshOverviews();
+
     size_t m_areaId;
     Ui::PlotAreaPanel *ui;
 
@@ -48,6 +53,7 @@ private:
 
     // UI State
     QMap<size_t, QCPGraph *> m_watchEntryToGraphMapping; ///< (Watch entry ID -> QCPGraph mapping)
+    QMap<size_t, QSharedPointer<QCPGraphDataContainer>> m_overviews; ///< (Watch entry ID -> Summary drawn instead)
 
     bool m_horizAutoFit;
     bool m_horizAutoScroll;
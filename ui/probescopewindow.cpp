@@ -9,6 +9,7 @@
 #include <QDateTime>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QSettings>
 
 #ifdef PROBESCOPE_INCLUDE_BUILD_INFO
@@ -138,7 +139,8 @@ ProbeScopeWindow::ProbeScopeWindow(QWidget *parent) : QMainWindow(parent), m_ref
     connect(ui->actionNewPlotArea, &QAction::triggered, this, &ProbeScopeWindow::sltNewPlotArea);
 
     connect(ui->actionCrashApplication, &QAction::triggered, this, &ProbeScopeWindow::sltCrashApp);
-    connect(ui->actionTestSaveData, &QAction::triggered, this, &ProbeScopeWindow::sltTestSaveData);
+    connect(ui->actionOpenCapture, &QAction::triggered, this, &ProbeScopeWindow::sltOpenCapture);
+    connect(ui->actionExportCapture, &QAction::triggered, this, &ProbeScopeWindow::sltExportCapture);
 
     // UI internal signals
     connect(&m_refreshTimer, &QTimer::timeout, this, &ProbeScopeWindow::sltRefreshTimerExpired);
@@ -151,10 +153,25 @@ ProbeScopeWindow::ProbeScopeWindow(QWidget *parent) : QMainWindow(parent), m_ref
     // Misc initialization
     reevaluateConnectionRelatedWidgetEnableStates();
 
+    // Offer to recover what a crashed session left in the cache file. Done after the signals are connected, as
+    // recovering adds plot areas and watch entries.
+    if (m_workspace->hasInterruptedCapture()) {
+        auto choice = QMessageBox::question(
+            this, tr("Recover interrupted capture"),
+            tr("The cache file holds a capture that was not closed properly, ProbeScope may have crashed during it.\n"
+               "Watch entries: %1\n\nDo you wish to recover it? Otherwise it will be discarded.")
+                .arg(m_workspace->getInterruptedCaptureNames().join(", ")),
+            QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
+        if (choice == QMessageBox::Yes) {
+            m_workspace->recoverInterruptedCapture();
+        } else {
+            m_workspace->discardInterruptedCapture();
+        }
+    }
+
 #ifdef NDEBUG
     ui->actionCrashApplication->setVisible(false);
 #endif
-    // ui->actionTestSaveData->setVisible(false);
 }
 
 ProbeScopeWindow::~ProbeScopeWindow() {
@@ -272,11 +289,76 @@ void ProbeScopeWindow::sltCrashApp() {
     (*((volatile int *) 0)) = 0;
 }
 
-void ProbeScopeWindow::sltTestSaveData() {
-    QString name = QInputDialog::getText(this, "Input File Name", "File name");
+void ProbeScopeWindow::sltOpenCapture() {
+    if (m_workspace->isAcquisitionActive()) {
+        QMessageBox::warning(this, tr("Open capture"), tr("Stop the acquisition before opening a capture."));
+        return;
+    }
 
-    m_workspace->saveAcquisitionData(QStringLiteral("D:/expm/undergraduate-thesis/data/probescope-%1.csv").arg(name));
-};
+    QSettings settings;
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open capture..."),
+                                                    settings.value("SavedPaths/ExportCaptureDir").toString(),
+                                                    tr("ProbeScope recording (*.psrec)"));
+
+    if (fileName.isEmpty()) {
+        return;
+    }
+
+    if (auto result = m_workspace->openCaptureFile(fileName); result.isErr()) {
+        QMessageBox::critical(this, tr("Open capture"),
+                              tr("Cannot open capture file.\nError message: %1")
+                                  .arg(CaptureFile::errorString(result.unwrapErr())));
+        return;
+    }
+
+    foreach (auto &i, m_plotAreas) {
+        i->replot();
+    }
+}
+
+void ProbeScopeWindow::sltExportCapture() {
+    QSettings settings;
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Export capture..."),
+                                                    settings.value("SavedPaths/ExportCaptureDir").toString(),
+                                                    tr("ProbeScope recording (*.psrec);;CSV (*.csv)"));
+
+    if (fileName.isEmpty()) {
+        return;
+    }
+
+    QFileInfo fileInfo(fileName);
+    if (fileInfo.dir().exists()) {
+        settings.setValue("SavedPaths/ExportCaptureDir", fileInfo.dir().absolutePath());
+    }
+
+    auto format = fileInfo.suffix().compare("csv", Qt::CaseInsensitive) == 0 ? CaptureExporter::Format::Csv
+                                                                              : CaptureExporter::Format::Psrec;
+    if (auto result = m_workspace->exportCapture(fileName, format); result.isErr()) {
+        QMessageBox::warning(this, tr("Export capture"),
+                             result.unwrapErr() == WorkspaceModel::Error::CaptureExportOverwritesSource
+                                 ? tr("The capture file is open, it can't be exported onto itself.")
+                                 : tr("Another export is still running."));
+        return;
+    }
+
+    // Progress is shown in thousandths, the point counts may not fit in an int
+    auto dialog = new QProgressDialog(tr("Exporting capture to %1...").arg(fileInfo.fileName()), tr("Cancel"), 0,
+                                      1000, this);
+    dialog->setAutoReset(false);
+    dialog->setAutoClose(false);
+    connect(dialog, &QProgressDialog::canceled, m_workspace, &WorkspaceModel::cancelCaptureExport);
+    connect(m_workspace, &WorkspaceModel::captureExportProgress, dialog, [dialog](uint64_t written, uint64_t total) {
+        dialog->setValue(total ? int(std::min<uint64_t>(written * 1000 / total, 1000)) : 0);
+    });
+    connect(m_workspace, &WorkspaceModel::captureExportFinished, dialog,
+            [this, dialog](bool succeeded, QString errorMessage) {
+                if (!succeeded && !dialog->wasCanceled()) {
+                    QMessageBox::critical(this, tr("Export capture"),
+                                          tr("Exporting capture failed.\n%1").arg(errorMessage));
+                }
+                dialog->deleteLater();
+            });
+}
 
 void ProbeScopeWindow::sltSelectProbe() {
     // NOTE: MUST ensure that acquisition is not running
@@ -93,7 +93,8 @@ private slots:
     void sltNewPlotArea();
 
     void sltCrashApp();
-    void sltTestSaveData();
+    void sltOpenCapture();
+    void sltExportCapture();
 
     // Status bar
     void sltSelectProbe();
@@ -8,6 +8,9 @@ WatchEntryPanel::WatchEntryPanel(IUiStateBridge *uiBridge, QWidget *parent) : m_
 
     m_plotAreaColumnDelegate = new PlotAreaColumnDelegate(uiBridge, this);
     ui->viewWatchEntry->setItemDelegateForColumn(WatchEntryModel::Columns::PlotAreas, m_plotAreaColumnDelegate);
+    m_overflowPolicyColumnDelegate = new OverflowPolicyColumnDelegate(this);
+    ui->viewWatchEntry->setItemDelegateForColumn(WatchEntryModel::Columns::OverflowPolicy,
+                                                 m_overflowPolicyColumnDelegate);
     ui->viewWatchEntry->setSelectionBehavior(QAbstractItemView::SelectRows);
 
     connect(ui->btnRemoveEntry, &QPushButton::clicked, this, &WatchEntryPanel::sltBtnRemoveEntryClicked);
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include "delegate/overflowpolicycolumndelegate.h"
 #include "delegate/plotareacolumndelegate.h"
 #include "ui_watchentrypanel.h"
 #include "uistatebridge.h"
@@ -25,5 +26,6 @@ private:
     IUiStateBridge *m_uiBridge;
 
     PlotAreaColumnDelegate *m_plotAreaColumnDelegate;
+    OverflowPolicyColumnDelegate *m_overflowPolicyColumnDelegate;
     QSet<int> m_selectedRows;
 };